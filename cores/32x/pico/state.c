@@ -584,6 +584,7 @@ readend:
 
   // due to dep from 68k cycles..
   Pico.t.m68c_frame_start = Pico.t.m68c_aim;
+  Pico.t.m68c_line_start = Pico.t.m68c_aim - 488; // last line of the frame
   if (PicoIn.AHW & PAHW_32X)
     Pico32xStateLoaded(0);
   if (PicoIn.AHW & PAHW_MCD)
@@ -37,6 +37,13 @@ static StateManager stateManager(&osystem);
 
 static int videoWidth, videoHeight;
 
+// The console as it was right after loading the game. Resetting goes back to
+// it in place instead of loading the game again, and loading a state starts
+// from a reset so that anything the state doesn't cover, such as the random
+// number generator, is the same every time.
+static string powerOnState;
+static uInt32 powerOnRandom;
+
 static retro_log_printf_t log_cb;
 static retro_video_refresh_t video_cb;
 static retro_input_poll_t input_poll_cb;
@@ -144,8 +151,18 @@ bool retro_serialize(void *data, size_t size)
     return true;
 }
 
+static void reset_console()
+{
+   Serializer state;
+   state.set(powerOnState);
+   stateManager.loadState(state);
+   console->system().randGenerator().setState(powerOnRandom);
+   console->system().reset();
+}
+
 bool retro_unserialize(const void *data, size_t size)
 {
+    reset_console();
     std::string s((const char*)data, size);
     Serializer state;
     state.set(s);
@@ -237,6 +254,12 @@ bool retro_load_game(const struct retro_game_info *info)
    videoWidth = tia.width();
    videoHeight = tia.height();
 
+   Serializer state;
+   if (!stateManager.saveState(state))
+      return false;
+   powerOnState = state.get();
+   powerOnRandom = console->system().randGenerator().state();
+
    return true;
 }
 
@@ -315,7 +338,7 @@ void retro_deinit(void)
 
 void retro_reset(void)
 {
-   console->system().reset();
+   reset_console();
 }
 
 void retro_run(void)
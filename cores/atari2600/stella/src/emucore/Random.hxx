@@ -54,6 +54,13 @@ class Random
     */
     uInt32 next();
 
+    /**
+      Answer the current state of the generator, or continue from a state
+      it had before, so that the numbers after it repeat
+    */
+    uInt32 state() const { return myValue; }
+    void setState(uInt32 value) { myValue = value; }
+
     /**
       Class method which sets the OSystem in use; the constructor will
       use this to reseed the random number generator every time a new
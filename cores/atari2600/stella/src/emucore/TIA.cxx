@@ -149,6 +149,10 @@ void TIA::reset()
   myBLMask = &TIATables::BLMask[0][0];
   myPFMask = TIATables::PFMask[0];
 
+  // Start a new frame, even if the last one was interrupted
+  myPartialFrameFlag = false;
+  myFramePointerClocks = 0;
+
   // Recalculate the size of the display
   toggleFixedColors(0);
   frameReset();
@@ -137,14 +137,15 @@ void GB::loadState(const void *data) {
 }
 
 void GB::saveState(void *data) {
-   SaveState state;
+   // Value-initialized: mappers leave the fields they don't use untouched
+   SaveState state = SaveState();
    p_->cpu.setStatePtrs(state);
    p_->cpu.saveState(state);
    StateSaver::saveState(state, data);
 }
 
 size_t GB::stateSize() const {
-   SaveState state;
+   SaveState state = SaveState();
    p_->cpu.setStatePtrs(state);
    p_->cpu.saveState(state);
    return StateSaver::stateSize(state);
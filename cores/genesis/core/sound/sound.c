@@ -53,6 +53,7 @@ static uint32 fm_cycles_count;
 /* YM chip function pointers */
 static void (*YM_Reset)(void);
 static void (*YM_Update)(int *buffer, int length);
+static void (*YM_Skip)(int *buffer, int length);
 static void (*YM_Write)(unsigned int a, unsigned int v);
 
 /* Run FM chip until required M-cycles */
@@ -63,8 +64,15 @@ INLINE void fm_update(unsigned int cycles)
     /* number of samples to run */
     unsigned int samples = (cycles - fm_cycles_count + fm_cycles_ratio - 1) / fm_cycles_ratio;
 
-    /* run FM chip to sample buffer */
-    YM_Update(fm_ptr, samples);
+    /* run FM chip to sample buffer (FM synthesis is skipped when sound is disabled) */
+    if (snd.enabled)
+    {
+      YM_Update(fm_ptr, samples);
+    }
+    else
+    {
+      YM_Skip(fm_ptr, samples);
+    }
 
     /* update FM buffer pointer */
     fm_ptr += (samples << 1);
@@ -84,6 +92,7 @@ void sound_init( void )
     YM2612Config(config.dac_bits);
     YM_Reset = YM2612ResetChip;
     YM_Update = YM2612Update;
+    YM_Skip = YM2612Skip;
     YM_Write = YM2612Write;
 
     /* chip is running at VCLK / 144 = MCLK / 7 / 144 */
@@ -95,6 +104,7 @@ void sound_init( void )
     YM2413Init();
     YM_Reset = YM2413ResetChip;
     YM_Update = YM2413Update;
+    YM_Skip = YM2413Update;
     YM_Write = YM2413Write;
 
     /* chip is running at ZCLK / 72 = MCLK / 15 / 72 */
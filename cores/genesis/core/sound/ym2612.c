@@ -1423,6 +1423,36 @@ INLINE signed int op_calc1(UINT32 phase, unsigned int env, unsigned int pm)
   return tl_tab[p];
 }
 
+/* update phase counters of one channel's operators */
+INLINE void update_phase_channel(FM_CH *CH)
+{
+  if(CH->pms)
+  {
+    /* 3-slot mode */
+    if ((ym2612.OPN.ST.mode & 0xC0) && (CH == &ym2612.CH[2]))
+    {
+      /* keyscale code is not modifiedby LFO */
+      UINT8 kc = ym2612.CH[2].kcode;
+      UINT32 pm = ym2612.CH[2].pms + ym2612.OPN.LFO_PM;
+      update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT1], pm, kc, ym2612.OPN.SL3.block_fnum[1]);
+      update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT2], pm, kc, ym2612.OPN.SL3.block_fnum[2]);
+      update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT3], pm, kc, ym2612.OPN.SL3.block_fnum[0]);
+      update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT4], pm, kc, ym2612.CH[2].block_fnum);
+    }
+    else
+    {
+      update_phase_lfo_channel(CH);
+    }
+  }
+  else  /* no LFO phase modulation */
+  {
+    CH->SLOT[SLOT1].phase += CH->SLOT[SLOT1].Incr;
+    CH->SLOT[SLOT2].phase += CH->SLOT[SLOT2].Incr;
+    CH->SLOT[SLOT3].phase += CH->SLOT[SLOT3].Incr;
+    CH->SLOT[SLOT4].phase += CH->SLOT[SLOT4].Incr;
+  }
+}
+
 INLINE void chan_calc(FM_CH *CH, int num)
 {
   do
@@ -1471,31 +1501,7 @@ INLINE void chan_calc(FM_CH *CH, int num)
     CH->mem_value = mem;
 
     /* update phase counters AFTER output calculations */
-    if(CH->pms)
-    {
-      /* 3-slot mode */
-      if ((ym2612.OPN.ST.mode & 0xC0) && (CH == &ym2612.CH[2]))
-      {
-        /* keyscale code is not modifiedby LFO */
-        UINT8 kc = ym2612.CH[2].kcode;
-        UINT32 pm = ym2612.CH[2].pms + ym2612.OPN.LFO_PM;
-        update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT1], pm, kc, ym2612.OPN.SL3.block_fnum[1]);
-        update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT2], pm, kc, ym2612.OPN.SL3.block_fnum[2]);
-        update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT3], pm, kc, ym2612.OPN.SL3.block_fnum[0]);
-        update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT4], pm, kc, ym2612.CH[2].block_fnum);
-      }
-      else
-      {
-        update_phase_lfo_channel(CH);
-      }
-    }
-    else  /* no LFO phase modulation */
-    {
-      CH->SLOT[SLOT1].phase += CH->SLOT[SLOT1].Incr;
-      CH->SLOT[SLOT2].phase += CH->SLOT[SLOT2].Incr;
-      CH->SLOT[SLOT3].phase += CH->SLOT[SLOT3].Incr;
-      CH->SLOT[SLOT4].phase += CH->SLOT[SLOT4].Incr;
-    }
+    update_phase_channel(CH);
 
     /* next channel */
     CH++;
@@ -1986,13 +1992,9 @@ unsigned int YM2612Read(void)
   return ym2612.OPN.ST.status & 0xff;
 }
 
-/* Generate samples for ym2612 */
-void YM2612Update(int *buffer, int length)
+/* refresh PG increments and EG rates if required */
+INLINE void refresh_fc_eg_chans(void)
 {
-  int i;
-  int lt,rt;
-
-  /* refresh PG increments and EG rates if required */
   refresh_fc_eg_chan(&ym2612.CH[0]);
   refresh_fc_eg_chan(&ym2612.CH[1]);
 
@@ -2015,6 +2017,55 @@ void YM2612Update(int *buffer, int length)
   refresh_fc_eg_chan(&ym2612.CH[3]);
   refresh_fc_eg_chan(&ym2612.CH[4]);
   refresh_fc_eg_chan(&ym2612.CH[5]);
+}
+
+/* advance LFO and envelope generator by one sample */
+INLINE void advance_lfo_eg(void)
+{
+  /* advance LFO */
+  advance_lfo();
+
+  /* advance envelope generator */
+  ym2612.OPN.eg_timer ++;
+
+  /* EG is updated every 3 samples */
+  if (ym2612.OPN.eg_timer >= 3)
+  {
+    ym2612.OPN.eg_timer = 0;
+    ym2612.OPN.eg_cnt++;
+    advance_eg_channels(&ym2612.CH[0], ym2612.OPN.eg_cnt);
+  }
+}
+
+/* timer A and CSM mode control, once per sample */
+INLINE void advance_timer_a(void)
+{
+  /* CSM mode: if CSM Key ON has occured, CSM Key OFF need to be sent       */
+  /* only if Timer A does not overflow again (i.e CSM Key ON not set again) */
+  ym2612.OPN.SL3.key_csm <<= 1;
+
+  /* timer A control */
+  INTERNAL_TIMER_A();
+
+  /* CSM Mode Key ON still disabled */
+  if (ym2612.OPN.SL3.key_csm & 2)
+  {
+    /* CSM Mode Key OFF (verified by Nemesis on real hardware) */
+    FM_KEYOFF_CSM(&ym2612.CH[2],SLOT1);
+    FM_KEYOFF_CSM(&ym2612.CH[2],SLOT2);
+    FM_KEYOFF_CSM(&ym2612.CH[2],SLOT3);
+    FM_KEYOFF_CSM(&ym2612.CH[2],SLOT4);
+    ym2612.OPN.SL3.key_csm = 0;
+  }
+}
+
+/* Generate samples for ym2612 */
+void YM2612Update(int *buffer, int length)
+{
+  int i;
+  int lt,rt;
+
+  refresh_fc_eg_chans();
 
   /* buffering */
   for(i=0; i < length ; i++)
@@ -2042,19 +2093,7 @@ void YM2612Update(int *buffer, int length)
       chan_calc(&ym2612.CH[0],5);
     }
 
-    /* advance LFO */
-    advance_lfo();
-
-    /* advance envelope generator */
-    ym2612.OPN.eg_timer ++;
-
-    /* EG is updated every 3 samples */
-    if (ym2612.OPN.eg_timer >= 3)
-    {
-      ym2612.OPN.eg_timer = 0;
-      ym2612.OPN.eg_cnt++;
-      advance_eg_channels(&ym2612.CH[0], ym2612.OPN.eg_cnt);
-    }
+    advance_lfo_eg();
 
     /* 14-bit accumulator channels outputs (range is -8192;+8192) */
     if (out_fm[0] > 8192) out_fm[0] = 8192;
@@ -2088,23 +2127,43 @@ void YM2612Update(int *buffer, int length)
     *buffer++ = lt;
     *buffer++ = rt;
 
-    /* CSM mode: if CSM Key ON has occured, CSM Key OFF need to be sent       */
-    /* only if Timer A does not overflow again (i.e CSM Key ON not set again) */
-    ym2612.OPN.SL3.key_csm <<= 1;
+    advance_timer_a();
+  }
+
+  /* timer B control */
+  INTERNAL_TIMER_B(length);
+}
+
+/* Same as YM2612Update, but only keeps the chip state (envelopes, LFO,  */
+/* timers, operator phases) running and outputs silence. Used when audio */
+/* is discarded. Operator feedback and the delayed MEM sample are not    */
+/* computed, so a state saved after skipping differs in those from one   */
+/* saved with audio on, and the first samples once audio is back can    */
+/* differ slightly. Nothing the CPU can read depends on them.            */
+void YM2612Skip(int *buffer, int length)
+{
+  int i, c;
 
-    /* timer A control */
-    INTERNAL_TIMER_A();
+  refresh_fc_eg_chans();
+
+  for(i=0; i < length ; i++)
+  {
+    /* update SSG-EG output */
+    update_ssg_eg_channels(&ym2612.CH[0]);
 
-    /* CSM Mode Key ON still disabled */
-    if (ym2612.OPN.SL3.key_csm & 2)
+    /* channel 6 has no operator output in DAC mode */
+    for (c = 0; c < (ym2612.dacen ? 5 : 6); c++)
     {
-      /* CSM Mode Key OFF (verified by Nemesis on real hardware) */
-      FM_KEYOFF_CSM(&ym2612.CH[2],SLOT1);
-      FM_KEYOFF_CSM(&ym2612.CH[2],SLOT2);
-      FM_KEYOFF_CSM(&ym2612.CH[2],SLOT3);
-      FM_KEYOFF_CSM(&ym2612.CH[2],SLOT4);
-      ym2612.OPN.SL3.key_csm = 0;
+      update_phase_channel(&ym2612.CH[c]);
     }
+
+    advance_lfo_eg();
+
+    /* no output */
+    *buffer++ = 0;
+    *buffer++ = 0;
+
+    advance_timer_a();
   }
 
   /* timer B control */
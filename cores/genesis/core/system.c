@@ -623,6 +623,10 @@ void system_frame_gen(int do_skip)
     {
       render_line(line);
     }
+    else
+    {
+      skip_line(line);
+    }
 
     /* update 6-Buttons & Lightguns */
     input_refresh();
@@ -970,6 +974,10 @@ void system_frame_scd(int do_skip)
     {
       render_line(line);
     }
+    else
+    {
+      skip_line(line);
+    }
 
     /* update 6-Buttons & Lightguns */
     input_refresh();
@@ -1376,6 +1384,10 @@ void system_frame_sms(int do_skip)
       {
         render_line(line);
       }
+      else
+      {
+        skip_line(line);
+      }
     }
 
     /* update 6-Buttons & Lightguns */
@@ -84,6 +84,7 @@ typedef struct
     int oh;         /* Previous height of viewport */
     int changed;    /* 1= Viewport width or height have changed */
   } viewport;
+  uint8 *index;     /* Palette index of each pixel, width bytes per line (optional) */
 } t_bitmap;
 
 typedef struct
@@ -4153,12 +4153,55 @@ void render_line(int line)
   remap_line(line);
 }
 
+void skip_line(int line)
+{
+  /* Same as render_line() without the background layers and pixel output: */
+  /* sprites are still drawn, into a blank line, so that collision, SOVR   */
+  /* and sprite masking flags are identical to a rendered line.            */
+  if (reg[1] & 0x40)
+  {
+    /* Update pattern cache */
+    if (bg_list_index)
+    {
+      update_bg_pattern_cache(bg_list_index);
+      bg_list_index = 0;
+    }
+
+    /* Clear line buffer (no sprite pixels) */
+    memset(&linebuf[0][0], 0, bitmap.viewport.w + 0x40);
+
+    /* Render sprite layer */
+    render_obj(line & 1);
+
+    /* Parse sprites for next line */
+    if (line < (bitmap.viewport.h - 1))
+    {
+      parse_satb(line);
+    }
+  }
+  else if (system_hw < SYSTEM_MD)
+  {
+    /* Update SOVR flag */
+    status |= spr_ovr;
+    spr_ovr = 0;
+
+    /* Sprites are still parsed when display is disabled */
+    parse_satb(line);
+  }
+}
+
 void blank_line(int line, int offset, int width)
 {
   memset(&linebuf[0][0x20 + offset], 0x40, width);
   remap_line(line);
 }
 
+/* Pixel colors in the output format, indexed by VDP pixel data */
+const void *render_palette(void)
+{
+  return pixel;
+}
+
 void remap_line(int line)
 {
   /* Line width */
@@ -4179,6 +4222,12 @@ void remap_line(int line)
     line = (line * 2) + odd_frame;
   }
 
+  /* Keep the palette indices before they are converted */
+  if (bitmap.index)
+  {
+    memcpy(&bitmap.index[line * bitmap.width], src, width);
+  }
+
 #if defined(USE_15BPP_RENDERING) || defined(USE_16BPP_RENDERING)
   /* NTSC Filter (only supported for 15 or 16-bit pixels rendering) */
   if (config.ntsc)
@@ -105,8 +105,10 @@ extern uint16 spr_col;
 extern void render_init(void);
 extern void render_reset(void);
 extern void render_line(int line);
+extern void skip_line(int line);
 extern void blank_line(int line, int offset, int width);
 extern void remap_line(int line);
+extern const void *render_palette(void);
 extern void window_clip(unsigned int data, unsigned int sw);
 extern void render_bg_m0(int line);
 extern void render_bg_m1(int line);
@@ -113,6 +113,7 @@ static bool is_running = 0;
 static uint8_t temp[0x10000];
 static int16 soundbuffer[3068];
 static uint16_t bitmap_data_[720 * 576];
+static uint8_t bitmap_index_[720 * 576];
 
 static bool restart_eq = false;
 
@@ -494,6 +495,7 @@ static void init_bitmap(void)
    bitmap.height     = 576;
    bitmap.pitch      = 720 * 2;
    bitmap.data       = (uint8_t *)bitmap_data_;
+   bitmap.index      = bitmap_index_;
 }
 
 static void config_default(void)
@@ -2280,17 +2282,33 @@ void retro_reset(void)
    gen_reset(0);
 }
 
+/* stable-retro extension: the last frame as indices into the VDP palette,
+ * laid out like the frame passed to video_cb */
+const uint8_t *retro_get_indexed_frame(size_t *pitch, const void **palette)
+{
+   *pitch   = bitmap.width;
+   *palette = render_palette();
+   return bitmap.index;
+}
+
 void retro_run(void)
 {
    bool updated = false;
+   int av_enable = 3;
+   int do_skip;
    is_running = true;
 
+   if (!environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable))
+      av_enable = 3;
+   do_skip = !(av_enable & 1);
+   snd.enabled = (av_enable & 2) ? 1 : 0;
+
    if (system_hw == SYSTEM_MCD)
-      system_frame_scd(0);
+      system_frame_scd(do_skip);
    else if ((system_hw & SYSTEM_PBC) == SYSTEM_MD)
-      system_frame_gen(0);
+      system_frame_gen(do_skip);
    else
-      system_frame_sms(0);
+      system_frame_sms(do_skip);
 
    if (bitmap.viewport.changed & 9)
    {
@@ -2332,7 +2350,10 @@ void retro_run(void)
       }
    }
 
-   video_cb(bitmap.data, vwidth, vheight, 720 * 2);
+   if (do_skip)
+      video_cb(NULL, vwidth, vheight, 720 * 2);
+   else
+      video_cb(bitmap.data, vwidth, vheight, 720 * 2);
    audio_cb(soundbuffer, audio_update(soundbuffer));
 
    environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated);
@@ -1294,25 +1294,50 @@ static void retro_run_blit(uint8_t *gfx)
 
 }
 
+/* stable-retro extension: the last frame as indices into retro_palette,
+ * cropped like the frame passed to video_cb. The palette is left NULL when
+ * the raw palette is in use, since the indices then also need the
+ * emphasis bits to be meaningful. */
+const uint8_t *retro_get_indexed_frame(size_t *pitch, const void **palette)
+{
+   if (!XBuf)
+      return NULL;
+
+   *pitch   = 256;
+   *palette = use_raw_palette ? NULL : retro_palette;
+   if (!use_overscan)
+      return XBuf + 8 + 256 * 8;
+   return XBuf;
+}
+
 void retro_run(void)
 {
    unsigned i;
    uint8_t *gfx;
    int32_t ssize = 0;
    bool updated = false;
+   int av_enable = 3;
+   int skip;
 
    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated)
       check_variables(false);
 
+   if (!environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable))
+      av_enable = 3;
+   skip = !(av_enable & 1);
+
    FCEUD_UpdateInput();
-   FCEUI_Emulate(&gfx, &sound, &ssize, 0);
+   FCEUI_Emulate(&gfx, &sound, &ssize, skip);
 
    for (i = 0; i < ssize; i++)
       sound[i] = (sound[i] << 16) | (sound[i] & 0xffff);
 
    audio_batch_cb((const int16_t*)sound, ssize);
 
-   retro_run_blit(gfx);
+   if (skip)
+      video_cb(NULL, 0, 0, 0);
+   else
+      retro_run_blit(gfx);
 }
 
 static unsigned serialize_size = 0;
@@ -281,6 +281,12 @@ static void S9xAudioCallback(void*)
    static int16_t audio_buf[0x20000];
 
    S9xFinalizeSamples();
+   if (Settings.Mute)
+   {
+      // Nothing to output, only drop what was left over from before muting
+      S9xClearSamples();
+      return;
+   }
    size_t avail = S9xGetSampleCount();
    S9xMixSamples((uint8*)audio_buf, avail);
    audio_batch_cb(audio_buf,avail >> 1);
@@ -975,6 +981,12 @@ void retro_run()
       update_geometry();
       height = PPU.ScreenHeight;
    }
+   int av_enable = 3;
+   if (!environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable))
+      av_enable = 3;
+   IPPU.RenderThisFrame = (av_enable & 1) ? TRUE : FALSE;
+   S9xSetSoundMute((av_enable & 2) ? FALSE : TRUE);
+
    poll_cb();
    report_buttons();
    S9xMainLoop();
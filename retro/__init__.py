@@ -2,7 +2,18 @@ import os
 import sys
 
 import retro.data
-from retro._retro import Movie, RetroEmulator, core_path
+from retro._retro import (
+    AudioFeatures,
+    DeltaState,
+    FrameStack,
+    Movie,
+    RetroEmulator,
+    RewindBuffer,
+    StateArena,
+    VecRetroEmulator,
+    cached_state,
+    core_path,
+)
 from retro.enums import Actions, Observations, State
 from retro.retro_env import RetroEnv
 
@@ -16,6 +27,13 @@ with open(os.path.join(os.path.dirname(__file__), "VERSION.txt")) as f:
 __all__ = [
     "Movie",
     "RetroEmulator",
+    "VecRetroEmulator",
+    "FrameStack",
+    "AudioFeatures",
+    "StateArena",
+    "DeltaState",
+    "RewindBuffer",
+    "cached_state",
     "Actions",
     "State",
     "Observations",
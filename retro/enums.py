@@ -18,6 +18,7 @@ class Observations(Enum):
 
     IMAGE = 0  #: Use RGB image observations
     RAM = 1  #: Use RAM observations where you can see the memory of the game instead of the screen
+    INDEXED = 2  #: Use the screen as palette indices, on consoles that draw through a palette
 
 
 class Actions(Enum):
@@ -12,7 +12,6 @@ back.
 import argparse
 import random
 
-import gymnasium as gym
 import numpy as np
 from gymnasium.wrappers.time_limit import TimeLimit
 
@@ -21,27 +20,6 @@ import retro
 EXPLORATION_PARAM = 0.005
 
 
-class Frameskip(gym.Wrapper):
-    def __init__(self, env, skip=4):
-        super().__init__(env)
-        self._skip = skip
-
-    def reset(self):
-        return self.env.reset()
-
-    def step(self, act):
-        total_rew = 0.0
-        terminated = False
-        truncated = False
-        for i in range(self._skip):
-            obs, rew, terminated, truncated, info = self.env.step(act)
-            total_rew += rew
-            if terminated or truncated:
-                break
-
-        return obs, total_rew, terminated, truncated, info
-
-
 class Node:
     def __init__(self, value=-np.inf, children=None):
         self.value = value
@@ -182,8 +160,8 @@ def brute_retro(
         state,
         use_restricted_actions=retro.Actions.DISCRETE,
         scenario=scenario,
+        frameskip=4,
     )
-    env = Frameskip(env)
     env = TimeLimit(env, max_episode_steps=max_episode_steps)
 
     brute = Brute(env, max_episode_steps=max_episode_steps)
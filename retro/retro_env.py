@@ -1,5 +1,3 @@
-import gc
-import gzip
 import json
 import os
 
@@ -33,6 +31,14 @@ class RetroEnv(gym.Env):
         inttype=retro.data.Integrations.STABLE,
         obs_type=retro.Observations.IMAGE,
         render_mode="human",
+        frameskip=1,
+        grayscale=False,
+        downsample=1,
+        interlace=False,
+        size=None,
+        max_pool=False,
+        frame_stack=None,
+        render_every_frame=False,
     ):
         if not hasattr(self, "spec"):
             self.spec = None
@@ -44,6 +50,19 @@ class RetroEnv(gym.Env):
         self.statename = state
         self.initial_state = None
         self.players = players
+        if frameskip < 1:
+            raise ValueError("frameskip must be at least 1")
+        self.frameskip = frameskip
+        # Converted straight from the core's framebuffer in one pass
+        self.screen_format = {
+            "grayscale": grayscale,
+            "downsample": downsample,
+            "interlace": interlace,
+            "size": size,
+            "max_pool": max_pool,
+        }
+        # Image observations are the last frame_stack screens if it is set
+        self.frame_stack = None
 
         # Don't return multiple rewards in multiplayer mode by default
         # as stable-baselines3 vectorized environments doesn't support it
@@ -75,6 +94,8 @@ class RetroEnv(gym.Env):
             self.load_state(self.statename, inttype)
 
         self.data = retro.data.GameData()
+        # Render the frames a step skips too, in case the scenario ends on one
+        self.data.render_every_frame = render_every_frame
 
         if info is None:
             info = "data"
@@ -96,11 +117,10 @@ class RetroEnv(gym.Env):
 
         self.system = retro.get_romfile_system(rom_path)
 
-        # We can't have more than one emulator per process. Before creating an
-        # emulator, ensure that unused ones are garbage-collected
-        gc.collect()
         self.em = retro.RetroEmulator(rom_path)
         self.em.configure_data(self.data)
+        # Steps run one frame at a time still need the screen before the last
+        self.em.max_pool = max_pool
         self.em.step()
 
         core = retro.get_system_info(self.system)
@@ -133,10 +153,19 @@ class RetroEnv(gym.Env):
             self.action_space = gym.spaces.MultiBinary(self.num_buttons * players)
 
         if self._obs_type == retro.Observations.RAM:
+            if frame_stack:
+                raise ValueError("Only image observations can be stacked")
             shape = self.get_ram().shape
         else:
             img = [self.get_screen(p) for p in range(players)]
             shape = img[0].shape
+            if frame_stack:
+                self.frame_stack = retro.FrameStack(frame_stack, shape)
+                shape = self.frame_stack.shape
+                # Stacked observations are copied into these in turn, so each
+                # one stays as it is until the step after the one returning it
+                self._stacked = [np.zeros(shape, np.uint8) for _ in range(2)]
+                self._next_stacked = 0
         self.observation_space = gym.spaces.Box(
             low=0,
             high=255,
@@ -154,37 +183,45 @@ class RetroEnv(gym.Env):
             self.auto_record(record)
 
         self.render_mode = render_mode
+        # Let the core skip rendering when nothing is going to look at the screen
+        self.em.video_enabled = self._obs_type != retro.Observations.RAM or render_mode is not None
+
+    def _stack_out(self):
+        if not self.frame_stack:
+            return None
+        out = self._stacked[self._next_stacked]
+        self._next_stacked ^= 1
+        return out
 
     def _update_obs(self):
         if self._obs_type == retro.Observations.RAM:
             self.ram = self.get_ram()
             return self.ram
-        elif self._obs_type == retro.Observations.IMAGE:
-            self.img = self.get_screen()
+        elif self._obs_type in (retro.Observations.IMAGE, retro.Observations.INDEXED):
+            if self.frame_stack:
+                self.img = self.em.get_screen(
+                    crop=self.data.crop_info(),
+                    stack=self.frame_stack,
+                    out=self._stack_out(),
+                    indexed=self._obs_type == retro.Observations.INDEXED,
+                    **self.screen_format,
+                )
+            else:
+                self.img = self.get_screen()
             return self.img
         else:
             raise ValueError(f"Unrecognized observation type: {self._obs_type}")
 
     def action_to_array(self, a):
+        # Decoded natively, the same way step() does it
+        masks = self.data.decode_action(
+            a,
+            self.use_restricted_actions.value,
+            self.players,
+            self.num_buttons,
+        )
         actions = []
-        for p in range(self.players):
-            action = 0
-            if self.use_restricted_actions == retro.Actions.DISCRETE:
-                for combo in self.button_combos:
-                    current = a % len(combo)
-                    a //= len(combo)
-                    action |= combo[current]
-            elif self.use_restricted_actions == retro.Actions.MULTI_DISCRETE:
-                ap = a[self.num_buttons * p : self.num_buttons * (p + 1)]
-                for i in range(len(ap)):
-                    buttons = self.button_combos[i]
-                    action |= buttons[ap[i]]
-            else:
-                ap = a[self.num_buttons * p : self.num_buttons * (p + 1)]
-                for i in range(len(ap)):
-                    action |= int(ap[i]) << i
-                if self.use_restricted_actions == retro.Actions.FILTERED:
-                    action = self.data.filter_action(action)
+        for action in masks:
             ap = np.zeros([self.num_buttons], np.uint8)
             for i in range(self.num_buttons):
                 ap[i] = (action >> i) & 1
@@ -195,23 +232,61 @@ class RetroEnv(gym.Env):
         if self.img is None and self.ram is None:
             raise RuntimeError("Please call env.reset() before env.step()")
 
+        if self.movie or type(self).compute_step is not RetroEnv.compute_step:
+            ob, rew, done, info = self._step_frames(a)
+        else:
+            # Decode the action, run the frames and collect the results in one native call
+            ob, rewards, done, info = self.em.step_action(
+                self.data,
+                a,
+                self.use_restricted_actions.value,
+                self.players,
+                self.frameskip,
+                self._obs_type.value,
+                stack=self.frame_stack,
+                out=self._stack_out(),
+                **self.screen_format,
+            )
+            if self._obs_type == retro.Observations.RAM:
+                self.ram = ob
+            else:
+                self.img = ob
+            if self.players > 1 and self.multi_rewards:
+                rew = rewards
+            else:
+                rew = rewards[0]
+            info = dict(info)
+
+        if self.render_mode == "human":
+            self.render()
+
+        return ob, rew, bool(done), False, info
+
+    def _step_frames(self, a):
+        # Run one frame at a time when a movie needs to see every frame or a
+        # subclass computes the step results itself
         for p, ap in enumerate(self.action_to_array(a)):
             if self.movie:
                 for i in range(self.num_buttons):
                     self.movie.set_key(i, ap[i], p)
             self.em.set_button_mask(ap, p)
 
-        if self.movie:
-            self.movie.step()
-        self.em.step()
-        self.data.update_ram()
-        ob = self._update_obs()
-        rew, done, info = self.compute_step()
-
-        if self.render_mode == "human":
-            self.render()
-
-        return ob, rew, bool(done), False, dict(info)
+        rew = None
+        for _ in range(self.frameskip):
+            if self.movie:
+                self.movie.step()
+            self.em.step()
+            self.data.update_ram()
+            frame_rew, done, info = self.compute_step()
+            if rew is None:
+                rew = frame_rew
+            elif self.players > 1 and self.multi_rewards:
+                rew = [total + r for total, r in zip(rew, frame_rew)]
+            else:
+                rew += frame_rew
+            if done:
+                break
+        return self._update_obs(), rew, done, info
 
     def reset(self, seed=None, options=None):
         super().reset(seed=seed)
@@ -234,6 +309,8 @@ class RetroEnv(gym.Env):
             self.movie.step()
         self.data.reset()
         self.data.update_ram()
+        if self.frame_stack:
+            self.frame_stack.reset()
 
         if self.render_mode == "human":
             self.render()
@@ -243,7 +320,17 @@ class RetroEnv(gym.Env):
     def render(self):
         mode = self.render_mode
 
-        img = self.get_screen() if self.img is None else self.img
+        if (
+            self.img is None
+            or self.frame_stack
+            or self._obs_type == retro.Observations.INDEXED
+            or self.screen_format["grayscale"]
+            or self.screen_format["size"]
+            or self.screen_format["max_pool"]
+        ):
+            img = self.em.get_screen()
+        else:
+            img = self.img
         if mode == "rgb_array":
             return img
         elif mode == "human":
@@ -274,36 +361,23 @@ class RetroEnv(gym.Env):
         self.data.set_value(name, val)
 
     def get_ram(self):
-        blocks = []
-        for offset in sorted(self.data.memory.blocks):
-            arr = np.frombuffer(self.data.memory.blocks[offset], dtype=np.uint8)
-            blocks.append(arr)
-        return np.concatenate(blocks)
+        return self.data.memory.pack()
 
     def get_screen(self, player=0):
-        img = self.em.get_screen()
-        x, y, w, h = self.data.crop_info(player)
-        if not w or x + w > img.shape[1]:
-            w = img.shape[1]
-        else:
-            w += x
-        if not h or y + h > img.shape[0]:
-            h = img.shape[0]
-        else:
-            h += y
-        if x == 0 and y == 0 and w == img.shape[1] and h == img.shape[0]:
-            return img
-        return img[y:h, x:w]
+        return self.em.get_screen(
+            crop=self.data.crop_info(player),
+            indexed=self._obs_type == retro.Observations.INDEXED,
+            **self.screen_format,
+        )
 
     def load_state(self, statename, inttype=retro.data.Integrations.DEFAULT):
         if not statename.endswith(".state"):
             statename += ".state"
 
-        with gzip.open(
+        # Decompressed once per process and shared by every env using it
+        self.initial_state = retro.cached_state(
             retro.data.get_file_path(self.gamename, statename, inttype),
-            "rb",
-        ) as fh:
-            self.initial_state = fh.read()
+        )
 
         self.statename = statename
 
@@ -0,0 +1,245 @@
+#include "audioops.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+using namespace Retro;
+using namespace std;
+
+static const double PI = 3.14159265358979323846;
+
+static double hzToMel(double hz) {
+	return 2595.0 * log10(1.0 + hz / 700.0);
+}
+
+static double melToHz(double mel) {
+	return 700.0 * (pow(10.0, mel / 2595.0) - 1.0);
+}
+
+AudioFeatures::AudioFeatures(Kind kind, double rate, size_t rows, size_t fftSize, size_t hop, size_t bins)
+	: m_kind(kind)
+	, m_rate(rate)
+	, m_rows(rows)
+	, m_fftSize(fftSize)
+	, m_hop(hop ? hop : fftSize / 2) {
+	if (!(rate > 0)) {
+		throw invalid_argument("Sample rate must be positive");
+	}
+	if (!rows) {
+		throw invalid_argument("At least one row must be kept");
+	}
+	switch (kind) {
+	case Kind::SAMPLES:
+		m_columns = 1;
+		break;
+	case Kind::STFT:
+	case Kind::MEL:
+		if (fftSize < 2 || (fftSize & (fftSize - 1))) {
+			throw invalid_argument("FFT size must be a power of 2");
+		}
+		if (m_hop > fftSize) {
+			throw invalid_argument("Hop must not be longer than the FFT");
+		}
+		m_columns = kind == Kind::STFT ? fftSize / 2 + 1 : bins;
+		if (kind == Kind::MEL && (!bins || bins > fftSize / 2)) {
+			throw invalid_argument("There must be between 1 and half the FFT size mel bands");
+		}
+		break;
+	default:
+		throw invalid_argument("Unknown audio feature kind");
+	}
+	m_buffer.assign(m_rows * m_columns * 2, 0);
+	if (kind == Kind::SAMPLES) {
+		return;
+	}
+
+	m_frame.resize(fftSize);
+	m_window.resize(fftSize);
+	for (size_t i = 0; i < fftSize; ++i) {
+		m_window[i] = 0.5 - 0.5 * cos(2 * PI * i / fftSize);
+	}
+	size_t bits = 0;
+	while ((size_t(1) << bits) < fftSize) {
+		++bits;
+	}
+	m_reversed.resize(fftSize);
+	for (size_t i = 0; i < fftSize; ++i) {
+		size_t reversed = 0;
+		for (size_t b = 0; b < bits; ++b) {
+			reversed |= ((i >> b) & 1) << (bits - 1 - b);
+		}
+		m_reversed[i] = reversed;
+	}
+	m_twiddleReal.resize(fftSize / 2);
+	m_twiddleImag.resize(fftSize / 2);
+	for (size_t i = 0; i < fftSize / 2; ++i) {
+		m_twiddleReal[i] = cos(2 * PI * i / fftSize);
+		m_twiddleImag[i] = -sin(2 * PI * i / fftSize);
+	}
+	m_real.resize(fftSize);
+	m_imag.resize(fftSize);
+	m_power.resize(fftSize / 2 + 1);
+	m_row.resize(m_columns);
+
+	if (kind == Kind::MEL) {
+		double top = hzToMel(rate / 2);
+		for (size_t band = 0; band < bins; ++band) {
+			double low = melToHz(top * band / (bins + 1));
+			double center = melToHz(top * (band + 1) / (bins + 1));
+			double high = melToHz(top * (band + 2) / (bins + 1));
+			size_t start = 0;
+			vector<float> weights;
+			for (size_t k = 0; k <= fftSize / 2; ++k) {
+				double hz = k * rate / fftSize;
+				if (hz <= low || hz >= high) {
+					continue;
+				}
+				if (weights.empty()) {
+					start = k;
+				}
+				weights.resize(k - start + 1);
+				weights[k - start] = hz <= center ? (hz - low) / (center - low) : (high - hz) / (high - center);
+			}
+			if (weights.empty()) {
+				// Bands narrower than the FFT's resolution take the nearest bin
+				start = min<size_t>(lround(center * fftSize / rate), fftSize / 2);
+				weights.push_back(1);
+			}
+			m_melStart.push_back(start);
+			m_melWeights.emplace_back(move(weights));
+		}
+	}
+}
+
+void AudioFeatures::push(const int16_t* stereo, size_t frames, double inputRate) {
+	if (!frames || !(inputRate > 0)) {
+		return;
+	}
+	if (m_inputSize + frames > m_input.size()) {
+		size_t capacity = max<size_t>(m_input.size(), 1024);
+		while (capacity < m_inputSize + frames) {
+			capacity *= 2;
+		}
+		vector<float> input(capacity);
+		for (size_t i = 0; i < m_inputSize; ++i) {
+			input[i] = this->input(i);
+		}
+		m_input.swap(input);
+		m_inputStart = 0;
+	}
+	size_t mask = m_input.size() - 1;
+	for (size_t i = 0; i < frames; ++i) {
+		m_input[(m_inputStart + m_inputSize + i) & mask] = (stereo[i * 2] + stereo[i * 2 + 1]) * (0.5f / 32768.f);
+	}
+	m_inputSize += frames;
+
+	// Shrinking averages the input each output sample covers, and growing
+	// interpolates linearly between input samples
+	double step = inputRate / m_rate;
+	double available = m_inputSize;
+	if (step >= 1) {
+		while (m_position + step <= available) {
+			double start = m_position;
+			double end = m_position + step;
+			double sum = 0;
+			for (size_t i = start; i < end; ++i) {
+				sum += input(i) * (min<double>(end, i + 1) - max<double>(start, i));
+			}
+			addSample(sum / step);
+			m_position = end;
+		}
+	} else {
+		while (m_position + 1 < available) {
+			size_t i = m_position;
+			float fraction = m_position - i;
+			addSample(input(i) + (input(i + 1) - input(i)) * fraction);
+			m_position += step;
+		}
+	}
+	size_t used = min<size_t>(m_position, m_inputSize);
+	m_inputStart = (m_inputStart + used) & mask;
+	m_inputSize -= used;
+	m_position -= used;
+}
+
+void AudioFeatures::reset() {
+	m_inputStart = 0;
+	m_inputSize = 0;
+	m_position = 0;
+	m_frameStart = 0;
+	m_frameSize = 0;
+	m_next = 0;
+	fill(m_buffer.begin(), m_buffer.end(), 0);
+}
+
+void AudioFeatures::addSample(float sample) {
+	if (m_kind == Kind::SAMPLES) {
+		addRow(&sample);
+		return;
+	}
+	m_frame[(m_frameStart + m_frameSize) & (m_fftSize - 1)] = sample;
+	if (++m_frameSize == m_fftSize) {
+		transform();
+		m_frameStart = (m_frameStart + m_hop) & (m_fftSize - 1);
+		m_frameSize -= m_hop;
+	}
+}
+
+void AudioFeatures::addRow(const float* row) {
+	float* slot = &m_buffer[m_next * m_columns];
+	memcpy(slot, row, m_columns * sizeof(float));
+	memcpy(&slot[m_rows * m_columns], row, m_columns * sizeof(float));
+	m_next = (m_next + 1) % m_rows;
+}
+
+void AudioFeatures::transform() {
+	size_t n = m_fftSize;
+	for (size_t i = 0; i < n; ++i) {
+		m_real[m_reversed[i]] = m_frame[(m_frameStart + i) & (n - 1)] * m_window[i];
+		m_imag[i] = 0;
+	}
+	float* real = m_real.data();
+	float* imag = m_imag.data();
+	for (size_t size = 2; size <= n; size *= 2) {
+		size_t half = size / 2;
+		size_t stride = n / size;
+		for (size_t start = 0; start < n; start += size) {
+			float* ar = &real[start];
+			float* ai = &imag[start];
+			float* br = &real[start + half];
+			float* bi = &imag[start + half];
+			for (size_t k = 0; k < half; ++k) {
+				float wr = m_twiddleReal[k * stride];
+				float wi = m_twiddleImag[k * stride];
+				float tr = wr * br[k] - wi * bi[k];
+				float ti = wr * bi[k] + wi * br[k];
+				br[k] = ar[k] - tr;
+				bi[k] = ai[k] - ti;
+				ar[k] += tr;
+				ai[k] += ti;
+			}
+		}
+	}
+	for (size_t k = 0; k <= n / 2; ++k) {
+		m_power[k] = real[k] * real[k] + imag[k] * imag[k];
+	}
+
+	if (m_kind == Kind::STFT) {
+		for (size_t k = 0; k <= n / 2; ++k) {
+			m_row[k] = sqrt(m_power[k]);
+		}
+	} else {
+		for (size_t band = 0; band < m_columns; ++band) {
+			const vector<float>& weights = m_melWeights[band];
+			const float* power = &m_power[m_melStart[band]];
+			float energy = 0;
+			for (size_t k = 0; k < weights.size(); ++k) {
+				energy += weights[k] * power[k];
+			}
+			m_row[band] = log(energy + 1e-10f);
+		}
+	}
+	addRow(m_row.data());
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace Retro {
+
+// Turns stereo samples into features for audio observations as they arrive:
+// a mono downmix, resampled to a fixed rate, and optionally cut into
+// overlapping windows that are transformed into a magnitude spectrogram or
+// log-mel energies. The most recent rows are kept contiguous, oldest first,
+// in the same mirrored layout as a FrameStack.
+class AudioFeatures {
+public:
+	enum class Kind {
+		SAMPLES,
+		STFT,
+		MEL
+	};
+
+	// rows is how many samples or spectrogram frames are kept. Spectrograms
+	// take a frame of fftSize samples, which must be a power of 2, every hop
+	// samples; MEL groups each frame into bins mel bands.
+	AudioFeatures(Kind, double rate, size_t rows, size_t fftSize = 0, size_t hop = 0, size_t bins = 0);
+
+	Kind kind() const { return m_kind; }
+	double rate() const { return m_rate; }
+	size_t rows() const { return m_rows; }
+	// 1 for samples, fftSize / 2 + 1 for STFT, or bins for MEL
+	size_t columns() const { return m_columns; }
+
+	// Adds frames interleaved stereo samples recorded at inputRate
+	void push(const int16_t* stereo, size_t frames, double inputRate);
+
+	// The last rows() rows, oldest first. Rows that haven't been filled yet
+	// are zero. Pushing samples changes what this points to.
+	const float* features() const { return &m_buffer[m_next * m_columns]; }
+
+	// Forgets all samples and rows
+	void reset();
+
+private:
+	void addSample(float);
+	void addRow(const float*);
+	void transform();
+
+	float input(size_t i) const { return m_input[(m_inputStart + i) & (m_input.size() - 1)]; }
+
+	Kind m_kind;
+	double m_rate;
+	size_t m_rows;
+	size_t m_columns;
+	size_t m_fftSize;
+	size_t m_hop;
+
+	// Mono input not yet resampled, in a ring whose size is a power of 2, and
+	// where the next output sample starts in it
+	std::vector<float> m_input;
+	size_t m_inputStart = 0;
+	size_t m_inputSize = 0;
+	double m_position = 0;
+
+	// Samples of the spectrogram frame being collected, in a ring of fftSize
+	std::vector<float> m_frame;
+	size_t m_frameStart = 0;
+	size_t m_frameSize = 0;
+	std::vector<float> m_window;
+	std::vector<size_t> m_reversed;
+	// A scalar radix-2 FFT over separate real and imaginary arrays
+	std::vector<float> m_twiddleReal;
+	std::vector<float> m_twiddleImag;
+	std::vector<float> m_real;
+	std::vector<float> m_imag;
+	std::vector<float> m_power;
+	// Each mel band is a triangle over the power spectrum, starting at
+	// m_melStart with weights m_melWeights
+	std::vector<size_t> m_melStart;
+	std::vector<std::vector<float>> m_melWeights;
+	std::vector<float> m_row;
+
+	size_t m_next = 0;
+	std::vector<float> m_buffer;
+};
+}
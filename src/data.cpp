@@ -155,6 +155,7 @@ string GameData::dataPath(const string& hint) {
 
 void GameData::reset() {
 	restart();
+	++m_generation;
 	m_lastMem.reset();
 	m_cloneMem.reset();
 	m_vars.clear();
@@ -187,7 +188,7 @@ void GameData::setActions(const vector<vector<vector<string>>>& actions) {
 	::setActions(m_buttons, actions, m_actions);
 }
 
-map<int, set<int>> GameData::validActions() const {
+const map<int, set<int>>& GameData::validActions() const {
 	return m_actions;
 }
 
@@ -309,12 +310,14 @@ Variable GameData::getVariable(const string& name) const {
 void GameData::setVariable(const string& name, const Variable& var) {
 	removeVariable(name);
 	m_vars.emplace(name, var);
+	++m_generation;
 }
 
 void GameData::removeVariable(const string& name) {
 	auto iter = m_vars.find(name);
 	if (iter != m_vars.end()) {
 		m_vars.erase(iter);
+		++m_generation;
 	}
 }
 
@@ -382,6 +385,59 @@ void GameData::removeSearch(const string& name) {
 	}
 }
 
+VariableVector::VariableVector(const GameData& data, const vector<string>& names)
+	: m_data(&data)
+	, m_generation(data.generation())
+	, m_names(names) {
+	for (const auto& name : names) {
+		if (data.m_customVars.find(name) != data.m_customVars.end()) {
+			m_entries.push_back(Entry{ nullptr, Variable{ "|u1", 0 } });
+			continue;
+		}
+		auto var = data.m_vars.find(name);
+		if (var == data.m_vars.end()) {
+			throw invalid_argument(name);
+		}
+		const Variable& v = var->second;
+		const MemoryView<>* block = nullptr;
+		size_t start = 0;
+		for (const auto& kv : data.m_mem.blocks()) {
+			if (v.address >= kv.first && v.address - kv.first < kv.second.size()) {
+				block = &kv.second;
+				start = kv.first;
+				break;
+			}
+		}
+		if (!block || v.address - start + v.type.width > block->size()) {
+			throw out_of_range(name);
+		}
+		m_entries.push_back(Entry{ block, Variable{ v.type, v.address - start, v.mask } });
+	}
+}
+
+template<typename T>
+void VariableVector::read(T* out) const {
+	if (m_data->generation() != m_generation) {
+		throw runtime_error("The variables or the memory changed since they were compiled");
+	}
+	for (size_t i = 0; i < m_entries.size(); ++i) {
+		const Entry& entry = m_entries[i];
+		if (entry.block) {
+			out[i] = m_data->m_mem.read(*entry.block, entry.var);
+			continue;
+		}
+		auto custom = m_data->m_customVars.find(m_names[i]);
+		if (custom == m_data->m_customVars.end()) {
+			throw invalid_argument(m_names[i]);
+		}
+		out[i] = custom->second->cast<T>();
+	}
+}
+
+template void VariableVector::read(int64_t*) const;
+template void VariableVector::read(float*) const;
+template void VariableVector::read(double*) const;
+
 Scenario::Scenario(GameData& data)
 	: m_data(data) {
 	reset();
@@ -465,6 +521,8 @@ bool Scenario::load(istream* file, const std::string& path) {
 	}
 
 	reset();
+	m_scripts.clear();
+	m_contexts.clear();
 
 	const auto& reward = const_cast<const json&>(manifest).find("reward");
 	if (reward != manifest.cend()) {
@@ -555,7 +613,7 @@ bool Scenario::load(istream* file, const std::string& path) {
 	if (crops != manifest.cend()) {
 		for (unsigned i = 0; i < MAX_PLAYERS; ++i) {
 			if (i < crops->size()) {
-				CropInfo cropInfo{ crops[i][0], crop[i][1], crop[i][2], crop[i][3] };
+				CropInfo cropInfo{ (*crops)[i][0], (*crops)[i][1], (*crops)[i][2], (*crops)[i][3] };
 				m_crops[i] = cropInfo;
 			} else {
 				m_crops[i] = {};
@@ -784,12 +842,16 @@ void Scenario::reset() {
 }
 
 bool Scenario::loadScript(const string& filename, const string& scope) {
-	auto context = ScriptContext::get(scope);
+	auto context = scriptContext(scope);
 	if (!context) {
-		return false;
+		context = ScriptContext::create(scope);
+		if (!context) {
+			return false;
+		}
+		context->setData(&m_data);
+		context->setScenario(this);
+		m_contexts[scope] = context;
 	}
-	context->setData(&m_data);
-	context->setScenario(this);
 	string path = filename;
 	if (filename[0] == '/') {
 		size_t prefixLength;
@@ -819,16 +881,16 @@ bool Scenario::loadScript(const string& filename, const string& scope) {
 }
 
 void Scenario::reloadScripts() {
-	ScriptContext::reset();
-
+	// The contexts stay alive and rerun the chunks they compiled already, so
+	// this doesn't touch the filesystem
+	for (const auto& context : m_contexts) {
+		context.second->restart();
+	}
 	for (const auto& script : m_scripts) {
-		auto context = ScriptContext::get(script.second);
-		if (!context) {
-			continue;
+		auto context = scriptContext(script.second);
+		if (context) {
+			context->load(m_base + "/" + script.first);
 		}
-		context->setData(&m_data);
-		context->setScenario(this);
-		context->load(m_base + "/" + script.first);
 	}
 }
 
@@ -836,6 +898,25 @@ vector<pair<string, string>> Scenario::scripts() const {
 	return m_scripts;
 }
 
+shared_ptr<ScriptContext> Scenario::scriptContext(const string& type) const {
+	if (type.empty() && m_contexts.size() == 1) {
+		return m_contexts.begin()->second;
+	}
+	const auto& found = m_contexts.find(type);
+	if (found == m_contexts.end()) {
+		return nullptr;
+	}
+	return found->second;
+}
+
+vector<string> Scenario::scriptContexts() const {
+	vector<string> contexts;
+	for (const auto& context : m_contexts) {
+		contexts.emplace_back(context.first);
+	}
+	return contexts;
+}
+
 void Scenario::restart() {
 	m_data.restart();
 	for (unsigned i = 0; i < MAX_PLAYERS; ++i) {
@@ -855,6 +936,35 @@ void Scenario::update() {
 	++m_frame;
 }
 
+unsigned Scenario::step(Emulator* emulator, unsigned frames, float rewards[MAX_PLAYERS]) {
+	if (rewards) {
+		for (unsigned i = 0; i < MAX_PLAYERS; ++i) {
+			rewards[i] = 0;
+		}
+	}
+	// Only the last frame can be observed, so don't render the ones before it
+	// unless the scenario may end on one of them and that frame is wanted
+	bool videoEnabled = emulator->getVideoEnabled();
+	unsigned frame = 0;
+	while (frame < frames) {
+		emulator->setVideoEnabled(videoEnabled && (m_renderEveryFrame || frame + 1 == frames));
+		emulator->run();
+		++frame;
+		m_data.updateRam();
+		update();
+		if (rewards) {
+			for (unsigned i = 0; i < MAX_PLAYERS; ++i) {
+				rewards[i] += m_reward[i];
+			}
+		}
+		if (m_done) {
+			break;
+		}
+	}
+	emulator->setVideoEnabled(videoEnabled);
+	return frame;
+}
+
 float Scenario::currentReward(unsigned player) const {
 	if (player >= MAX_PLAYERS) {
 		throw range_error("requested player is out of bounds");
@@ -898,9 +1008,17 @@ void Scenario::getCrop(size_t* x, size_t* y, size_t* width, size_t* height, unsi
 	*height = m_crops[player].height;
 }
 
+Variant Scenario::callScript(const pair<string, string>& func) const {
+	auto context = scriptContext(func.second);
+	if (!context) {
+		throw runtime_error("No script context for " + func.first);
+	}
+	return context->callFunction(func.first);
+}
+
 float Scenario::calculateReward(unsigned player) const {
 	if (m_rewardFunc[player].first.size()) {
-		return ScriptContext::get(m_rewardFunc[player].second)->callFunction(m_rewardFunc[player].first);
+		return callScript(m_rewardFunc[player]);
 	}
 
 	float reward = m_rewardTime[player].calculate(1, 1);
@@ -912,7 +1030,7 @@ float Scenario::calculateReward(unsigned player) const {
 
 bool Scenario::calculateDone() const {
 	if (m_doneFunc.first.size()) {
-		return ScriptContext::get(m_doneFunc.second)->callFunction(m_doneFunc.first);
+		return callScript(m_doneFunc);
 	}
 	for (auto var = m_doneVars.cbegin(); var != m_doneVars.cend(); ++var) {
 		int done = var->second.test(m_data.lookupValue(var->first), m_data.lookupDelta(var->first));
@@ -975,6 +1093,68 @@ unsigned Scenario::filterAction(unsigned action) const {
 	return ::filterAction(action, m_actions);
 }
 
+void Scenario::decodeAction(ActionType type, const int64_t* action, size_t size, unsigned players, unsigned buttons, unsigned masks[MAX_PLAYERS]) const {
+	if (players > MAX_PLAYERS) {
+		throw invalid_argument("players > MAX_PLAYERS");
+	}
+	if (buttons > N_BUTTONS) {
+		throw invalid_argument("buttons > N_BUTTONS");
+	}
+
+	if (type == ActionType::ALL || type == ActionType::FILTERED) {
+		if (size != players * buttons) {
+			throw invalid_argument("Action must have one value per button per player");
+		}
+		for (unsigned player = 0; player < players; ++player) {
+			unsigned mask = 0;
+			for (unsigned button = 0; button < buttons; ++button) {
+				if (action[player * buttons + button]) {
+					mask |= 1 << button;
+				}
+			}
+			masks[player] = type == ActionType::FILTERED ? filterAction(mask) : mask;
+		}
+		return;
+	}
+
+	const map<int, set<int>>& actions = m_actions.empty() ? m_data.validActions() : m_actions;
+	if (type == ActionType::DISCRETE) {
+		if (size != 1 || action[0] < 0) {
+			throw invalid_argument("Discrete action must be a single non-negative value");
+		}
+		uint64_t value = action[0];
+		for (unsigned player = 0; player < players; ++player) {
+			masks[player] = 0;
+			for (const auto& actionSet : actions) {
+				if (actionSet.second.empty()) {
+					continue;
+				}
+				auto combo = actionSet.second.begin();
+				advance(combo, value % actionSet.second.size());
+				value /= actionSet.second.size();
+				masks[player] |= *combo;
+			}
+		}
+		return;
+	}
+
+	if (size != players * actions.size()) {
+		throw invalid_argument("Action must have one value per set of valid actions per player");
+	}
+	for (unsigned player = 0; player < players; ++player) {
+		masks[player] = 0;
+		for (const auto& actionSet : actions) {
+			int64_t index = *action++;
+			if (index < 0 || static_cast<size_t>(index) >= actionSet.second.size()) {
+				throw invalid_argument("Action index out of range");
+			}
+			auto combo = actionSet.second.begin();
+			advance(combo, index);
+			masks[player] |= *combo;
+		}
+	}
+}
+
 static const vector<pair<string, Operation>> s_ops{
 	make_pair("equal", Operation::EQUAL),
 	make_pair("negative-equal", Operation::NEGATIVE_EQUAL),
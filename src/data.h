@@ -16,6 +16,8 @@
 
 namespace Retro {
 
+class ScriptContext;
+
 class GameData {
 public:
 	bool load(const std::string& filename);
@@ -38,7 +40,7 @@ public:
 	std::vector<std::string> buttons() const;
 
 	void setActions(const std::vector<std::vector<std::vector<std::string>>>& actions);
-	std::map<int, std::set<int>> validActions() const;
+	const std::map<int, std::set<int>>& validActions() const;
 	unsigned filterAction(unsigned) const;
 
 	Datum lookupValue(const std::string& name);
@@ -68,6 +70,12 @@ public:
 	Search* getSearch(const std::string& name);
 	void removeSearch(const std::string& name);
 
+	// Changes whenever the variables or the memory they are read from change,
+	// which makes VariableVectors compiled before it stale
+	uint64_t generation() const { return m_generation; }
+	// Called after the memory has been mapped again, e.g. for another emulator
+	void invalidate() { ++m_generation; }
+
 #ifdef USE_CAPNP
 	bool loadSearches(const std::string& filename);
 	bool saveSearches(const std::string& filename) const;
@@ -86,6 +94,38 @@ private:
 	std::unordered_map<std::string, Search> m_searches;
 	std::unordered_map<std::string, AddressSpace> m_searchOldMem;
 	std::unordered_map<std::string, std::unique_ptr<Variant>> m_customVars;
+	uint64_t m_generation = 0;
+
+	friend class VariableVector;
+};
+
+// A fixed list of variables, resolved once to where their values live so
+// that all of them can be read every step without looking up any names.
+// Custom values, which the scenario clears when it restarts, are still found
+// by name. Reading throws once the game data is configured for another
+// emulator or the variables are changed, and it must be compiled again.
+class VariableVector {
+public:
+	VariableVector(const GameData&, const std::vector<std::string>& names);
+
+	const std::vector<std::string>& names() const { return m_names; }
+	size_t size() const { return m_names.size(); }
+
+	// Writes the value of each variable, in order, to out
+	template<typename T>
+	void read(T* out) const;
+
+private:
+	// Custom values have no block
+	struct Entry {
+		const MemoryView<>* block;
+		Variable var;
+	};
+
+	const GameData* m_data;
+	uint64_t m_generation;
+	std::vector<std::string> m_names;
+	std::vector<Entry> m_entries;
 };
 
 class Scenario {
@@ -103,12 +143,27 @@ public:
 	bool loadScript(const std::string& filename, const std::string& scope);
 	void reloadScripts();
 	std::vector<std::pair<std::string, std::string>> scripts() const;
+	// Every scenario runs its scripts in contexts of its own, one per script
+	// type. An empty type picks the only context there is.
+	std::shared_ptr<ScriptContext> scriptContext(const std::string& type) const;
+	std::vector<std::string> scriptContexts() const;
 
 	const GameData* data() const { return &m_data; }
 
 	void update();
 	void restart();
 
+	// Runs up to `frames` frames with the current button state, updating the RAM
+	// and the scenario after each one. Rewards of every frame are summed into
+	// `rewards`, if given. Stops after the first frame on which the scenario is
+	// done and returns how many frames were actually run. Only the last of the
+	// `frames` frames is rendered, so if the scenario is done before it the
+	// screen still shows the last frame rendered before the step, unless every
+	// frame is set to be rendered.
+	unsigned step(Emulator*, unsigned frames = 1, float rewards[MAX_PLAYERS] = nullptr);
+	void setRenderEveryFrame(bool render) { m_renderEveryFrame = render; }
+	bool renderEveryFrame() const { return m_renderEveryFrame; }
+
 	float currentReward(unsigned player = 0) const;
 	float totalReward(unsigned player = 0) const;
 	bool isDone() const;
@@ -122,6 +177,20 @@ public:
 	std::map<int, std::set<int>> validActions() const;
 	unsigned filterAction(unsigned) const;
 
+	// Same values as retro.Actions
+	enum class ActionType {
+		ALL,
+		FILTERED,
+		DISCRETE,
+		MULTI_DISCRETE
+	};
+
+	// Turns an action from one of RetroEnv's action spaces into a button mask per
+	// player. DISCRETE takes one value covering every player, MULTI_DISCRETE one
+	// index into each set of valid actions per player, and ALL and FILTERED one
+	// value per button per player.
+	void decodeAction(ActionType, const int64_t* action, size_t size, unsigned players, unsigned buttons, unsigned masks[MAX_PLAYERS]) const;
+
 	enum class Measurement {
 		ABSOLUTE,
 		DELTA
@@ -198,6 +267,7 @@ public:
 private:
 	bool isDone(const DoneNode&) const;
 
+	Variant callScript(const std::pair<std::string, std::string>& func) const;
 	float calculateReward(unsigned player) const;
 	bool calculateDone() const;
 
@@ -205,6 +275,7 @@ private:
 	std::string m_base;
 
 	std::vector<std::pair<std::string, std::string>> m_scripts;
+	std::unordered_map<std::string, std::shared_ptr<ScriptContext>> m_contexts;
 
 	std::unordered_map<std::string, RewardSpec> m_rewardVars[MAX_PLAYERS];
 	RewardSpec m_rewardTime[MAX_PLAYERS];
@@ -222,5 +293,6 @@ private:
 	bool m_done = false;
 	CropInfo m_crops[MAX_PLAYERS]{};
 	uint64_t m_frame = 0;
+	bool m_renderEveryFrame = false;
 };
 }
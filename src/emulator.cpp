@@ -1,17 +1,24 @@
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
 #ifndef _WIN32
 #include <dlfcn.h>
+#include <unistd.h>
 #endif
 #include <fstream>
 #include <map>
+#include <mutex>
 #include <sstream>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "audioops.h"
 #include "coreinfo.h"
 #include "data.h"
 #include "emulator.h"
 #include "libretro.h"
+#include "rewind.h"
 
 #ifndef _WIN32
 #define GETSYM dlsym
@@ -23,7 +30,14 @@ using namespace std;
 
 namespace Retro {
 
-static Emulator* s_loadedEmulator = nullptr;
+// The emulator whose core is currently being called into on this thread. libretro
+// callbacks carry no context pointer, so this is how they find their instance.
+static thread_local Emulator* s_loadedEmulator = nullptr;
+
+// Libraries currently loaded in place by some instance. Any other instance using
+// the same core has to load a private copy of it instead.
+static mutex s_coreLock;
+static unordered_set<string> s_sharedCores;
 
 static map<string, const char*> s_envVariables = {
 	{ "genesis_plus_gx_bram", "per game" },
@@ -31,30 +45,78 @@ static map<string, const char*> s_envVariables = {
 	{ "genesis_plus_gx_blargg_ntsc_filter", "disabled" }
 };
 
-static void (*retro_init)(void);
-static void (*retro_deinit)(void);
-static unsigned (*retro_api_version)(void);
-static void (*retro_get_system_info)(struct retro_system_info* info);
-static void (*retro_get_system_av_info)(struct retro_system_av_info* info);
-static void (*retro_reset)(void);
-static void (*retro_run)(void);
-static size_t (*retro_serialize_size)(void);
-static bool (*retro_serialize)(void* data, size_t size);
-static bool (*retro_unserialize)(const void* data, size_t size);
-static bool (*retro_load_game)(const struct retro_game_info* game);
-static void (*retro_unload_game)(void);
-static void* (*retro_get_memory_data)(unsigned id);
-static size_t (*retro_get_memory_size)(unsigned id);
-static void (*retro_cheat_reset)(void);
-static void (*retro_cheat_set)(unsigned index, bool enabled, const char* code);
-static void (*retro_set_environment)(retro_environment_t);
-static void (*retro_set_video_refresh)(retro_video_refresh_t);
-static void (*retro_set_audio_sample)(retro_audio_sample_t);
-static void (*retro_set_audio_sample_batch)(retro_audio_sample_batch_t);
-static void (*retro_set_input_poll)(retro_input_poll_t);
-static void (*retro_set_input_state)(retro_input_state_t);
-
-Emulator::Emulator() {
+struct Emulator::Core {
+	void (*init)(void);
+	void (*deinit)(void);
+	unsigned (*api_version)(void);
+	void (*get_system_info)(struct retro_system_info* info);
+	void (*get_system_av_info)(struct retro_system_av_info* info);
+	void (*reset)(void);
+	void (*run)(void);
+	size_t (*serialize_size)(void);
+	bool (*serialize)(void* data, size_t size);
+	bool (*unserialize)(const void* data, size_t size);
+	bool (*load_game)(const struct retro_game_info* game);
+	void (*unload_game)(void);
+	void* (*get_memory_data)(unsigned id);
+	size_t (*get_memory_size)(unsigned id);
+	void (*cheat_reset)(void);
+	void (*cheat_set)(unsigned index, bool enabled, const char* code);
+	void (*set_environment)(retro_environment_t);
+	void (*set_video_refresh)(retro_video_refresh_t);
+	void (*set_audio_sample)(retro_audio_sample_t);
+	void (*set_audio_sample_batch)(retro_audio_sample_batch_t);
+	void (*set_input_poll)(retro_input_poll_t);
+	void (*set_input_state)(retro_input_state_t);
+	// Not part of libretro, so only some of our cores have it
+	const uint8_t* (*get_indexed_frame)(size_t* pitch, const void** palette);
+};
+
+class ActiveEmulator {
+public:
+	ActiveEmulator(Emulator* emulator)
+		: m_previous(s_loadedEmulator) {
+		s_loadedEmulator = emulator;
+	}
+	~ActiveEmulator() {
+		s_loadedEmulator = m_previous;
+	}
+
+private:
+	Emulator* m_previous;
+};
+
+static string copyCore(const string& corePath) {
+#ifdef _WIN32
+	char dir[MAX_PATH];
+	char name[MAX_PATH];
+	if (!GetTempPathA(MAX_PATH, dir) || !GetTempFileNameA(dir, "ret", 0, name)) {
+		return {};
+	}
+	string copy = name;
+#else
+	string ext = corePath.substr(corePath.find_last_of('.'));
+	const char* tmpdir = getenv("TMPDIR");
+	string copy = string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/retro-core-XXXXXX" + ext;
+	int fd = mkstemps(&copy[0], ext.size());
+	if (fd < 0) {
+		return {};
+	}
+	close(fd);
+#endif
+	ifstream in(corePath, ios::binary);
+	ofstream out(copy, ios::binary | ios::trunc);
+	out << in.rdbuf();
+	out.close();
+	if (in.fail() || out.fail()) {
+		remove(copy.c_str());
+		return {};
+	}
+	return copy;
+}
+
+Emulator::Emulator()
+	: m_retro(new Core) {
 }
 
 Emulator::~Emulator() {
@@ -69,10 +131,6 @@ Emulator::~Emulator() {
 	}
 }
 
-bool Emulator::isLoaded() {
-	return s_loadedEmulator;
-}
-
 bool Emulator::loadRom(const string& romPath) {
 	if (m_romLoaded) {
 		unloadRom();
@@ -122,52 +180,54 @@ bool Emulator::loadRom(const string& romPath) {
 	}
 	in.close();
 
-	auto res = retro_load_game(&gameInfo);
+	ActiveEmulator active(this);
+	auto res = m_retro->load_game(&gameInfo);
 	delete[] romData;
 	if (!res) {
 		return false;
 	}
-	retro_get_system_av_info(&m_avInfo);
+	m_retro->get_system_av_info(&m_avInfo);
 	fixScreenSize(romPath);
 
 	m_romLoaded = true;
-	m_romPath = romPath;
 	return true;
 }
 
 void Emulator::run() {
-	assert(s_loadedEmulator == this);
+	ActiveEmulator active(this);
 	m_audioData.clear();
-	retro_run();
+	m_retro->run();
+	if (m_audioFeatures) {
+		m_audioFeatures->push(m_audioData.data(), m_audioData.size() / 2, getAudioRate());
+	}
+	if (m_rewind) {
+		m_rewind->push(*this);
+	}
 }
 
-void Emulator::reset() {
-	assert(s_loadedEmulator == this);
+void Emulator::setRewind(RewindBuffer* rewind) {
+	m_rewind = rewind;
+	if (m_rewind) {
+		m_rewind->restart(*this);
+	}
+}
 
-	memset(m_buttonMask, 0, sizeof(m_buttonMask));
+const uint8_t* Emulator::getIndexedData(size_t* pitch, const void** palette) {
+	*palette = nullptr;
+	if (!m_coreHandle || !m_retro->get_indexed_frame) {
+		return nullptr;
+	}
+	return m_retro->get_indexed_frame(pitch, palette);
+}
 
-	retro_system_info systemInfo;
-	retro_get_system_info(&systemInfo);
-	if (!strcmp(systemInfo.library_name, "Stella")) {
-		// Stella does not properly clear everything when reseting or loading a savestate
-		string romPath = m_romPath;
+void Emulator::reset() {
+	ActiveEmulator active(this);
 
-#ifdef _WIN32
-		FreeLibrary(m_coreHandle);
-#else
-		dlclose(m_coreHandle);
-#endif
-		m_coreHandle = nullptr;
-		s_loadedEmulator = nullptr;
-		m_romLoaded = false;
-		loadRom(m_romPath);
-		if (m_addressSpace) {
-			m_addressSpace->reset();
-			m_addressSpace->addBlock(Retro::ramBase(m_core), retro_get_memory_size(RETRO_MEMORY_SYSTEM_RAM), retro_get_memory_data(RETRO_MEMORY_SYSTEM_RAM));
-		}
+	memset(m_buttonMask, 0, sizeof(m_buttonMask));
+	m_retro->reset();
+	if (m_rewind) {
+		m_rewind->restart(*this);
 	}
-
-	retro_reset();
 }
 
 void Emulator::unloadCore() {
@@ -177,117 +237,151 @@ void Emulator::unloadCore() {
 	if (m_romLoaded) {
 		unloadRom();
 	}
-	retro_deinit();
-#ifdef _WIN32
-	FreeLibrary(m_coreHandle);
-#else
-	dlclose(m_coreHandle);
-#endif
-	m_coreHandle = nullptr;
-	s_loadedEmulator = nullptr;
+	ActiveEmulator active(this);
+	m_retro->deinit();
+	closeCore();
 }
 
 void Emulator::unloadRom() {
 	if (!m_romLoaded) {
 		return;
 	}
-	retro_unload_game();
+	ActiveEmulator active(this);
+	m_retro->unload_game();
 	m_romLoaded = false;
-	m_romPath.clear();
 	m_addressSpace = nullptr;
 	m_map.clear();
 }
 
 bool Emulator::serialize(void* data, size_t size) {
-	assert(s_loadedEmulator == this);
-	return retro_serialize(data, size);
+	ActiveEmulator active(this);
+	return m_retro->serialize(data, size);
 }
 
 bool Emulator::unserialize(const void* data, size_t size) {
-	assert(s_loadedEmulator == this);
+	ActiveEmulator active(this);
 	try {
-		retro_system_info systemInfo;
-		retro_get_system_info(&systemInfo);
-		if (!strcmp(systemInfo.library_name, "Stella")) {
-			reset();
+		if (!m_retro->unserialize(data, size)) {
+			return false;
 		}
-
-		return retro_unserialize(data, size);
+		if (m_rewind && !m_rewind->replaying()) {
+			m_rewind->restart(*this);
+		}
+		return true;
 	} catch (...) {
 		return false;
 	}
 }
 
 size_t Emulator::serializeSize() {
-	assert(s_loadedEmulator == this);
-	return retro_serialize_size();
+	ActiveEmulator active(this);
+	return m_retro->serialize_size();
 }
 
 void Emulator::clearCheats() {
-	assert(s_loadedEmulator == this);
-	retro_cheat_reset();
+	ActiveEmulator active(this);
+	m_retro->cheat_reset();
 }
 
 void Emulator::setCheat(unsigned index, bool enabled, const char* code) {
-	assert(s_loadedEmulator == this);
-	retro_cheat_set(index, enabled, code);
+	ActiveEmulator active(this);
+	m_retro->cheat_set(index, enabled, code);
 }
 
 bool Emulator::loadCore(const string& corePath) {
-	if (s_loadedEmulator) {
-		return false;
+	string libPath = corePath;
+	{
+		lock_guard<mutex> lock(s_coreLock);
+		if (s_sharedCores.count(corePath)) {
+			// Loading the same path again would just hand back the existing handle
+			m_coreCopy = copyCore(corePath);
+			if (m_coreCopy.empty()) {
+				return false;
+			}
+			libPath = m_coreCopy;
+		} else {
+			s_sharedCores.insert(corePath);
+			m_coreLibrary = corePath;
+		}
 	}
 
 #ifdef _WIN32
-	m_coreHandle = LoadLibrary(corePath.c_str());
+	m_coreHandle = LoadLibrary(libPath.c_str());
 #else
-	m_coreHandle = dlopen(corePath.c_str(), RTLD_LAZY);
+	m_coreHandle = dlopen(libPath.c_str(), RTLD_LAZY | RTLD_LOCAL);
+	if (!m_coreCopy.empty()) {
+		// The mapping keeps the copy alive, so it doesn't need to outlive this call
+		remove(m_coreCopy.c_str());
+		m_coreCopy.clear();
+	}
 #endif
 	if (!m_coreHandle) {
+		closeCore();
 		return false;
 	}
 
-	retro_init = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_init"));
-	retro_deinit = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_deinit"));
-	retro_api_version = reinterpret_cast<unsigned int (*)()>(GETSYM(m_coreHandle, "retro_api_version"));
-	retro_get_system_info = reinterpret_cast<void (*)(struct retro_system_info*)>(GETSYM(m_coreHandle, "retro_get_system_info"));
-	retro_get_system_av_info = reinterpret_cast<void (*)(struct retro_system_av_info*)>(GETSYM(m_coreHandle, "retro_get_system_av_info"));
-	retro_reset = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_reset"));
-	retro_run = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_run"));
-	retro_serialize_size = reinterpret_cast<size_t (*)()>(GETSYM(m_coreHandle, "retro_serialize_size"));
-	retro_serialize = reinterpret_cast<bool (*)(void*, size_t)>(GETSYM(m_coreHandle, "retro_serialize"));
-	retro_unserialize = reinterpret_cast<bool (*)(const void*, size_t)>(GETSYM(m_coreHandle, "retro_unserialize"));
-	retro_load_game = reinterpret_cast<bool (*)(const struct retro_game_info*)>(GETSYM(m_coreHandle, "retro_load_game"));
-	retro_unload_game = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_unload_game"));
-	retro_get_memory_data = reinterpret_cast<void* (*) (unsigned int)>(GETSYM(m_coreHandle, "retro_get_memory_data"));
-	retro_get_memory_size = reinterpret_cast<size_t (*)(unsigned int)>(GETSYM(m_coreHandle, "retro_get_memory_size"));
-	retro_cheat_reset = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_cheat_reset"));
-	retro_cheat_set = reinterpret_cast<void (*)(unsigned int, bool, const char*)>(GETSYM(m_coreHandle, "retro_cheat_set"));
-	retro_set_environment = reinterpret_cast<void (*)(retro_environment_t)>(GETSYM(m_coreHandle, "retro_set_environment"));
-	retro_set_video_refresh = reinterpret_cast<void (*)(retro_video_refresh_t)>(GETSYM(m_coreHandle, "retro_set_video_refresh"));
-	retro_set_audio_sample = reinterpret_cast<void (*)(retro_audio_sample_t)>(GETSYM(m_coreHandle, "retro_set_audio_sample"));
-	retro_set_audio_sample_batch = reinterpret_cast<void (*)(retro_audio_sample_batch_t)>(GETSYM(m_coreHandle, "retro_set_audio_sample_batch"));
-	retro_set_input_poll = reinterpret_cast<void (*)(retro_input_poll_t)>(GETSYM(m_coreHandle, "retro_set_input_poll"));
-	retro_set_input_state = reinterpret_cast<void (*)(short (*)(unsigned int, unsigned int, unsigned int, unsigned int))>(GETSYM(m_coreHandle, "retro_set_input_state"));
+	m_retro->init = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_init"));
+	m_retro->deinit = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_deinit"));
+	m_retro->api_version = reinterpret_cast<unsigned int (*)()>(GETSYM(m_coreHandle, "retro_api_version"));
+	m_retro->get_system_info = reinterpret_cast<void (*)(struct retro_system_info*)>(GETSYM(m_coreHandle, "retro_get_system_info"));
+	m_retro->get_system_av_info = reinterpret_cast<void (*)(struct retro_system_av_info*)>(GETSYM(m_coreHandle, "retro_get_system_av_info"));
+	m_retro->reset = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_reset"));
+	m_retro->run = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_run"));
+	m_retro->serialize_size = reinterpret_cast<size_t (*)()>(GETSYM(m_coreHandle, "retro_serialize_size"));
+	m_retro->serialize = reinterpret_cast<bool (*)(void*, size_t)>(GETSYM(m_coreHandle, "retro_serialize"));
+	m_retro->unserialize = reinterpret_cast<bool (*)(const void*, size_t)>(GETSYM(m_coreHandle, "retro_unserialize"));
+	m_retro->load_game = reinterpret_cast<bool (*)(const struct retro_game_info*)>(GETSYM(m_coreHandle, "retro_load_game"));
+	m_retro->unload_game = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_unload_game"));
+	m_retro->get_memory_data = reinterpret_cast<void* (*) (unsigned int)>(GETSYM(m_coreHandle, "retro_get_memory_data"));
+	m_retro->get_memory_size = reinterpret_cast<size_t (*)(unsigned int)>(GETSYM(m_coreHandle, "retro_get_memory_size"));
+	m_retro->cheat_reset = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_cheat_reset"));
+	m_retro->cheat_set = reinterpret_cast<void (*)(unsigned int, bool, const char*)>(GETSYM(m_coreHandle, "retro_cheat_set"));
+	m_retro->set_environment = reinterpret_cast<void (*)(retro_environment_t)>(GETSYM(m_coreHandle, "retro_set_environment"));
+	m_retro->set_video_refresh = reinterpret_cast<void (*)(retro_video_refresh_t)>(GETSYM(m_coreHandle, "retro_set_video_refresh"));
+	m_retro->set_audio_sample = reinterpret_cast<void (*)(retro_audio_sample_t)>(GETSYM(m_coreHandle, "retro_set_audio_sample"));
+	m_retro->set_audio_sample_batch = reinterpret_cast<void (*)(retro_audio_sample_batch_t)>(GETSYM(m_coreHandle, "retro_set_audio_sample_batch"));
+	m_retro->set_input_poll = reinterpret_cast<void (*)(retro_input_poll_t)>(GETSYM(m_coreHandle, "retro_set_input_poll"));
+	m_retro->set_input_state = reinterpret_cast<void (*)(short (*)(unsigned int, unsigned int, unsigned int, unsigned int))>(GETSYM(m_coreHandle, "retro_set_input_state"));
+	m_retro->get_indexed_frame = reinterpret_cast<const uint8_t* (*) (size_t*, const void**)>(GETSYM(m_coreHandle, "retro_get_indexed_frame"));
 
 	// The default according to the docs
 	m_imgDepth = 15;
-	s_loadedEmulator = this;
+	ActiveEmulator active(this);
 
-	retro_set_environment(cbEnvironment);
-	retro_set_video_refresh(cbVideoRefresh);
-	retro_set_audio_sample(cbAudioSample);
-	retro_set_audio_sample_batch(cbAudioSampleBatch);
-	retro_set_input_poll(cbInputPoll);
-	retro_set_input_state(cbInputState);
-	retro_init();
+	m_retro->set_environment(cbEnvironment);
+	m_retro->set_video_refresh(cbVideoRefresh);
+	m_retro->set_audio_sample(cbAudioSample);
+	m_retro->set_audio_sample_batch(cbAudioSampleBatch);
+	m_retro->set_input_poll(cbInputPoll);
+	m_retro->set_input_state(cbInputState);
+	m_retro->init();
 
 	return true;
 }
 
+void Emulator::closeCore() {
+	if (m_coreHandle) {
+#ifdef _WIN32
+		FreeLibrary(m_coreHandle);
+#else
+		dlclose(m_coreHandle);
+#endif
+		m_coreHandle = nullptr;
+	}
+	if (!m_coreCopy.empty()) {
+		remove(m_coreCopy.c_str());
+		m_coreCopy.clear();
+	}
+	if (!m_coreLibrary.empty()) {
+		lock_guard<mutex> lock(s_coreLock);
+		s_sharedCores.erase(m_coreLibrary);
+		m_coreLibrary.clear();
+	}
+}
+
 void Emulator::fixScreenSize(const string& romName) {
 	retro_system_info systemInfo;
-	retro_get_system_info(&systemInfo);
+	m_retro->get_system_info(&systemInfo);
 	if (!strcmp(systemInfo.library_name, "Genesis Plus GX")) {
 		switch (romName.back()) {
 		case 'd': // Mega Drive
@@ -375,8 +469,9 @@ bool Emulator::cbEnvironment(unsigned cmd, void* data) {
 		return true;
 	case RETRO_ENVIRONMENT_GET_VARIABLE: {
 		struct retro_variable* var = reinterpret_cast<struct retro_variable*>(data);
-		if (s_envVariables.count(string(var->key))) {
-			var->value = s_envVariables[string(var->key)];
+		auto iter = s_envVariables.find(string(var->key));
+		if (iter != s_envVariables.end()) {
+			var->value = iter->second;
 			return true;
 		}
 		return false;
@@ -404,6 +499,9 @@ bool Emulator::cbEnvironment(unsigned cmd, void* data) {
 		cb->log = cbLog;
 		return true;
 	}
+	case RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE:
+		*reinterpret_cast<int*>(data) = (s_loadedEmulator->m_videoEnabled ? 1 : 0) | (s_loadedEmulator->m_audioEnabled ? 2 : 0);
+		return true;
 	default:
 		return false;
 	}
@@ -422,12 +520,18 @@ void Emulator::cbVideoRefresh(const void* data, unsigned, unsigned, size_t pitch
 
 void Emulator::cbAudioSample(int16_t left, int16_t right) {
 	assert(s_loadedEmulator);
+	if (!s_loadedEmulator->m_audioEnabled) {
+		return;
+	}
 	s_loadedEmulator->m_audioData.push_back(left);
 	s_loadedEmulator->m_audioData.push_back(right);
 }
 
 size_t Emulator::cbAudioSampleBatch(const int16_t* data, size_t frames) {
 	assert(s_loadedEmulator);
+	if (!s_loadedEmulator->m_audioEnabled) {
+		return frames;
+	}
 	s_loadedEmulator->m_audioData.insert(s_loadedEmulator->m_audioData.end(), data, &data[frames * 2]);
 	return frames;
 }
@@ -438,17 +542,23 @@ void Emulator::cbInputPoll() {
 
 int16_t Emulator::cbInputState(unsigned port, unsigned, unsigned, unsigned id) {
 	assert(s_loadedEmulator);
+	// Some cores poll more ports or buttons than there are in the mask
+	if (port >= MAX_PLAYERS || id >= N_BUTTONS) {
+		return 0;
+	}
 	return s_loadedEmulator->m_buttonMask[port][id];
 }
 
 void Emulator::configureData(GameData* data) {
+	ActiveEmulator active(this);
 	m_addressSpace = &data->addressSpace();
 	m_addressSpace->reset();
 	Retro::configureData(data, m_core);
 	reconfigureAddressSpace();
-	if (m_addressSpace->blocks().empty() && retro_get_memory_size(RETRO_MEMORY_SYSTEM_RAM)) {
-		m_addressSpace->addBlock(Retro::ramBase(m_core), retro_get_memory_size(RETRO_MEMORY_SYSTEM_RAM), retro_get_memory_data(RETRO_MEMORY_SYSTEM_RAM));
+	if (m_addressSpace->blocks().empty() && m_retro->get_memory_size(RETRO_MEMORY_SYSTEM_RAM)) {
+		m_addressSpace->addBlock(Retro::ramBase(m_core), m_retro->get_memory_size(RETRO_MEMORY_SYSTEM_RAM), m_retro->get_memory_data(RETRO_MEMORY_SYSTEM_RAM));
 	}
+	data->invalidate();
 }
 
 vector<string> Emulator::buttons() const {
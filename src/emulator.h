@@ -3,6 +3,7 @@
 #include "libretro.h"
 #include "memory.h"
 
+#include <memory>
 #include <string>
 #include <vector>
 #include <cstring>
@@ -16,15 +17,15 @@ namespace Retro {
 const int N_BUTTONS = 16;
 const int MAX_PLAYERS = 2;
 
+class AudioFeatures;
 class GameData;
+class RewindBuffer;
 class Emulator {
 public:
 	Emulator();
 	~Emulator();
 	Emulator(const Emulator&) = delete;
 
-	static bool isLoaded();
-
 	bool loadRom(const std::string& romPath);
 
 	void run();
@@ -35,6 +36,13 @@ public:
 	int getImageWidth() { return m_avInfo.geometry.base_width; }
 	int getImagePitch() { return m_imgPitch; }
 	int getImageDepth() { return m_imgDepth; }
+
+	// The last frame as palette indices, one byte per pixel and the size of
+	// the image, on cores that render through a palette (NES, Genesis, Master
+	// System and Game Gear); nullptr on other cores. palette gets the 256
+	// colors the indices stand for, in the image's pixel format, or nullptr
+	// if the core's palette isn't a plain lookup table.
+	const uint8_t* getIndexedData(size_t* pitch, const void** palette);
 	double getFrameRate() { return m_avInfo.timing.fps; }
 	int getAudioSamples() { return m_audioData.size() / 2; }
 	double getAudioRate() { return m_avInfo.timing.sample_rate; }
@@ -49,6 +57,27 @@ public:
 	void setKey(int port, int key, bool active) { m_buttonMask[port][key] = active; }
 	bool getKey(int port, int key) { return m_buttonMask[port][key]; }
 
+	// When video is disabled, cores that support it skip rendering and the
+	// image data keeps pointing at the last frame that was rendered
+	void setVideoEnabled(bool enabled) { m_videoEnabled = enabled; }
+	bool getVideoEnabled() const { return m_videoEnabled; }
+
+	// When audio is disabled no samples are collected, and cores that support
+	// it skip sound synthesis
+	void setAudioEnabled(bool enabled) { m_audioEnabled = enabled; }
+	bool getAudioEnabled() const { return m_audioEnabled; }
+
+	// Every frame's audio is also pushed into features, if set, so that none
+	// of it is lost over several frames. The emulator doesn't own it.
+	void setAudioFeatures(AudioFeatures* features) { m_audioFeatures = features; }
+	AudioFeatures* getAudioFeatures() const { return m_audioFeatures; }
+
+	// Every frame is also recorded into rewind, if set, which starts over
+	// whenever a state is loaded or the game is reset. The emulator doesn't
+	// own it.
+	void setRewind(RewindBuffer* rewind);
+	RewindBuffer* getRewind() const { return m_rewind; }
+
 	void clearCheats();
 	void setCheat(unsigned index, bool enabled, const char* code);
 
@@ -58,7 +87,10 @@ public:
 	std::vector<std::string> keybinds() const;
 
 private:
+	struct Core;
+
 	bool loadCore(const std::string& corePath);
+	void closeCore();
 	void fixScreenSize(const std::string& romName);
 	void reconfigureAddressSpace();
 
@@ -75,9 +107,13 @@ private:
 	const void* m_imgData = nullptr;
 	size_t m_imgPitch = 0;
 	int m_imgDepth = 0;
+	bool m_videoEnabled = true;
 
 	// Audio buffer; accumulated during run()
 	std::vector<int16_t> m_audioData;
+	bool m_audioEnabled = true;
+	AudioFeatures* m_audioFeatures = nullptr;
+	RewindBuffer* m_rewind = nullptr;
 	AddressSpace* m_addressSpace = nullptr;
 
 	retro_system_av_info m_avInfo = {};
@@ -85,6 +121,12 @@ private:
 
 	char* m_corePath = nullptr;
 
+	// Each instance owns its own copy of the core's entry points. If another
+	// instance already has the same core loaded, a private copy of the library
+	// is loaded instead so that the two don't share any global state.
+	std::unique_ptr<Core> m_retro;
+	std::string m_coreLibrary;
+	std::string m_coreCopy;
 #ifdef _WIN32
 	HMODULE m_coreHandle = nullptr;
 #else
@@ -92,6 +134,5 @@ private:
 #endif
 	bool m_romLoaded = false;
 	std::string m_core;
-	std::string m_romPath;
 };
 }
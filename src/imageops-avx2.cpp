@@ -0,0 +1,242 @@
+#include "imageops-wide.h"
+
+#include <immintrin.h>
+
+// Everything in this file is compiled with AVX2 enabled, so it must only be
+// reached through the dispatch in imageops.cpp. Constants are kept local to
+// the functions so nothing runs AVX2 code during static initialization.
+//
+// The 256-bit forms of the byte and word shuffles work on each 128-bit lane
+// separately, so the kernels below perform exactly the same steps as the
+// SSSE3 ones per lane and then put the lanes back in order before storing.
+
+namespace Retro {
+namespace AVX2 {
+
+static inline __m256i _load(const void* p) {
+	return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+static inline __m256i _convert565ToGray(__m256i pix) {
+	/* Mask out channels */
+	__m256i r = _mm256_and_si256(pix, _mm256_set1_epi16(static_cast<short>(0xF800)));
+	__m256i g = _mm256_and_si256(pix, _mm256_set1_epi16(0x07E0));
+	__m256i b = _mm256_and_si256(pix, _mm256_set1_epi16(0x001F));
+	/* Normalize channels */
+	r = _mm256_srli_epi16(r, 10);
+	g = _mm256_srli_epi16(g, 5);
+	b = _mm256_slli_epi16(b, 1);
+	/* Combine channels */
+	r = _mm256_add_epi16(r, g);
+	r = _mm256_add_epi16(r, b);
+	return r;
+}
+
+static inline __m256i _convertX888ToGray(__m256i pix) {
+	const __m256i maskR32 = _mm256_broadcastsi128_si256(_mm_set_epi8(0x80, 0x80, 0x80, 0x0E, 0x80, 0x80, 0x80, 0x0A, 0x80, 0x80, 0x80, 0x06, 0x80, 0x80, 0x80, 0x02));
+	const __m256i maskG32 = _mm256_broadcastsi128_si256(_mm_set_epi8(0x80, 0x80, 0x80, 0x0D, 0x80, 0x80, 0x80, 0x09, 0x80, 0x80, 0x80, 0x05, 0x80, 0x80, 0x80, 0x01));
+	const __m256i maskB32 = _mm256_broadcastsi128_si256(_mm_set_epi8(0x80, 0x80, 0x80, 0x0C, 0x80, 0x80, 0x80, 0x08, 0x80, 0x80, 0x80, 0x04, 0x80, 0x80, 0x80, 0x00));
+	/* Mask out channels */
+	__m256i r = _mm256_shuffle_epi8(pix, maskR32);
+	__m256i g = _mm256_shuffle_epi8(pix, maskG32);
+	__m256i b = _mm256_shuffle_epi8(pix, maskB32);
+	/* Combine channels */
+	r = _mm256_add_epi32(r, g);
+	r = _mm256_add_epi32(r, b);
+	r = _mm256_srli_epi16(r, 2);
+	return r;
+}
+
+static inline __m256i _halveW16(__m256i a, __m256i b) {
+	/* Same swizzle as the SSSE3 version, once per lane */
+	__m256i tmp0 = _mm256_shufflelo_epi16(a, 0xD8);
+	tmp0 = _mm256_shufflehi_epi16(tmp0, 0xD8);
+	tmp0 = _mm256_shuffle_epi32(tmp0, 0xD8);
+	__m256i tmp1 = _mm256_shufflelo_epi16(b, 0xD8);
+	tmp1 = _mm256_shufflehi_epi16(tmp1, 0xD8);
+	tmp1 = _mm256_shuffle_epi32(tmp1, 0xD8);
+	__m256i tmp2 = _mm256_unpacklo_epi64(tmp0, tmp1);
+	__m256i tmp3 = _mm256_unpackhi_epi64(tmp0, tmp1);
+	/* Halve width */
+	return _mm256_avg_epu16(tmp2, tmp3);
+}
+
+static inline __m256i _halveWNeighbor16(__m256i a, __m256i b) {
+	__m256i tmp0 = _mm256_shufflelo_epi16(a, 0xD8);
+	tmp0 = _mm256_shufflehi_epi16(tmp0, 0xD8);
+	tmp0 = _mm256_shuffle_epi32(tmp0, 0xD8);
+	__m256i tmp1 = _mm256_shufflelo_epi16(b, 0xD8);
+	tmp1 = _mm256_shufflehi_epi16(tmp1, 0xD8);
+	tmp1 = _mm256_shuffle_epi32(tmp1, 0xD8);
+	return _mm256_unpacklo_epi64(tmp0, tmp1);
+}
+
+static inline __m256i _halveW32(__m256i a, __m256i b) {
+	__m256i tmp0 = _mm256_shuffle_epi32(a, 0xD8);
+	__m256i tmp1 = _mm256_shuffle_epi32(b, 0xD8);
+	__m256i tmp2 = _mm256_unpacklo_epi64(tmp0, tmp1);
+	__m256i tmp3 = _mm256_unpackhi_epi64(tmp0, tmp1);
+	/* Halve width */
+	return _mm256_avg_epu16(tmp2, tmp3);
+}
+
+static inline __m256i _halveWNeighbor32(__m256i a, __m256i b) {
+	__m256i tmp0 = _mm256_shuffle_epi32(a, 0xD8);
+	__m256i tmp1 = _mm256_shuffle_epi32(b, 0xD8);
+	return _mm256_unpacklo_epi64(tmp0, tmp1);
+}
+
+/* 16 words below 256 -> 16 bytes, in order */
+static inline __m128i _narrow16(__m256i words) {
+	__m256i bytes = _mm256_packus_epi16(words, words);
+	return _mm256_castsi256_si128(_mm256_permute4x64_epi64(bytes, 0x08));
+}
+
+/* 8 dwords below 256 -> 8 bytes, in order */
+static inline __m128i _narrow32(__m256i dwords) {
+	__m256i bytes = _mm256_packus_epi32(dwords, dwords);
+	bytes = _mm256_packus_epi16(bytes, bytes);
+	return _mm_unpacklo_epi32(_mm256_castsi256_si128(bytes), _mm256_extracti128_si256(bytes, 1));
+}
+
+/* B G R X per dword -> R G B in the low 12 bytes of each lane */
+static inline __m256i _shuffleX888To888(__m256i pix) {
+	const __m256i shuffle = _mm256_broadcastsi128_si256(_mm_set_epi8(0x80, 0x80, 0x80, 0x80, 0x0C, 0x0D, 0x0E, 0x08, 0x09, 0x0A, 0x04, 0x05, 0x06, 0x00, 0x01, 0x02));
+	return _mm256_shuffle_epi8(pix, shuffle);
+}
+
+/* Four vectors of 8 pixels each, shuffled by _shuffleX888To888 -> 96 packed bytes */
+static inline void _store888(__m256i a, __m256i b, __m256i c, __m256i d, uint8_t* out) {
+	/* Packed dword i of a shuffled vector lives at dword i + i / 3 */
+	__m256i out0 = _mm256_blend_epi32(
+		_mm256_permutevar8x32_epi32(a, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 0, 0)),
+		_mm256_permutevar8x32_epi32(b, _mm256_setr_epi32(0, 0, 0, 0, 0, 0, 0, 1)), 0xC0);
+	__m256i out1 = _mm256_blend_epi32(
+		_mm256_permutevar8x32_epi32(b, _mm256_setr_epi32(2, 4, 5, 6, 0, 0, 0, 0)),
+		_mm256_permutevar8x32_epi32(c, _mm256_setr_epi32(0, 0, 0, 0, 0, 1, 2, 4)), 0xF0);
+	__m256i out2 = _mm256_blend_epi32(
+		_mm256_permutevar8x32_epi32(c, _mm256_setr_epi32(5, 6, 0, 0, 0, 0, 0, 0)),
+		_mm256_permutevar8x32_epi32(d, _mm256_setr_epi32(0, 0, 0, 1, 2, 4, 5, 6)), 0xFC);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(&out[0]), out0);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(&out[32]), out1);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(&out[64]), out2);
+}
+
+/* 8 RGB565 pixels -> 8 XRGB8888 pixels */
+static inline __m256i _expand565(const uint16_t* in) {
+	__m256i pix = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)));
+	__m256i r = _mm256_slli_epi32(_mm256_and_si256(pix, _mm256_set1_epi32(0xF800)), 8);
+	__m256i g = _mm256_slli_epi32(_mm256_and_si256(pix, _mm256_set1_epi32(0x07E0)), 5);
+	__m256i b = _mm256_slli_epi32(_mm256_and_si256(pix, _mm256_set1_epi32(0x001F)), 3);
+	return _mm256_or_si256(_mm256_or_si256(r, g), b);
+}
+
+size_t image565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	size_t width = w & ~size_t(31);
+	for (size_t y = 0; y < h; ++y) {
+		for (size_t x = 0; x < width; x += 32) {
+			_store888(_shuffleX888To888(_expand565(&in[x])), _shuffleX888To888(_expand565(&in[x + 8])),
+				_shuffleX888To888(_expand565(&in[x + 16])), _shuffleX888To888(_expand565(&in[x + 24])), &out[x * 3]);
+		}
+		out += outStride;
+		in += stride / 2;
+	}
+	return width;
+}
+
+size_t imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	size_t width = w & ~size_t(31);
+	for (size_t y = 0; y < h; ++y) {
+		for (size_t x = 0; x < width; x += 32) {
+			_store888(_shuffleX888To888(_load(&in[x])), _shuffleX888To888(_load(&in[x + 8])),
+				_shuffleX888To888(_load(&in[x + 16])), _shuffleX888To888(_load(&in[x + 24])), &out[x * 3]);
+		}
+		out += outStride;
+		in += stride / 4;
+	}
+	return width;
+}
+
+size_t imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	size_t width = w & ~size_t(31);
+	for (size_t y = 0; y + 1 < h; y += 2) {
+		for (size_t x = 0; x < width; x += 32) {
+			__m256i out0 = _halveW16(_convert565ToGray(_load(&in[x])), _convert565ToGray(_load(&in[x + 16])));
+			__m256i out1 = _halveW16(_convert565ToGray(_load(&in[x + stride / 2])), _convert565ToGray(_load(&in[x + 16 + stride / 2])));
+
+			// Halve height, then put the lanes' quadwords back in order
+			out0 = _mm256_avg_epu16(out0, out1);
+			out0 = _mm256_permute4x64_epi64(out0, 0xD8);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[x / 2]), _narrow16(out0));
+		}
+		out += outStride;
+		in += stride;
+	}
+	return width;
+}
+
+size_t imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	size_t width = w & ~size_t(63);
+	for (size_t y = 0; y + 3 < h; y += 4) {
+		for (size_t x = 0; x < width; x += 64) {
+			__m256i gray0 = _convert565ToGray(_halveWNeighbor16(_load(&in[x]), _load(&in[x + 16])));
+			__m256i gray1 = _convert565ToGray(_halveWNeighbor16(_load(&in[x + 32]), _load(&in[x + 48])));
+			__m256i out0 = _halveW16(gray0, gray1);
+
+			gray0 = _convert565ToGray(_halveWNeighbor16(_load(&in[x + stride]), _load(&in[x + 16 + stride])));
+			gray1 = _convert565ToGray(_halveWNeighbor16(_load(&in[x + 32 + stride]), _load(&in[x + 48 + stride])));
+			__m256i out1 = _halveW16(gray0, gray1);
+
+			// Halve height, then put the lanes' pixel pairs back in order
+			out0 = _mm256_avg_epu16(out0, out1);
+			out0 = _mm256_permutevar8x32_epi32(out0, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[x / 4]), _narrow16(out0));
+		}
+		out += outStride;
+		in += stride * 2;
+	}
+	return width;
+}
+
+size_t imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	size_t width = w & ~size_t(15);
+	for (size_t y = 0; y + 1 < h; y += 2) {
+		for (size_t x = 0; x < width; x += 16) {
+			__m256i out0 = _halveW32(_convertX888ToGray(_load(&in[x])), _convertX888ToGray(_load(&in[x + 8])));
+			__m256i out1 = _halveW32(_convertX888ToGray(_load(&in[x + stride / 4])), _convertX888ToGray(_load(&in[x + 8 + stride / 4])));
+
+			// Halve height, then put the lanes' quadwords back in order
+			out0 = _mm256_avg_epu16(out0, out1);
+			out0 = _mm256_permute4x64_epi64(out0, 0xD8);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(&out[x / 2]), _narrow32(out0));
+		}
+		out += outStride;
+		in += stride / 2;
+	}
+	return width;
+}
+
+size_t imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	size_t width = w & ~size_t(31);
+	for (size_t y = 0; y + 3 < h; y += 4) {
+		for (size_t x = 0; x < width; x += 32) {
+			__m256i gray0 = _convertX888ToGray(_halveWNeighbor32(_load(&in[x]), _load(&in[x + 8])));
+			__m256i gray1 = _convertX888ToGray(_halveWNeighbor32(_load(&in[x + 16]), _load(&in[x + 24])));
+			__m256i out0 = _halveW32(gray0, gray1);
+
+			gray0 = _convertX888ToGray(_halveWNeighbor32(_load(&in[x + stride / 2]), _load(&in[x + 8 + stride / 2])));
+			gray1 = _convertX888ToGray(_halveWNeighbor32(_load(&in[x + 16 + stride / 2]), _load(&in[x + 24 + stride / 2])));
+			__m256i out1 = _halveW32(gray0, gray1);
+
+			// Halve height, then put the lanes' pixels back in order
+			out0 = _mm256_avg_epu16(out0, out1);
+			out0 = _mm256_permutevar8x32_epi32(out0, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(&out[x / 4]), _narrow32(out0));
+		}
+		out += outStride;
+		in += stride;
+	}
+	return width;
+}
+}
+}
@@ -0,0 +1,204 @@
+#include "imageops-wide.h"
+
+#include <immintrin.h>
+
+// Everything in this file is compiled with AVX-512 (F and BW) enabled, so it
+// must only be reached through the dispatch in imageops.cpp. As with the AVX2
+// kernels, the shuffles work per 128-bit lane and the results are put back
+// in order before they are narrowed and stored.
+
+namespace Retro {
+namespace AVX512 {
+
+static inline __m512i _load(const void* p) {
+	return _mm512_loadu_si512(p);
+}
+
+static inline __m512i _convert565ToGray(__m512i pix) {
+	/* Mask out channels */
+	__m512i r = _mm512_and_si512(pix, _mm512_set1_epi16(static_cast<short>(0xF800)));
+	__m512i g = _mm512_and_si512(pix, _mm512_set1_epi16(0x07E0));
+	__m512i b = _mm512_and_si512(pix, _mm512_set1_epi16(0x001F));
+	/* Normalize channels */
+	r = _mm512_srli_epi16(r, 10);
+	g = _mm512_srli_epi16(g, 5);
+	b = _mm512_slli_epi16(b, 1);
+	/* Combine channels */
+	r = _mm512_add_epi16(r, g);
+	r = _mm512_add_epi16(r, b);
+	return r;
+}
+
+static inline __m512i _convertX888ToGray(__m512i pix) {
+	const __m512i maskR32 = _mm512_broadcast_i32x4(_mm_set_epi8(0x80, 0x80, 0x80, 0x0E, 0x80, 0x80, 0x80, 0x0A, 0x80, 0x80, 0x80, 0x06, 0x80, 0x80, 0x80, 0x02));
+	const __m512i maskG32 = _mm512_broadcast_i32x4(_mm_set_epi8(0x80, 0x80, 0x80, 0x0D, 0x80, 0x80, 0x80, 0x09, 0x80, 0x80, 0x80, 0x05, 0x80, 0x80, 0x80, 0x01));
+	const __m512i maskB32 = _mm512_broadcast_i32x4(_mm_set_epi8(0x80, 0x80, 0x80, 0x0C, 0x80, 0x80, 0x80, 0x08, 0x80, 0x80, 0x80, 0x04, 0x80, 0x80, 0x80, 0x00));
+	/* Mask out channels */
+	__m512i r = _mm512_shuffle_epi8(pix, maskR32);
+	__m512i g = _mm512_shuffle_epi8(pix, maskG32);
+	__m512i b = _mm512_shuffle_epi8(pix, maskB32);
+	/* Combine channels */
+	r = _mm512_add_epi32(r, g);
+	r = _mm512_add_epi32(r, b);
+	r = _mm512_srli_epi16(r, 2);
+	return r;
+}
+
+static inline __m512i _halveW16(__m512i a, __m512i b) {
+	/* Same swizzle as the SSSE3 version, once per lane */
+	__m512i tmp0 = _mm512_shufflelo_epi16(a, 0xD8);
+	tmp0 = _mm512_shufflehi_epi16(tmp0, 0xD8);
+	tmp0 = _mm512_shuffle_epi32(tmp0, _MM_PERM_DBCA);
+	__m512i tmp1 = _mm512_shufflelo_epi16(b, 0xD8);
+	tmp1 = _mm512_shufflehi_epi16(tmp1, 0xD8);
+	tmp1 = _mm512_shuffle_epi32(tmp1, _MM_PERM_DBCA);
+	__m512i tmp2 = _mm512_unpacklo_epi64(tmp0, tmp1);
+	__m512i tmp3 = _mm512_unpackhi_epi64(tmp0, tmp1);
+	/* Halve width */
+	return _mm512_avg_epu16(tmp2, tmp3);
+}
+
+static inline __m512i _halveWNeighbor16(__m512i a, __m512i b) {
+	__m512i tmp0 = _mm512_shufflelo_epi16(a, 0xD8);
+	tmp0 = _mm512_shufflehi_epi16(tmp0, 0xD8);
+	tmp0 = _mm512_shuffle_epi32(tmp0, _MM_PERM_DBCA);
+	__m512i tmp1 = _mm512_shufflelo_epi16(b, 0xD8);
+	tmp1 = _mm512_shufflehi_epi16(tmp1, 0xD8);
+	tmp1 = _mm512_shuffle_epi32(tmp1, _MM_PERM_DBCA);
+	return _mm512_unpacklo_epi64(tmp0, tmp1);
+}
+
+static inline __m512i _halveW32(__m512i a, __m512i b) {
+	__m512i tmp0 = _mm512_shuffle_epi32(a, _MM_PERM_DBCA);
+	__m512i tmp1 = _mm512_shuffle_epi32(b, _MM_PERM_DBCA);
+	__m512i tmp2 = _mm512_unpacklo_epi64(tmp0, tmp1);
+	__m512i tmp3 = _mm512_unpackhi_epi64(tmp0, tmp1);
+	/* Halve width */
+	return _mm512_avg_epu16(tmp2, tmp3);
+}
+
+static inline __m512i _halveWNeighbor32(__m512i a, __m512i b) {
+	__m512i tmp0 = _mm512_shuffle_epi32(a, _MM_PERM_DBCA);
+	__m512i tmp1 = _mm512_shuffle_epi32(b, _MM_PERM_DBCA);
+	return _mm512_unpacklo_epi64(tmp0, tmp1);
+}
+
+/* 16 XRGB8888 pixels -> 48 packed RGB888 bytes */
+static inline void _store888(__m512i pix, uint8_t* out) {
+	const __m512i shuffle = _mm512_broadcast_i32x4(_mm_set_epi8(0x80, 0x80, 0x80, 0x80, 0x0C, 0x0D, 0x0E, 0x08, 0x09, 0x0A, 0x04, 0x05, 0x06, 0x00, 0x01, 0x02));
+	pix = _mm512_shuffle_epi8(pix, shuffle);
+	pix = _mm512_permutexvar_epi32(_mm512_setr_epi32(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0, 0, 0, 0), pix);
+	_mm512_mask_storeu_epi8(out, 0x0000FFFFFFFFFFFFULL, pix);
+}
+
+size_t image565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	size_t width = w & ~size_t(15);
+	for (size_t y = 0; y < h; ++y) {
+		for (size_t x = 0; x < width; x += 16) {
+			__m512i pix = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&in[x])));
+			__m512i r = _mm512_slli_epi32(_mm512_and_si512(pix, _mm512_set1_epi32(0xF800)), 8);
+			__m512i g = _mm512_slli_epi32(_mm512_and_si512(pix, _mm512_set1_epi32(0x07E0)), 5);
+			__m512i b = _mm512_slli_epi32(_mm512_and_si512(pix, _mm512_set1_epi32(0x001F)), 3);
+			_store888(_mm512_or_si512(_mm512_or_si512(r, g), b), &out[x * 3]);
+		}
+		out += outStride;
+		in += stride / 2;
+	}
+	return width;
+}
+
+size_t imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	size_t width = w & ~size_t(15);
+	for (size_t y = 0; y < h; ++y) {
+		for (size_t x = 0; x < width; x += 16) {
+			_store888(_load(&in[x]), &out[x * 3]);
+		}
+		out += outStride;
+		in += stride / 4;
+	}
+	return width;
+}
+
+size_t imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	size_t width = w & ~size_t(63);
+	for (size_t y = 0; y + 1 < h; y += 2) {
+		for (size_t x = 0; x < width; x += 64) {
+			__m512i out0 = _halveW16(_convert565ToGray(_load(&in[x])), _convert565ToGray(_load(&in[x + 32])));
+			__m512i out1 = _halveW16(_convert565ToGray(_load(&in[x + stride / 2])), _convert565ToGray(_load(&in[x + 32 + stride / 2])));
+
+			// Halve height, then put the lanes' quadwords back in order
+			out0 = _mm512_avg_epu16(out0, out1);
+			out0 = _mm512_permutexvar_epi64(_mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7), out0);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(&out[x / 2]), _mm512_cvtepi16_epi8(out0));
+		}
+		out += outStride;
+		in += stride;
+	}
+	return width;
+}
+
+size_t imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	size_t width = w & ~size_t(127);
+	for (size_t y = 0; y + 3 < h; y += 4) {
+		for (size_t x = 0; x < width; x += 128) {
+			__m512i gray0 = _convert565ToGray(_halveWNeighbor16(_load(&in[x]), _load(&in[x + 32])));
+			__m512i gray1 = _convert565ToGray(_halveWNeighbor16(_load(&in[x + 64]), _load(&in[x + 96])));
+			__m512i out0 = _halveW16(gray0, gray1);
+
+			gray0 = _convert565ToGray(_halveWNeighbor16(_load(&in[x + stride]), _load(&in[x + 32 + stride])));
+			gray1 = _convert565ToGray(_halveWNeighbor16(_load(&in[x + 64 + stride]), _load(&in[x + 96 + stride])));
+			__m512i out1 = _halveW16(gray0, gray1);
+
+			// Halve height, then put the lanes' pixel pairs back in order
+			out0 = _mm512_avg_epu16(out0, out1);
+			out0 = _mm512_permutexvar_epi32(_mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15), out0);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(&out[x / 4]), _mm512_cvtepi16_epi8(out0));
+		}
+		out += outStride;
+		in += stride * 2;
+	}
+	return width;
+}
+
+size_t imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	size_t width = w & ~size_t(31);
+	for (size_t y = 0; y + 1 < h; y += 2) {
+		for (size_t x = 0; x < width; x += 32) {
+			__m512i out0 = _halveW32(_convertX888ToGray(_load(&in[x])), _convertX888ToGray(_load(&in[x + 16])));
+			__m512i out1 = _halveW32(_convertX888ToGray(_load(&in[x + stride / 4])), _convertX888ToGray(_load(&in[x + 16 + stride / 4])));
+
+			// Halve height, then put the lanes' pixel pairs back in order
+			out0 = _mm512_avg_epu16(out0, out1);
+			out0 = _mm512_permutexvar_epi64(_mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7), out0);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[x / 2]), _mm512_cvtepi32_epi8(out0));
+		}
+		out += outStride;
+		in += stride / 2;
+	}
+	return width;
+}
+
+size_t imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	size_t width = w & ~size_t(63);
+	for (size_t y = 0; y + 3 < h; y += 4) {
+		for (size_t x = 0; x < width; x += 64) {
+			__m512i gray0 = _convertX888ToGray(_halveWNeighbor32(_load(&in[x]), _load(&in[x + 16])));
+			__m512i gray1 = _convertX888ToGray(_halveWNeighbor32(_load(&in[x + 32]), _load(&in[x + 48])));
+			__m512i out0 = _halveW32(gray0, gray1);
+
+			gray0 = _convertX888ToGray(_halveWNeighbor32(_load(&in[x + stride / 2]), _load(&in[x + 16 + stride / 2])));
+			gray1 = _convertX888ToGray(_halveWNeighbor32(_load(&in[x + 32 + stride / 2]), _load(&in[x + 48 + stride / 2])));
+			__m512i out1 = _halveW32(gray0, gray1);
+
+			// Halve height, then put the lanes' pixels back in order
+			out0 = _mm512_avg_epu16(out0, out1);
+			out0 = _mm512_permutexvar_epi32(_mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15), out0);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[x / 4]), _mm512_cvtepi32_epi8(out0));
+		}
+		out += outStride;
+		in += stride;
+	}
+	return width;
+}
+}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Kernels for wider vector units than the baseline build targets. These live
+// in their own translation units that are compiled for AVX2 and AVX-512
+// respectively, and are only called after checking that the CPU has them.
+//
+// Each kernel processes as many whole vectors from the left of every row as
+// fit and returns the number of input columns it covered; the caller
+// finishes the rest with the baseline kernels. Results are bit-identical to
+// the baseline kernels.
+
+namespace Retro {
+namespace AVX2 {
+size_t image565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+size_t imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+size_t imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+size_t imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+size_t imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+size_t imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+}
+
+namespace AVX512 {
+size_t image565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+size_t imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+size_t imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+size_t imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+size_t imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+size_t imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+}
+}
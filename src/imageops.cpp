@@ -4,22 +4,41 @@
 #include <emmintrin.h>
 #include <tmmintrin.h>
 #endif
-#include <stdexcept>
+#ifdef IMAGEOPS_WIDE
+#include "imageops-wide.h"
+#endif
+#include <algorithm>
+#include <array>
 #include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <vector>
 
 using namespace Retro;
 using namespace std;
 
-static void imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
-static void imageHalve565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride);
-static void imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
-static void imageQuarter565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride);
-static void image565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
-static void imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
-static void imageHalveX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride);
-static void imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
-static void imageQuarterX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride);
-static void imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
+template<Image::Format format>
+static void imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+template<Image::Format format>
+static void imageHalve565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride, size_t oldStride, size_t outStride);
+template<Image::Format format>
+static void imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+template<Image::Format format>
+static void imageQuarter565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride, size_t oldStride, size_t outStride);
+template<Image::Format format>
+static void image565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+template<Image::Format format>
+static void image565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+template<Image::Format format>
+static void image565ToX888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+static void imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+static void imageHalveX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride, size_t oldStride, size_t outStride);
+static void imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+static void imageQuarterX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride, size_t oldStride, size_t outStride);
+static void imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+static void imageX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
 
 #ifdef __SSSE3__
 const static __m128i maskR16 = _mm_set1_epi16(0xF800);
@@ -28,6 +47,29 @@ const static __m128i maskB16 = _mm_set1_epi16(0x001F);
 const static __m128i maskR32 = _mm_set_epi8(0x80, 0x80, 0x80, 0x0E, 0x80, 0x80, 0x80, 0x0A, 0x80, 0x80, 0x80, 0x06, 0x80, 0x80, 0x80, 0x02);
 const static __m128i maskG32 = _mm_set_epi8(0x80, 0x80, 0x80, 0x0D, 0x80, 0x80, 0x80, 0x09, 0x80, 0x80, 0x80, 0x05, 0x80, 0x80, 0x80, 0x01);
 const static __m128i maskB32 = _mm_set_epi8(0x80, 0x80, 0x80, 0x0C, 0x80, 0x80, 0x80, 0x08, 0x80, 0x80, 0x80, 0x04, 0x80, 0x80, 0x80, 0x00);
+#endif
+
+// The 16-bit kernels are written for RGB565. 0RGB1555 is widened to that
+// layout as it is loaded, with green gaining a zero low bit, so both formats
+// share the same kernels and give the same results for the same colors.
+template<Image::Format format>
+static inline uint16_t _pixel565(uint16_t pix) {
+	if (format == Image::Format::RGB1555) {
+		return ((pix & 0x7FE0) << 1) | (pix & 0x001F);
+	}
+	return pix;
+}
+
+#ifdef __SSSE3__
+template<Image::Format format>
+static inline __m128i _load565(const uint16_t* in) {
+	__m128i pix = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+	if (format == Image::Format::RGB1555) {
+		__m128i rg = _mm_slli_epi16(_mm_and_si128(pix, _mm_set1_epi16(0x7FE0)), 1);
+		pix = _mm_or_si128(rg, _mm_and_si128(pix, maskB16));
+	}
+	return pix;
+}
 
 static inline __m128i _convert565ToGray(__m128i pix) {
 	/* Mask out channels */
@@ -136,7 +178,8 @@ static inline __m128i _halveWNeighbor32(__m128i a, __m128i b) {
 }
 #endif
 
-void imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+template<Image::Format format>
+void imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
 	for (size_t y = 0; y + 1 < h; y += 2) {
 		size_t x = 0;
 #ifdef __SSSE3__
@@ -144,12 +187,12 @@ void imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, s
 			__m128i gray0;
 			__m128i gray1;
 
-			gray0 = _convert565ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x])));
-			gray1 = _convert565ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 8])));
+			gray0 = _convert565ToGray(_load565<format>(&in[x]));
+			gray1 = _convert565ToGray(_load565<format>(&in[x + 8]));
 			__m128i out0 = _halveW16(gray0, gray1);
 
-			gray0 = _convert565ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + stride / 2])));
-			gray1 = _convert565ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 8 + stride / 2])));
+			gray0 = _convert565ToGray(_load565<format>(&in[x + stride / 2]));
+			gray1 = _convert565ToGray(_load565<format>(&in[x + 8 + stride / 2]));
 			__m128i out1 = _halveW16(gray0, gray1);
 
 			// Halve height
@@ -159,17 +202,19 @@ void imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, s
 			out += 8;
 		}
 #endif
-		for (; x < w; x += 2) {
-			unsigned gray0 = _convert565ToGray(in[x], in[x + 1]);
-			unsigned gray1 = _convert565ToGray(in[x + stride / 2], in[x + stride / 2 + 1]);
+		for (; x + 1 < w; x += 2) {
+			unsigned gray0 = _convert565ToGray(_pixel565<format>(in[x]), _pixel565<format>(in[x + 1]));
+			unsigned gray1 = _convert565ToGray(_pixel565<format>(in[x + stride / 2]), _pixel565<format>(in[x + stride / 2 + 1]));
 			*out = (gray0 + gray1) / 2;
 			++out;
 		}
+		out += outStride - w / 2;
 		in += stride;
 	}
 }
 
-void imageHalve565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride) {
+template<Image::Format format>
+void imageHalve565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride, size_t oldStride, size_t outStride) {
 	for (size_t y = 0; y + 1 < h; y += 2) {
 		size_t x = 0;
 #ifdef __SSSE3__
@@ -177,40 +222,43 @@ void imageHalve565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uin
 			__m128i gray0;
 			__m128i gray1;
 
-			gray0 = _convert565ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x])));
-			gray1 = _convert565ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 8])));
+			gray0 = _convert565ToGray(_load565<format>(&in[x]));
+			gray1 = _convert565ToGray(_load565<format>(&in[x + 8]));
 			__m128i out0 = _halveW16(gray0, gray1);
 
-			gray0 = _convert565ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + stride / 2])));
-			gray1 = _convert565ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 8 + stride / 2])));
+			gray0 = _convert565ToGray(_load565<format>(&in[x + stride / 2]));
+			gray1 = _convert565ToGray(_load565<format>(&in[x + 8 + stride / 2]));
 			__m128i out1 = _halveW16(gray0, gray1);
 
 			// Halve height
 			out0 = _mm_avg_epu16(out0, out1);
 
 			// Interlace with old data
-			out1 = _mm_load_si128(reinterpret_cast<const __m128i*>(oldin));
+			out1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(oldin));
 			out1 = _mm_slli_epi16(out1, 8);
 			out0 = _mm_add_epi8(out0, out1);
-			_mm_store_si128(reinterpret_cast<__m128i*>(out), out0);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), out0);
 			oldin += 8;
 			out += 8;
 		}
 #endif
-		for (; x < w; x += 2) {
-			unsigned gray0 = _convert565ToGray(in[x], in[x + 1]);
-			unsigned gray1 = _convert565ToGray(in[x + stride / 2], in[x + stride / 2 + 1]);
+		for (; x + 1 < w; x += 2) {
+			unsigned gray0 = _convert565ToGray(_pixel565<format>(in[x]), _pixel565<format>(in[x + 1]));
+			unsigned gray1 = _convert565ToGray(_pixel565<format>(in[x + stride / 2]), _pixel565<format>(in[x + stride / 2 + 1]));
 			gray0 = (gray0 + gray1) / 2;
 			gray0 |= *oldin << 8;
 			*out = gray0;
 			++oldin;
 			++out;
 		}
+		oldin += oldStride / 2 - w / 2;
+		out += outStride / 2 - w / 2;
 		in += stride;
 	}
 }
 
-void imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+template<Image::Format format>
+void imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
 	for (size_t y = 0; y + 3 < h; y += 4) {
 		size_t x = 0;
 #ifdef __SSSE3__
@@ -218,14 +266,14 @@ void imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h,
 			__m128i gray0;
 			__m128i gray1;
 
-			gray0 = _halveWNeighbor16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x])), _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 8])));
-			gray1 = _halveWNeighbor16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 16])), _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 24])));
+			gray0 = _halveWNeighbor16(_load565<format>(&in[x]), _load565<format>(&in[x + 8]));
+			gray1 = _halveWNeighbor16(_load565<format>(&in[x + 16]), _load565<format>(&in[x + 24]));
 			gray0 = _convert565ToGray(gray0);
 			gray1 = _convert565ToGray(gray1);
 			__m128i out0 = _halveW16(gray0, gray1);
 
-			gray0 = _halveWNeighbor16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + stride])), _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 8 + stride])));
-			gray1 = _halveWNeighbor16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 16 + stride])), _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 24 + stride])));
+			gray0 = _halveWNeighbor16(_load565<format>(&in[x + stride]), _load565<format>(&in[x + 8 + stride]));
+			gray1 = _halveWNeighbor16(_load565<format>(&in[x + 16 + stride]), _load565<format>(&in[x + 24 + stride]));
 			gray0 = _convert565ToGray(gray0);
 			gray1 = _convert565ToGray(gray1);
 			__m128i out1 = _halveW16(gray0, gray1);
@@ -238,16 +286,18 @@ void imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h,
 		}
 #endif
 		for (; x + 3 < w; x += 4) {
-			unsigned gray0 = _convert565ToGray(in[x], in[x + 2]);
-			unsigned gray1 = _convert565ToGray(in[x + stride], in[x + stride + 2]);
+			unsigned gray0 = _convert565ToGray(_pixel565<format>(in[x]), _pixel565<format>(in[x + 2]));
+			unsigned gray1 = _convert565ToGray(_pixel565<format>(in[x + stride]), _pixel565<format>(in[x + stride + 2]));
 			*out = (gray0 + gray1) / 2;
 			++out;
 		}
+		out += outStride - w / 4;
 		in += stride * 2;
 	}
 }
 
-void imageQuarter565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride) {
+template<Image::Format format>
+void imageQuarter565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride, size_t oldStride, size_t outStride) {
 	for (size_t y = 0; y + 3 < h; y += 4) {
 		size_t x = 0;
 #ifdef __SSSE3__
@@ -255,14 +305,14 @@ void imageQuarter565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, u
 			__m128i gray0;
 			__m128i gray1;
 
-			gray0 = _halveWNeighbor16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x])), _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 8])));
-			gray1 = _halveWNeighbor16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 16])), _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 24])));
+			gray0 = _halveWNeighbor16(_load565<format>(&in[x]), _load565<format>(&in[x + 8]));
+			gray1 = _halveWNeighbor16(_load565<format>(&in[x + 16]), _load565<format>(&in[x + 24]));
 			gray0 = _convert565ToGray(gray0);
 			gray1 = _convert565ToGray(gray1);
 			__m128i out0 = _halveW16(gray0, gray1);
 
-			gray0 = _halveWNeighbor16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + stride])), _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 8 + stride])));
-			gray1 = _halveWNeighbor16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 16 + stride])), _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 24 + stride])));
+			gray0 = _halveWNeighbor16(_load565<format>(&in[x + stride]), _load565<format>(&in[x + 8 + stride]));
+			gray1 = _halveWNeighbor16(_load565<format>(&in[x + 16 + stride]), _load565<format>(&in[x + 24 + stride]));
 			gray0 = _convert565ToGray(gray0);
 			gray1 = _convert565ToGray(gray1);
 			__m128i out1 = _halveW16(gray0, gray1);
@@ -280,20 +330,22 @@ void imageQuarter565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, u
 		}
 #endif
 		for (; x + 3 < w; x += 4) {
-			unsigned gray0 = _convert565ToGray(in[x], in[x + 2]);
-			unsigned gray1 = _convert565ToGray(in[x + stride], in[x + stride + 2]);
+			unsigned gray0 = _convert565ToGray(_pixel565<format>(in[x]), _pixel565<format>(in[x + 2]));
+			unsigned gray1 = _convert565ToGray(_pixel565<format>(in[x + stride]), _pixel565<format>(in[x + stride + 2]));
 			gray0 = (gray0 + gray1) / 2;
 			gray0 |= *oldin << 8;
 			*out = gray0;
 			++oldin;
 			++out;
 		}
+		oldin += oldStride / 2 - w / 4;
+		out += outStride / 2 - w / 4;
 		in += stride * 2;
 	}
 }
 
 #ifdef __SSSE3__
-static inline void _convert565To888(const __m128i* in, __m128i* out) {
+static inline void _convert565To888(__m128i pix0, __m128i pix1, __m128i* out) {
 	/* 00 R0 00 R1 00 R2 00 R3 00 R4 00 R5 00 R6 00 R7 -> R0 00 00 R1 00 00 R2 00 00 R3 00 00 R4 00 00 R5 */
 	const static __m128i rblend00 = _mm_set_epi8(0x0A, 0x80, 0x80, 0x08, 0x80, 0x80, 0x06, 0x80, 0x80, 0x04, 0x80, 0x80, 0x02, 0x80, 0x80, 0x00);
 
@@ -330,9 +382,6 @@ static inline void _convert565To888(const __m128i* in, __m128i* out) {
 	/* 00 B8 00 B9 00 BA 00 BB 00 BC 00 BD 00 BE 00 BF -> BA 00 00 BB 00 00 BC 00 00 BD 00 00 BE 00 00 BF */
 	const static __m128i bblend21 = _mm_set_epi8(0x0E, 0x80, 0x80, 0x0C, 0x80, 0x80, 0x0A, 0x80, 0x80, 0x08, 0x80, 0x80, 0x06, 0x80, 0x80, 0x04);
 
-	__m128i pix0 = _mm_load_si128(&in[0]);
-	__m128i pix1 = _mm_load_si128(&in[1]);
-
 	// Mask out channels
 	__m128i r0 = _mm_and_si128(pix0, maskR16);
 	__m128i g0 = _mm_and_si128(pix0, maskG16);
@@ -365,33 +414,84 @@ static inline void _convert565To888(const __m128i* in, __m128i* out) {
 	out2 = _mm_or_si128(out2, _mm_shuffle_epi8(g1, gblend21));
 	out2 = _mm_or_si128(out2, _mm_shuffle_epi8(b1, bblend21));
 
-	_mm_store_si128(&out[0], out0);
-	_mm_store_si128(&out[1], out1);
-	_mm_store_si128(&out[2], out2);
+	_mm_storeu_si128(&out[0], out0);
+	_mm_storeu_si128(&out[1], out1);
+	_mm_storeu_si128(&out[2], out2);
 }
 #endif
 
-void image565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+template<Image::Format format>
+void image565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
 	for (size_t y = 0; y < h; ++y) {
 		size_t x = 0;
 #ifdef __SSSE3__
-		for (; x < w; x += 16) {
-			_convert565To888(reinterpret_cast<const __m128i*>(&in[x]), reinterpret_cast<__m128i*>(out));
+		for (; x + 15 < w; x += 16) {
+			_convert565To888(_load565<format>(&in[x]), _load565<format>(&in[x + 8]), reinterpret_cast<__m128i*>(out));
 			out += 16 * 3;
 		}
 #endif
 		for (; x < w; ++x) {
-			uint16_t rgb = in[x];
+			uint16_t rgb = _pixel565<format>(in[x]);
 			out[0] = (rgb & 0xF800) >> 8;
 			out[1] = (rgb & 0x07E0) >> 3;
 			out[2] = (rgb & 0x001F) << 3;
 			out += 3;
 		}
+		out += outStride - w * 3;
 		in += stride / 2;
 	}
 }
 
-void imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+template<Image::Format format>
+void image565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+#ifdef __SSSE3__
+		for (; x + 7 < w; x += 8) {
+			__m128i gray = _convert565ToGray(_load565<format>(&in[x]));
+			gray = _mm_packus_epi16(gray, _mm_undefined_si128());
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out), gray);
+			out += 8;
+		}
+#endif
+		for (; x < w; ++x) {
+			*out = _convert565ToGray(_pixel565<format>(in[x]), _pixel565<format>(in[x]));
+			++out;
+		}
+		out += outStride - w;
+		in += stride / 2;
+	}
+}
+
+template<Image::Format format>
+void image565ToX888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+#ifdef __SSSE3__
+		for (; x + 7 < w; x += 8) {
+			__m128i pix = _load565<format>(&in[x]);
+			__m128i r = _mm_srli_epi16(_mm_and_si128(pix, maskR16), 8);
+			__m128i g = _mm_srli_epi16(_mm_and_si128(pix, maskG16), 3);
+			__m128i b = _mm_slli_epi16(_mm_and_si128(pix, maskB16), 3);
+			// Pair up B | G << 8 with 00 | R to interleave into little-endian X888
+			__m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi16(bg, r));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[16]), _mm_unpackhi_epi16(bg, r));
+			out += 8 * 4;
+		}
+#endif
+		for (; x < w; ++x) {
+			uint16_t rgb = _pixel565<format>(in[x]);
+			uint32_t pixel = ((rgb & 0xF800) << 8) | ((rgb & 0x07E0) << 5) | ((rgb & 0x001F) << 3);
+			memcpy(out, &pixel, sizeof(pixel));
+			out += 4;
+		}
+		out += outStride - w * 4;
+		in += stride / 2;
+	}
+}
+
+void imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
 	for (size_t y = 0; y + 1 < h; y += 2) {
 		size_t x = 0;
 #ifdef __SSSE3__
@@ -403,8 +503,8 @@ void imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h,
 			gray1 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 4])));
 			__m128i out0 = _halveW32(gray0, gray1);
 
-			gray0 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + stride / 2])));
-			gray1 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 4 + stride / 2])));
+			gray0 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + stride / 4])));
+			gray1 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 4 + stride / 4])));
 			__m128i out1 = _halveW32(gray0, gray1);
 
 			// Halve height
@@ -417,14 +517,17 @@ void imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h,
 		}
 #endif
 		for (; x + 1 < w; x += 2) {
-			*out = _convertX888ToGray(in[x], in[x + 1]);
+			unsigned gray0 = _convertX888ToGray(in[x], in[x + 1]);
+			unsigned gray1 = _convertX888ToGray(in[x + stride / 4], in[x + stride / 4 + 1]);
+			*out = (gray0 + gray1) / 2;
 			++out;
 		}
+		out += outStride - w / 2;
 		in += stride / 2;
 	}
 }
 
-void imageHalveX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride) {
+void imageHalveX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride, size_t oldStride, size_t outStride) {
 	for (size_t y = 0; y + 1 < h; y += 2) {
 		size_t x = 0;
 #ifdef __SSSE3__
@@ -436,8 +539,8 @@ void imageHalveX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, ui
 			gray1 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 4])));
 			__m128i out0 = _halveW32(gray0, gray1);
 
-			gray0 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + stride / 2])));
-			gray1 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 4 + stride / 2])));
+			gray0 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + stride / 4])));
+			gray1 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 4 + stride / 4])));
 			__m128i out1 = _halveW32(gray0, gray1);
 
 			// Halve height
@@ -455,16 +558,20 @@ void imageHalveX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, ui
 #endif
 		for (; x + 1 < w; x += 2) {
 			unsigned gray0 = _convertX888ToGray(in[x], in[x + 1]);
+			unsigned gray1 = _convertX888ToGray(in[x + stride / 4], in[x + stride / 4 + 1]);
+			gray0 = (gray0 + gray1) / 2;
 			gray0 |= *oldin << 8;
 			*out = gray0;
 			++oldin;
 			++out;
 		}
+		oldin += oldStride / 2 - w / 2;
+		out += outStride / 2 - w / 2;
 		in += stride / 2;
 	}
 }
 
-void imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+void imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
 	for (size_t y = 0; y + 3 < h; y += 4) {
 		size_t x = 0;
 #ifdef __SSSE3__
@@ -499,11 +606,12 @@ void imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h
 			*out = (gray0 + gray1) / 2;
 			++out;
 		}
+		out += outStride - w / 4;
 		in += stride;
 	}
 }
 
-void imageQuarterX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride) {
+void imageQuarterX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride, size_t oldStride, size_t outStride) {
 	for (size_t y = 0; y + 3 < h; y += 4) {
 		size_t x = 0;
 #ifdef __SSSE3__
@@ -545,11 +653,13 @@ void imageQuarterX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin,
 			++oldin;
 			++out;
 		}
+		oldin += oldStride / 2 - w / 4;
+		out += outStride / 2 - w / 4;
 		in += stride;
 	}
 }
 
-void imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+void imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
 	for (size_t y = 0; y < h; ++y) {
 		size_t x = 0;
 #ifdef __SSSE3__
@@ -572,10 +682,10 @@ void imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t
 			/* BC GC RC XC BD GD RD XD BE GE RE XE BF GF RF XF -> 00 00 00 00 RC GC BC RD GD BD RE GE BE RF GF DF */
 			const static __m128i blend23 = _mm_set_epi8(0x0C, 0x0D, 0x0E, 0x08, 0x09, 0x0A, 0x04, 0x05, 0x06, 0x00, 0x01, 0x02, 0x80, 0x80, 0x80, 0x80);
 
-			__m128i pix0 = _mm_load_si128(reinterpret_cast<const __m128i*>(&in[x]));
-			__m128i pix1 = _mm_load_si128(reinterpret_cast<const __m128i*>(&in[x + 4]));
-			__m128i pix2 = _mm_load_si128(reinterpret_cast<const __m128i*>(&in[x + 8]));
-			__m128i pix3 = _mm_load_si128(reinterpret_cast<const __m128i*>(&in[x + 12]));
+			__m128i pix0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x]));
+			__m128i pix1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 4]));
+			__m128i pix2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 8]));
+			__m128i pix3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 12]));
 
 			__m128i out0 = _mm_shuffle_epi8(pix0, blend00);
 			out0 = _mm_or_si128(out0, _mm_shuffle_epi8(pix1, blend01));
@@ -594,15 +704,437 @@ void imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t
 #endif
 		for (; x < w; ++x) {
 			uint32_t xrgb = in[x];
-			out[0] = xrgb;
+			out[0] = xrgb >> 16;
 			out[1] = xrgb >> 8;
-			out[2] = xrgb >> 16;
+			out[2] = xrgb;
 			out += 3;
 		}
+		out += outStride - w * 3;
+		in += stride / 4;
+	}
+}
+
+void imageX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+#ifdef __SSSE3__
+		for (; x + 3 < w; x += 4) {
+			__m128i gray = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x])));
+			gray = _mm_packus_epi16(gray, _mm_undefined_si128());
+			gray = _mm_packus_epi16(gray, _mm_undefined_si128());
+			unsigned outx = _mm_cvtsi128_si32(gray);
+			*reinterpret_cast<uint32_t*>(out) = outx;
+			out += 4;
+		}
+#endif
+		for (; x < w; ++x) {
+			*out = _convertX888ToGray(in[x], in[x]);
+			++out;
+		}
+		out += outStride - w;
 		in += stride / 4;
 	}
 }
 
+namespace {
+template<typename T>
+using Kernel = void (*)(const T* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+
+template<typename T>
+using WideKernel = size_t (*)(const T* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride);
+
+struct WideKernels {
+	WideKernel<uint16_t> image565To888 = nullptr;
+	WideKernel<uint32_t> imageX888To888 = nullptr;
+	WideKernel<uint16_t> imageHalve565ToGray = nullptr;
+	WideKernel<uint16_t> imageQuarter565ToGray = nullptr;
+	WideKernel<uint32_t> imageHalveX888ToGray = nullptr;
+	WideKernel<uint32_t> imageQuarterX888ToGray = nullptr;
+};
+}
+
+static Image::Simd bestSimd() {
+#ifdef IMAGEOPS_WIDE
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+		return Image::Simd::AVX512;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		return Image::Simd::AVX2;
+	}
+#endif
+	return Image::Simd::BASELINE;
+}
+
+static WideKernels wideKernels(Image::Simd simd) {
+	WideKernels kernels;
+	switch (simd) {
+	case Image::Simd::BASELINE:
+		break;
+#ifdef IMAGEOPS_WIDE
+	case Image::Simd::AVX2:
+		kernels.image565To888 = AVX2::image565To888;
+		kernels.imageX888To888 = AVX2::imageX888To888;
+		kernels.imageHalve565ToGray = AVX2::imageHalve565ToGray;
+		kernels.imageQuarter565ToGray = AVX2::imageQuarter565ToGray;
+		kernels.imageHalveX888ToGray = AVX2::imageHalveX888ToGray;
+		kernels.imageQuarterX888ToGray = AVX2::imageQuarterX888ToGray;
+		break;
+	case Image::Simd::AVX512:
+		kernels.image565To888 = AVX512::image565To888;
+		kernels.imageX888To888 = AVX512::imageX888To888;
+		kernels.imageHalve565ToGray = AVX512::imageHalve565ToGray;
+		kernels.imageQuarter565ToGray = AVX512::imageQuarter565ToGray;
+		kernels.imageHalveX888ToGray = AVX512::imageHalveX888ToGray;
+		kernels.imageQuarterX888ToGray = AVX512::imageQuarterX888ToGray;
+		break;
+#else
+	default:
+		break;
+#endif
+	}
+	return kernels;
+}
+
+static const Image::Simd s_bestSimd = bestSimd();
+static Image::Simd s_simd = s_bestSimd;
+static WideKernels s_wide = wideKernels(s_simd);
+
+// The wide kernel, if any, converts the left part of every row; the baseline
+// kernel finishes the columns it leaves over. divisor and depth locate the
+// first of those columns in the output.
+template<typename T>
+static void convert(WideKernel<T> wide, Kernel<T> kernel, size_t divisor, size_t depth, const void* in, void* out, size_t w, size_t h, size_t stride, size_t outStride) {
+	const T* pixels = static_cast<const T*>(in);
+	uint8_t* bytes = static_cast<uint8_t*>(out);
+	size_t x = 0;
+	if (wide) {
+		x = wide(pixels, bytes, w, h, stride, outStride);
+	}
+	if (x < w) {
+		kernel(&pixels[x], &bytes[x / divisor * depth], w - x, h, stride, outStride);
+	}
+}
+
+// Rows pooled by the *Max conversions at a time, which keeps them in cache
+static const size_t MAX_POOL_ROWS = 8;
+
+// Takes the larger of each channel of two rows of pixels, bytes long
+static void maxRow(void* out, const void* a, const void* b, Image::Format format, size_t bytes) {
+	size_t x = 0;
+	if (format == Image::Format::RGB565 || format == Image::Format::RGB1555) {
+		const uint16_t* pixelsA = static_cast<const uint16_t*>(a);
+		const uint16_t* pixelsB = static_cast<const uint16_t*>(b);
+		uint16_t* pixels = static_cast<uint16_t*>(out);
+		const uint16_t masks[3] = {
+			static_cast<uint16_t>(format == Image::Format::RGB565 ? 0xF800 : 0x7C00),
+			static_cast<uint16_t>(format == Image::Format::RGB565 ? 0x07E0 : 0x03E0),
+			0x001F
+		};
+		size_t w = bytes / 2;
+#ifdef __SSSE3__
+		for (; x + 7 < w; x += 8) {
+			__m128i pixA = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&pixelsA[x]));
+			__m128i pixB = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&pixelsB[x]));
+			__m128i pix = _mm_setzero_si128();
+			for (uint16_t mask : masks) {
+				__m128i channelA = _mm_and_si128(pixA, _mm_set1_epi16(mask));
+				__m128i channelB = _mm_and_si128(pixB, _mm_set1_epi16(mask));
+				// Unsigned 16-bit max, which needs SSE4.1 otherwise
+				pix = _mm_or_si128(pix, _mm_add_epi16(_mm_subs_epu16(channelA, channelB), channelB));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&pixels[x]), pix);
+		}
+#endif
+		for (; x < w; ++x) {
+			uint16_t pix = 0;
+			for (uint16_t mask : masks) {
+				pix |= max(pixelsA[x] & mask, pixelsB[x] & mask);
+			}
+			pixels[x] = pix;
+		}
+		return;
+	}
+
+	// Every other format has a byte per channel
+	const uint8_t* bytesA = static_cast<const uint8_t*>(a);
+	const uint8_t* bytesB = static_cast<const uint8_t*>(b);
+	uint8_t* bytesOut = static_cast<uint8_t*>(out);
+#ifdef __SSSE3__
+	for (; x + 15 < bytes; x += 16) {
+		__m128i pix = _mm_max_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&bytesA[x])), _mm_loadu_si128(reinterpret_cast<const __m128i*>(&bytesB[x])));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&bytesOut[x]), pix);
+	}
+#endif
+	for (; x < bytes; ++x) {
+		bytesOut[x] = max(bytesA[x], bytesB[x]);
+	}
+}
+
+namespace {
+// One dimension of a resize. Output pixel o is the weighted sum of the taps
+// input pixels starting at start[o]; shorter spans are padded with zero
+// weights. The float weights are stored by tap so neighbouring outputs are
+// adjacent. The same weights are also kept in 2.14 fixed point by output,
+// padded to whole vectors, for filtering along rows.
+struct ResizeFilter {
+	ResizeFilter(size_t in, size_t out);
+
+	static const int FIXED_ONE = 1 << 14;
+
+	size_t taps = 0;
+	size_t blocks = 0;
+	vector<size_t> start;
+	vector<float> weights;
+	vector<int16_t> fixedWeights;
+};
+
+struct Resizer {
+	Resizer(size_t inW, size_t inH, size_t outW, size_t outH)
+		: x(inW, outW)
+		, y(inH, outH) {
+	}
+
+	ResizeFilter x;
+	ResizeFilter y;
+
+	// One input row pooled with the old image, if there is one
+	vector<uint8_t> pooled;
+	// One input row converted to the output format, one plane per channel
+	vector<int16_t> planes;
+	// The last y.taps input rows after filtering them horizontally, as
+	// planes, by row % y.taps
+	vector<float> filtered;
+	vector<size_t> filteredRows;
+	vector<float> sum;
+};
+}
+
+ResizeFilter::ResizeFilter(size_t in, size_t out) {
+	double scale = static_cast<double>(in) / out;
+	vector<pair<size_t, vector<float>>> spans(out);
+	for (size_t o = 0; o < out; ++o) {
+		if (scale >= 1) {
+			double begin = o * scale;
+			double end = begin + scale;
+			spans[o].first = begin;
+			for (size_t i = begin; i < in && i < end; ++i) {
+				spans[o].second.push_back((min(end, i + 1.0) - max(begin, static_cast<double>(i))) / scale);
+			}
+		} else {
+			double center = max((o + 0.5) * scale - 0.5, 0.0);
+			size_t i = center;
+			if (i + 1 >= in) {
+				spans[o].first = in - 1;
+				spans[o].second.push_back(1);
+			} else {
+				double frac = center - i;
+				spans[o].first = i;
+				spans[o].second.push_back(1 - frac);
+				spans[o].second.push_back(frac);
+			}
+		}
+		taps = max(taps, spans[o].second.size());
+	}
+	blocks = (taps + 7) / 8;
+
+	start.resize(out);
+	weights.assign(taps * out, 0);
+	fixedWeights.assign(blocks * 8 * out, 0);
+	for (size_t o = 0; o < out; ++o) {
+		// Spans at the end are padded on the left so they stay in bounds
+		size_t pad = 0;
+		if (spans[o].first + taps > in) {
+			pad = spans[o].first + taps - in;
+		}
+		start[o] = spans[o].first - pad;
+		int16_t* fixed = &fixedWeights[o * blocks * 8];
+		int total = 0;
+		size_t largest = pad;
+		for (size_t t = 0; t < spans[o].second.size(); ++t) {
+			float weight = spans[o].second[t];
+			weights[(t + pad) * out + o] = weight;
+			fixed[t + pad] = weight * FIXED_ONE + 0.5f;
+			total += fixed[t + pad];
+			if (fixed[t + pad] > fixed[largest]) {
+				largest = t + pad;
+			}
+		}
+		// Rounding must not change the sum, or flat areas would drift
+		fixed[largest] += FIXED_ONE - total;
+	}
+}
+
+static Resizer& resizer(size_t inW, size_t inH, size_t outW, size_t outH) {
+	thread_local map<array<size_t, 4>, unique_ptr<Resizer>> resizers;
+	unique_ptr<Resizer>& resizer = resizers[{ { inW, inH, outW, outH } }];
+	if (!resizer) {
+		resizer.reset(new Resizer(inW, inH, outW, outH));
+	}
+	return *resizer;
+}
+
+template<Image::Format format>
+static void split565ToGray(int16_t* planes, const uint16_t* pixels, size_t w) {
+	size_t x = 0;
+#ifdef __SSSE3__
+	for (; x + 7 < w; x += 8) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&planes[x]), _convert565ToGray(_load565<format>(&pixels[x])));
+	}
+#endif
+	for (; x < w; ++x) {
+		planes[x] = _convert565ToGray(_pixel565<format>(pixels[x]), _pixel565<format>(pixels[x]));
+	}
+}
+
+template<Image::Format format>
+static void split565ToRGB(int16_t* r, int16_t* g, int16_t* b, const uint16_t* pixels, size_t w) {
+	for (size_t x = 0; x < w; ++x) {
+		uint16_t rgb = _pixel565<format>(pixels[x]);
+		r[x] = (rgb & 0xF800) >> 8;
+		g[x] = (rgb & 0x07E0) >> 3;
+		b[x] = (rgb & 0x001F) << 3;
+	}
+}
+
+// Converts a row straight to gray, or splits it into R, G and B planes
+static void splitRow(int16_t* planes, size_t planeSize, const void* in, Image::Format format, size_t w, bool gray) {
+	size_t x = 0;
+	if (gray) {
+		switch (format) {
+		case Image::Format::RGB565:
+			split565ToGray<Image::Format::RGB565>(planes, static_cast<const uint16_t*>(in), w);
+			break;
+		case Image::Format::RGB1555:
+			split565ToGray<Image::Format::RGB1555>(planes, static_cast<const uint16_t*>(in), w);
+			break;
+		case Image::Format::RGBX888: {
+			const uint32_t* pixels = static_cast<const uint32_t*>(in);
+#ifdef __SSSE3__
+			for (; x + 7 < w; x += 8) {
+				__m128i gray0 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&pixels[x])));
+				__m128i gray1 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&pixels[x + 4])));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(&planes[x]), _mm_packs_epi32(gray0, gray1));
+			}
+#endif
+			for (; x < w; ++x) {
+				planes[x] = _convertX888ToGray(pixels[x], pixels[x]);
+			}
+			break;
+		}
+		case Image::Format::G8: {
+			const uint8_t* pixels = static_cast<const uint8_t*>(in);
+			for (; x < w; ++x) {
+				planes[x] = pixels[x];
+			}
+			break;
+		}
+		default:
+			throw logic_error("unimplemented conversion");
+		}
+		return;
+	}
+
+	int16_t* r = planes;
+	int16_t* g = &planes[planeSize];
+	int16_t* b = &planes[planeSize * 2];
+	switch (format) {
+	case Image::Format::RGB565:
+		split565ToRGB<Image::Format::RGB565>(r, g, b, static_cast<const uint16_t*>(in), w);
+		break;
+	case Image::Format::RGB1555:
+		split565ToRGB<Image::Format::RGB1555>(r, g, b, static_cast<const uint16_t*>(in), w);
+		break;
+	case Image::Format::RGB888: {
+		const uint8_t* pixels = static_cast<const uint8_t*>(in);
+		for (; x < w; ++x) {
+			r[x] = pixels[x * 3];
+			g[x] = pixels[x * 3 + 1];
+			b[x] = pixels[x * 3 + 2];
+		}
+		break;
+	}
+	case Image::Format::RGBX888: {
+		const uint32_t* pixels = static_cast<const uint32_t*>(in);
+		for (; x < w; ++x) {
+			r[x] = (pixels[x] >> 16) & 0xFF;
+			g[x] = (pixels[x] >> 8) & 0xFF;
+			b[x] = pixels[x] & 0xFF;
+		}
+		break;
+	}
+	default:
+		throw logic_error("unimplemented conversion");
+	}
+}
+
+// Filters one plane of a row. in must be readable for filter.blocks * 8
+// pixels past the last span, and padded with zeros.
+static void filterPlane(float* out, const int16_t* in, const ResizeFilter& filter, size_t w) {
+	const size_t blocks = filter.blocks;
+	const int16_t* weights = filter.fixedWeights.data();
+	const float scale = 1.f / ResizeFilter::FIXED_ONE;
+	const size_t* start = filter.start.data();
+	size_t x = 0;
+#ifdef __SSSE3__
+	for (; x + 3 < w; x += 4) {
+		const int16_t* weight = &weights[x * blocks * 8];
+		__m128i sum0 = _mm_setzero_si128();
+		__m128i sum1 = _mm_setzero_si128();
+		__m128i sum2 = _mm_setzero_si128();
+		__m128i sum3 = _mm_setzero_si128();
+		for (size_t b = 0; b < blocks * 8; b += 8) {
+			sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[start[x] + b])), _mm_loadu_si128(reinterpret_cast<const __m128i*>(&weight[b]))));
+			sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[start[x + 1] + b])), _mm_loadu_si128(reinterpret_cast<const __m128i*>(&weight[blocks * 8 + b]))));
+			sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[start[x + 2] + b])), _mm_loadu_si128(reinterpret_cast<const __m128i*>(&weight[blocks * 16 + b]))));
+			sum3 = _mm_add_epi32(sum3, _mm_madd_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[start[x + 3] + b])), _mm_loadu_si128(reinterpret_cast<const __m128i*>(&weight[blocks * 24 + b]))));
+		}
+		__m128i sum = _mm_hadd_epi32(_mm_hadd_epi32(sum0, sum1), _mm_hadd_epi32(sum2, sum3));
+		_mm_storeu_ps(&out[x], _mm_mul_ps(_mm_cvtepi32_ps(sum), _mm_set1_ps(scale)));
+	}
+#endif
+	for (; x < w; ++x) {
+		const int16_t* pixels = &in[start[x]];
+		const int16_t* weight = &weights[x * blocks * 8];
+		int sum = 0;
+		for (size_t t = 0; t < blocks * 8; ++t) {
+			sum += pixels[t] * weight[t];
+		}
+		out[x] = sum * scale;
+	}
+}
+
+static void accumulateRow(float* sum, const float* row, float weight, size_t size) {
+	size_t i = 0;
+#ifdef __SSSE3__
+	__m128 w = _mm_set1_ps(weight);
+	for (; i + 3 < size; i += 4) {
+		__m128 acc = _mm_loadu_ps(&sum[i]);
+		acc = _mm_add_ps(acc, _mm_mul_ps(w, _mm_loadu_ps(&row[i])));
+		_mm_storeu_ps(&sum[i], acc);
+	}
+#endif
+	for (; i < size; ++i) {
+		sum[i] += weight * row[i];
+	}
+}
+
+static void storeRow(uint8_t* out, const float* sum, size_t size) {
+	size_t i = 0;
+#ifdef __SSSE3__
+	const __m128 half = _mm_set1_ps(0.5f);
+	for (; i + 7 < size; i += 8) {
+		__m128i lo = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(&sum[i]), half));
+		__m128i hi = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(&sum[i + 4]), half));
+		__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(lo, hi), _mm_undefined_si128());
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(&out[i]), bytes);
+	}
+#endif
+	for (; i < size; ++i) {
+		out[i] = min(sum[i] + 0.5f, 255.f);
+	}
+}
+
 Image::Image(Format format, const void* in, size_t w, size_t h, size_t stride)
 	: m_constBuffer(in)
 	, m_w(w)
@@ -620,6 +1152,34 @@ Image::Image(Format format, void* in, size_t w, size_t h, size_t stride)
 	, m_format(format) {
 }
 
+Image Retro::screenImage(const void* data, size_t w, size_t h, size_t stride, int depth) {
+	switch (depth) {
+	case 15:
+		return Image(Image::Format::RGB1555, data, w, h, stride);
+	case 16:
+		return Image(Image::Format::RGB565, data, w, h, stride);
+	case 32:
+		return Image(Image::Format::RGBX888, data, w, h, stride);
+	default:
+		throw runtime_error("Unsupported screen depth");
+	}
+}
+
+Image Image::crop(size_t x, size_t y, size_t w, size_t h) const {
+	if (x + w > m_w || y + h > m_h) {
+		throw invalid_argument("Crop is out of bounds");
+	}
+	Image cropped(*this);
+	size_t offset = y * m_stride + x * depth(m_format);
+	cropped.m_constBuffer = static_cast<const uint8_t*>(m_constBuffer) + offset;
+	if (m_buffer) {
+		cropped.m_buffer = static_cast<uint8_t*>(m_buffer) + offset;
+	}
+	cropped.m_w = w;
+	cropped.m_h = h;
+	return cropped;
+}
+
 void Image::copyTo(Image* other) {
 	if (m_w != other->m_w || m_h != other->m_h) {
 		throw invalid_argument("Image dimensions don't match");
@@ -631,7 +1191,31 @@ void Image::copyTo(Image* other) {
 			copyDirectlyTo(other);
 			break;
 		case Image::Format::RGB888:
-			image565To888(static_cast<const uint16_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
+			convert<uint16_t>(s_wide.image565To888, image565To888<Image::Format::RGB565>, 1, 3, m_constBuffer, other->m_buffer, m_w, m_h, m_stride, other->m_stride);
+			break;
+		case Image::Format::G8:
+			image565ToGray<Image::Format::RGB565>(static_cast<const uint16_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride, other->m_stride);
+			break;
+		case Image::Format::RGBX888:
+			image565ToX888<Image::Format::RGB565>(static_cast<const uint16_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride, other->m_stride);
+			break;
+		default:
+			throw logic_error("unimplemented conversion");
+		}
+		break;
+	case Image::Format::RGB1555:
+		switch (other->m_format) {
+		case Image::Format::RGB1555:
+			copyDirectlyTo(other);
+			break;
+		case Image::Format::RGB888:
+			convert<uint16_t>(nullptr, image565To888<Image::Format::RGB1555>, 1, 3, m_constBuffer, other->m_buffer, m_w, m_h, m_stride, other->m_stride);
+			break;
+		case Image::Format::G8:
+			image565ToGray<Image::Format::RGB1555>(static_cast<const uint16_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride, other->m_stride);
+			break;
+		case Image::Format::RGBX888:
+			image565ToX888<Image::Format::RGB1555>(static_cast<const uint16_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride, other->m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
@@ -641,6 +1225,7 @@ void Image::copyTo(Image* other) {
 		switch (other->m_format) {
 		case Image::Format::RGB888:
 			copyDirectlyTo(other);
+			break;
 		default:
 			throw logic_error("unimplemented conversion");
 		}
@@ -651,7 +1236,10 @@ void Image::copyTo(Image* other) {
 			copyDirectlyTo(other);
 			break;
 		case Image::Format::RGB888:
-			imageX888To888(static_cast<const uint32_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
+			convert<uint32_t>(s_wide.imageX888To888, imageX888To888, 1, 3, m_constBuffer, other->m_buffer, m_w, m_h, m_stride, other->m_stride);
+			break;
+		case Image::Format::G8:
+			imageX888ToGray(static_cast<const uint32_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride, other->m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
@@ -661,6 +1249,7 @@ void Image::copyTo(Image* other) {
 		switch (other->m_format) {
 		case Image::Format::G8:
 			copyDirectlyTo(other);
+			break;
 		default:
 			throw logic_error("unimplemented conversion");
 		}
@@ -676,7 +1265,16 @@ void Image::halveTo(Image* other) {
 	case Image::Format::RGB565:
 		switch (other->m_format) {
 		case Image::Format::G8:
-			imageHalve565ToGray(static_cast<const uint16_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
+			convert<uint16_t>(s_wide.imageHalve565ToGray, imageHalve565ToGray<Image::Format::RGB565>, 2, 1, m_constBuffer, other->m_buffer, m_w, m_h, m_stride, other->m_stride);
+			break;
+		default:
+			throw logic_error("unimplemented conversion");
+		}
+		break;
+	case Image::Format::RGB1555:
+		switch (other->m_format) {
+		case Image::Format::G8:
+			convert<uint16_t>(nullptr, imageHalve565ToGray<Image::Format::RGB1555>, 2, 1, m_constBuffer, other->m_buffer, m_w, m_h, m_stride, other->m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
@@ -687,7 +1285,7 @@ void Image::halveTo(Image* other) {
 	case Image::Format::RGBX888:
 		switch (other->m_format) {
 		case Image::Format::G8:
-			imageHalveX888ToGray(static_cast<const uint32_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
+			convert<uint32_t>(s_wide.imageHalveX888ToGray, imageHalveX888ToGray, 2, 1, m_constBuffer, other->m_buffer, m_w, m_h, m_stride, other->m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
@@ -709,7 +1307,16 @@ void Image::halveToInterlace(Image* other, const Image* old) {
 	case Image::Format::RGB565:
 		switch (other->m_format) {
 		case Image::Format::G8:
-			imageHalve565ToGrayInterlace(static_cast<const uint16_t*>(m_constBuffer), static_cast<const uint16_t*>(old->m_constBuffer), static_cast<uint16_t*>(other->m_buffer), m_w, m_h, m_stride);
+			imageHalve565ToGrayInterlace<Image::Format::RGB565>(static_cast<const uint16_t*>(m_constBuffer), static_cast<const uint16_t*>(old->m_constBuffer), static_cast<uint16_t*>(other->m_buffer), m_w, m_h, m_stride, old->m_stride, other->m_stride);
+			break;
+		default:
+			throw logic_error("unimplemented conversion");
+		}
+		break;
+	case Image::Format::RGB1555:
+		switch (other->m_format) {
+		case Image::Format::G8:
+			imageHalve565ToGrayInterlace<Image::Format::RGB1555>(static_cast<const uint16_t*>(m_constBuffer), static_cast<const uint16_t*>(old->m_constBuffer), static_cast<uint16_t*>(other->m_buffer), m_w, m_h, m_stride, old->m_stride, other->m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
@@ -720,7 +1327,7 @@ void Image::halveToInterlace(Image* other, const Image* old) {
 	case Image::Format::RGBX888:
 		switch (other->m_format) {
 		case Image::Format::G8:
-			imageHalveX888ToGrayInterlace(static_cast<const uint32_t*>(m_constBuffer), static_cast<const uint16_t*>(old->m_constBuffer), static_cast<uint16_t*>(other->m_buffer), m_w, m_h, m_stride);
+			imageHalveX888ToGrayInterlace(static_cast<const uint32_t*>(m_constBuffer), static_cast<const uint16_t*>(old->m_constBuffer), static_cast<uint16_t*>(other->m_buffer), m_w, m_h, m_stride, old->m_stride, other->m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
@@ -739,7 +1346,16 @@ void Image::quarterTo(Image* other) {
 	case Image::Format::RGB565:
 		switch (other->m_format) {
 		case Image::Format::G8:
-			imageQuarter565ToGray(static_cast<const uint16_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
+			convert<uint16_t>(s_wide.imageQuarter565ToGray, imageQuarter565ToGray<Image::Format::RGB565>, 4, 1, m_constBuffer, other->m_buffer, m_w, m_h, m_stride, other->m_stride);
+			break;
+		default:
+			throw logic_error("unimplemented conversion");
+		}
+		break;
+	case Image::Format::RGB1555:
+		switch (other->m_format) {
+		case Image::Format::G8:
+			convert<uint16_t>(nullptr, imageQuarter565ToGray<Image::Format::RGB1555>, 4, 1, m_constBuffer, other->m_buffer, m_w, m_h, m_stride, other->m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
@@ -750,7 +1366,7 @@ void Image::quarterTo(Image* other) {
 	case Image::Format::RGBX888:
 		switch (other->m_format) {
 		case Image::Format::G8:
-			imageQuarterX888ToGray(static_cast<const uint32_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
+			convert<uint32_t>(s_wide.imageQuarterX888ToGray, imageQuarterX888ToGray, 4, 1, m_constBuffer, other->m_buffer, m_w, m_h, m_stride, other->m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
@@ -775,7 +1391,16 @@ void Image::quarterToInterlace(Image* other, const Image* old) {
 	case Image::Format::RGB565:
 		switch (other->m_format) {
 		case Image::Format::G8:
-			imageQuarter565ToGrayInterlace(static_cast<const uint16_t*>(m_constBuffer), static_cast<const uint16_t*>(old->m_constBuffer), static_cast<uint16_t*>(other->m_buffer), m_w, m_h, m_stride);
+			imageQuarter565ToGrayInterlace<Image::Format::RGB565>(static_cast<const uint16_t*>(m_constBuffer), static_cast<const uint16_t*>(old->m_constBuffer), static_cast<uint16_t*>(other->m_buffer), m_w, m_h, m_stride, old->m_stride, other->m_stride);
+			break;
+		default:
+			throw logic_error("unimplemented conversion");
+		}
+		break;
+	case Image::Format::RGB1555:
+		switch (other->m_format) {
+		case Image::Format::G8:
+			imageQuarter565ToGrayInterlace<Image::Format::RGB1555>(static_cast<const uint16_t*>(m_constBuffer), static_cast<const uint16_t*>(old->m_constBuffer), static_cast<uint16_t*>(other->m_buffer), m_w, m_h, m_stride, old->m_stride, other->m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
@@ -786,7 +1411,7 @@ void Image::quarterToInterlace(Image* other, const Image* old) {
 	case Image::Format::RGBX888:
 		switch (other->m_format) {
 		case Image::Format::G8:
-			imageQuarterX888ToGrayInterlace(static_cast<const uint32_t*>(m_constBuffer), static_cast<const uint16_t*>(old->m_constBuffer), static_cast<uint16_t*>(other->m_buffer), m_w, m_h, m_stride);
+			imageQuarterX888ToGrayInterlace(static_cast<const uint32_t*>(m_constBuffer), static_cast<const uint16_t*>(old->m_constBuffer), static_cast<uint16_t*>(other->m_buffer), m_w, m_h, m_stride, old->m_stride, other->m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
@@ -834,28 +1459,211 @@ void Image::divideToInterlace(int divisor, Image* other, const Image* old) {
 	}
 }
 
-void Image::copyDirectlyTo(Image* other) {
-	size_t depth = 1;
-	switch (m_format) {
+void Image::copyToMax(Image* other, const Image* old) {
+	checkMax(old);
+	if (m_w != other->m_w || m_h != other->m_h) {
+		throw invalid_argument("Image dimensions don't match");
+	}
+	for (size_t y = 0; y < m_h; y += MAX_POOL_ROWS) {
+		size_t rows = min(MAX_POOL_ROWS, m_h - y);
+		Image out = other->crop(0, y, m_w, rows);
+		maxRows(old, y, rows).copyTo(&out);
+	}
+}
+
+void Image::divideToMax(int divisor, Image* other, const Image* old) {
+	checkMax(old);
+	if (divisor <= 0) {
+		throw invalid_argument("Cannot divide by zero");
+	}
+	if (m_w / divisor != other->m_w || m_h / divisor != other->m_h) {
+		throw invalid_argument("Image dimensions don't match");
+	}
+	// Whole output rows at a time; leftover input rows are dropped
+	size_t band = MAX_POOL_ROWS / divisor * divisor;
+	if (!band) {
+		band = divisor;
+	}
+	for (size_t y = 0; y < other->m_h * divisor; y += band) {
+		size_t rows = min(band, other->m_h * divisor - y);
+		Image out = other->crop(0, y / divisor, other->m_w, rows / divisor);
+		maxRows(old, y, rows).divideTo(divisor, &out);
+	}
+}
+
+void Image::resizeTo(Image* other) {
+	resize(other, nullptr);
+}
+
+void Image::resizeToMax(Image* other, const Image* old) {
+	checkMax(old);
+	resize(other, old);
+}
+
+void Image::resize(Image* other, const Image* old) {
+	if (m_w == other->m_w && m_h == other->m_h) {
+		if (old) {
+			copyToMax(other, old);
+		} else {
+			copyTo(other);
+		}
+		return;
+	}
+	if (!m_w || !m_h || !other->m_w || !other->m_h) {
+		throw invalid_argument("Cannot resize an empty image");
+	}
+	if (other->m_format != Image::Format::G8 && other->m_format != Image::Format::RGB888) {
+		throw logic_error("unimplemented conversion");
+	}
+	size_t channels = depth(other->m_format);
+	size_t rowSize = other->m_w * channels;
+	Resizer& resize = resizer(m_w, m_h, other->m_w, other->m_h);
+	const ResizeFilter& fx = resize.x;
+	const ResizeFilter& fy = resize.y;
+	size_t planeSize = m_w + fx.blocks * 8;
+	resize.planes.resize(planeSize * channels);
+	resize.filtered.resize(fy.taps * rowSize);
+	resize.filteredRows.assign(fy.taps, numeric_limits<size_t>::max());
+	resize.sum.resize(rowSize);
+
+	if (old) {
+		resize.pooled.resize(m_w * depth(m_format));
+	}
+
+	const uint8_t* in = static_cast<const uint8_t*>(m_constBuffer);
+	uint8_t* out = static_cast<uint8_t*>(other->m_buffer);
+	for (size_t oy = 0; oy < other->m_h; ++oy) {
+		fill(resize.sum.begin(), resize.sum.end(), 0.f);
+		for (size_t t = 0; t < fy.taps; ++t) {
+			size_t iy = fy.start[oy] + t;
+			float weight = fy.weights[t * other->m_h + oy];
+			if (!weight) {
+				continue;
+			}
+			float* filtered = &resize.filtered[iy % fy.taps * rowSize];
+			if (resize.filteredRows[iy % fy.taps] != iy) {
+				const uint8_t* row = &in[iy * m_stride];
+				if (old) {
+					const uint8_t* oldRow = &static_cast<const uint8_t*>(old->m_constBuffer)[iy * old->m_stride];
+					maxRow(resize.pooled.data(), row, oldRow, m_format, resize.pooled.size());
+					row = resize.pooled.data();
+				}
+				splitRow(resize.planes.data(), planeSize, row, m_format, m_w, channels == 1);
+				for (size_t c = 0; c < channels; ++c) {
+					filterPlane(&filtered[c * other->m_w], &resize.planes[c * planeSize], fx, other->m_w);
+				}
+				resize.filteredRows[iy % fy.taps] = iy;
+			}
+			accumulateRow(resize.sum.data(), filtered, weight, rowSize);
+		}
+		uint8_t* outRow = &out[oy * other->m_stride];
+		if (channels == 1) {
+			storeRow(outRow, resize.sum.data(), rowSize);
+		} else {
+			for (size_t x = 0; x < other->m_w; ++x) {
+				for (size_t c = 0; c < channels; ++c) {
+					outRow[x * channels + c] = min(resize.sum[c * other->m_w + x] + 0.5f, 255.f);
+				}
+			}
+		}
+	}
+}
+
+Image::Simd Image::simd() {
+	return s_simd;
+}
+
+bool Image::setSimd(Simd simd) {
+	if (simd > s_bestSimd) {
+		return false;
+	}
+	s_simd = simd;
+	s_wide = wideKernels(simd);
+	return true;
+}
+
+void Image::checkMax(const Image* old) const {
+	if (old->m_w != m_w || old->m_h != m_h) {
+		throw invalid_argument("Image dimensions don't match");
+	}
+	if (old->m_format != m_format) {
+		throw invalid_argument("Image formats don't match");
+	}
+}
+
+Image Image::maxRows(const Image* old, size_t y, size_t rows) const {
+	thread_local vector<uint8_t> pooled;
+	size_t rowSize = m_w * depth(m_format);
+	pooled.resize(rowSize * rows);
+	const uint8_t* in = static_cast<const uint8_t*>(m_constBuffer);
+	const uint8_t* oldIn = static_cast<const uint8_t*>(old->m_constBuffer);
+	for (size_t row = 0; row < rows; ++row) {
+		maxRow(&pooled[row * rowSize], &in[(y + row) * m_stride], &oldIn[(y + row) * old->m_stride], m_format, rowSize);
+	}
+	return Image(m_format, pooled.data(), m_w, rows, rowSize);
+}
+
+size_t Image::depth(Format format) {
+	switch (format) {
+	case Image::Format::RGB1555:
 	case Image::Format::RGB565:
-		depth = 2;
-		break;
+		return 2;
 	case Image::Format::RGB888:
-		depth = 3;
-		break;
+		return 3;
 	case Image::Format::RGBX888:
-		depth = 4;
-		break;
+		return 4;
 	case Image::Format::G8:
 		break;
 	}
-	if (m_stride == other->m_stride) {
+	return 1;
+}
+
+void Image::copyDirectlyTo(Image* other) {
+	if (m_stride == other->m_stride && m_stride == depth(m_format) * m_w) {
 		memcpy(other->m_buffer, m_constBuffer, m_stride * m_h);
 	} else {
 		const uint8_t* in = static_cast<const uint8_t*>(m_constBuffer);
 		uint8_t* out = static_cast<uint8_t*>(other->m_buffer);
 		for (size_t y = 0; y < m_h; ++y) {
-			memcpy(&out[other->m_stride * y], &in[m_stride * y], depth * y * m_w);
+			memcpy(&out[other->m_stride * y], &in[m_stride * y], depth(m_format) * m_w);
+		}
+	}
+}
+
+FrameStack::FrameStack(Image::Format format, size_t w, size_t h, size_t depth)
+	: m_format(format)
+	, m_w(w)
+	, m_h(h)
+	, m_depth(depth)
+	, m_stride(Image::depth(format) * w)
+	, m_frameSize(m_stride * h) {
+	if (!depth) {
+		throw invalid_argument("Frame stacks must hold at least one frame");
+	}
+	m_buffer.resize(m_frameSize * depth * 2);
+}
+
+uint8_t* FrameStack::next() {
+	return &m_buffer[m_next * m_frameSize];
+}
+
+void FrameStack::push() {
+	uint8_t* frame = &m_buffer[m_next * m_frameSize];
+	if (m_empty) {
+		for (size_t slot = 0; slot < m_depth * 2; ++slot) {
+			if (slot != m_next) {
+				memcpy(&m_buffer[slot * m_frameSize], frame, m_frameSize);
+			}
 		}
+		m_empty = false;
+	} else {
+		memcpy(&frame[m_depth * m_frameSize], frame, m_frameSize);
 	}
+	m_next = (m_next + 1) % m_depth;
+}
+
+void FrameStack::reset() {
+	m_next = 0;
+	m_empty = true;
+	fill(m_buffer.begin(), m_buffer.end(), 0);
 }
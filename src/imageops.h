@@ -2,23 +2,37 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <vector>
 
 namespace Retro {
 
 class Image {
 public:
 	enum class Format {
+		RGB1555,
 		RGB565,
 		RGB888,
 		RGBX888,
 		G8
 	};
 
+	enum class Simd {
+		BASELINE,
+		AVX2,
+		AVX512
+	};
+
 	Image() {}
 	Image(Format, const void* in, size_t w, size_t h, size_t stride);
 	Image(Format, void* in, size_t w, size_t h, size_t stride);
 	Image(const Image&) = default;
 
+	size_t width() const { return m_w; }
+	size_t height() const { return m_h; }
+
+	// Returns a view of a rectangle of this image, sharing its buffer
+	Image crop(size_t x, size_t y, size_t w, size_t h) const;
+
 	void copyTo(Image* other);
 	void halveTo(Image* other);
 	void halveToInterlace(Image* other, const Image* old);
@@ -27,8 +41,35 @@ public:
 	void divideTo(int divisor, Image* other);
 	void divideToInterlace(int divisor, Image* other, const Image* old);
 
+	// Resamples to the size of other, averaging over the covered area when
+	// shrinking and interpolating bilinearly when growing. Only a few rows
+	// are buffered at a time; the filter tables are kept per thread for each
+	// pair of sizes seen.
+	void resizeTo(Image* other);
+
+	// As copyTo, divideTo and resizeTo, but taking the brighter of this image
+	// and old, which has the same size and format, in each channel of each
+	// pixel first. This shows sprites that a game only draws every other
+	// frame. Rows are pooled a few at a time just ahead of the conversion.
+	void copyToMax(Image* other, const Image* old);
+	void divideToMax(int divisor, Image* other, const Image* old);
+	void resizeToMax(Image* other, const Image* old);
+
+	// Kernels for vector extensions beyond what the build targets are picked
+	// on startup from what the CPU supports. setSimd returns false if the CPU
+	// lacks the requested extensions.
+	static Simd simd();
+	static bool setSimd(Simd);
+
 private:
+	friend class FrameStack;
+
+	static size_t depth(Format);
+
 	void copyDirectlyTo(Image* other);
+	void resize(Image* other, const Image* old);
+	void checkMax(const Image* old) const;
+	Image maxRows(const Image* old, size_t y, size_t rows) const;
 
 	const void* m_constBuffer = nullptr;
 	void* m_buffer = nullptr;
@@ -37,4 +78,46 @@ private:
 	size_t m_stride;
 	Format m_format;
 };
+
+// A view of a core's framebuffer, whose format is given by its bits per pixel
+Image screenImage(const void* data, size_t w, size_t h, size_t stride, int depth);
+
+// The last few frames of one size and format, in a single allocation. Every
+// frame is stored twice, depth slots apart, so the most recent frames are
+// always contiguous from oldest to newest. Adding a frame then costs one
+// conversion and one copy, however deep the stack is.
+class FrameStack {
+public:
+	FrameStack(Image::Format, size_t w, size_t h, size_t depth);
+
+	Image::Format format() const { return m_format; }
+	size_t width() const { return m_w; }
+	size_t height() const { return m_h; }
+	size_t depth() const { return m_depth; }
+	size_t stride() const { return m_stride; }
+	size_t frameSize() const { return m_frameSize; }
+
+	// The last depth frames, oldest first, each frameSize bytes after the
+	// previous one. Pushing a frame changes what this points to.
+	const uint8_t* frames() const { return &m_buffer[m_next * m_frameSize]; }
+
+	// Where to write the next frame, with rows stride() bytes apart. It is
+	// added to the stack by calling push.
+	uint8_t* next();
+	void push();
+
+	// Forgets all frames; the first frame pushed afterwards fills the stack
+	void reset();
+
+private:
+	Image::Format m_format;
+	size_t m_w;
+	size_t m_h;
+	size_t m_depth;
+	size_t m_stride;
+	size_t m_frameSize;
+	size_t m_next = 0;
+	bool m_empty = true;
+	std::vector<uint8_t> m_buffer;
+};
 }
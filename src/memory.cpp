@@ -1,6 +1,7 @@
 #include "memory.h"
 
 #include <cstdlib>
+#include <cstring>
 #include <unordered_map>
 
 using namespace Retro;
@@ -391,6 +392,22 @@ MemoryView<>& AddressSpace::block(size_t offset) {
 	throw std::out_of_range("No known mapping");
 }
 
+size_t AddressSpace::packedSize() const {
+	size_t size = 0;
+	for (const auto& block : m_blocks) {
+		size += block.second.size();
+	}
+	return size;
+}
+
+void AddressSpace::pack(void* out) const {
+	uint8_t* bytes = static_cast<uint8_t*>(out);
+	for (const auto& block : m_blocks) {
+		memcpy(bytes, block.second.offset(0), block.second.size());
+		bytes += block.second.size();
+	}
+}
+
 bool AddressSpace::ok() const {
 	return m_blocks.size() > 0;
 }
@@ -465,19 +482,22 @@ int64_t AddressSpace::operator[](const Variable& var) const {
 		if (var.address - kv.first >= kv.second.size()) {
 			continue;
 		}
-		int64_t value;
-		if (m_overlay->width > 1) {
-			uint8_t fakeBase[16];
-			value = var.type.decode(m_overlay->parse(kv.second.offset(0), var.address - kv.first, reinterpret_cast<void*>(fakeBase), var.type.width));
-		} else {
-			value = var.type.decode(kv.second.offset(var.address - kv.first));
-		}
-		value &= var.mask;
-		return value;
+		return read(kv.second, Variable{ var.type, var.address - kv.first, var.mask });
 	}
 	throw std::out_of_range("No known mapping");
 }
 
+int64_t AddressSpace::read(const MemoryView<>& block, const Variable& var) const {
+	int64_t value;
+	if (m_overlay->width > 1) {
+		uint8_t fakeBase[16];
+		value = var.type.decode(m_overlay->parse(block.offset(0), var.address, reinterpret_cast<void*>(fakeBase), var.type.width));
+	} else {
+		value = var.type.decode(block.offset(var.address));
+	}
+	return value & var.mask;
+}
+
 AddressSpace& AddressSpace::operator=(AddressSpace&& as) {
 	m_blocks.clear();
 	m_overlay = move(as.m_overlay);
@@ -430,6 +430,13 @@ public:
 	const std::map<size_t, MemoryView<>>& blocks() const { return m_blocks; }
 	std::map<size_t, MemoryView<>>& blocks() { return m_blocks; }
 
+	// All of the blocks back to back, in order of address
+	size_t packedSize() const;
+	void pack(void* out) const;
+
+	// Reads a variable from one of the blocks, addressed from its start
+	int64_t read(const MemoryView<>& block, const Variable&) const;
+
 	bool ok() const;
 	void reset();
 	void clone(const AddressSpace&);
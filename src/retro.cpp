@@ -11,16 +11,20 @@ static inline T _hypot(T x, T y) {
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
 
+#include "audioops.h"
 #include "coreinfo.h"
 #include "data.h"
 #include "emulator.h"
 #include "imageops.h"
 #include "memory.h"
 #include "search.h"
-#include "script.h"
 #include "movie.h"
 #include "movie-bk2.h"
+#include "rewind.h"
+#include "savestate.h"
+#include "vecemulator.h"
 
+#include <array>
 #include <map>
 #include <unordered_map>
 #include <unordered_set>
@@ -30,55 +34,811 @@ namespace py = pybind11;
 using std::string;
 using namespace Retro;
 
+// Emulation, screen conversion and savestate calls release the GIL while they
+// run in C++. Separate emulator objects can therefore be driven from separate
+// Python threads in parallel, but a single RetroEmulator, VecRetroEmulator or
+// GameDataGlue must not be used from more than one thread at a time.
+static void checkContiguous(const py::buffer_info& info, const char* name = "out") {
+	ssize_t stride = info.itemsize;
+	for (ssize_t i = info.ndim - 1; i >= 0; --i) {
+		if (info.shape[i] > 1 && info.strides[i] != stride) {
+			throw std::invalid_argument(string(name) + " must be contiguous");
+		}
+		stride *= info.shape[i];
+	}
+}
+
+// Checks that out can take an h x w x channels screen. A two-dimensional
+// array is also accepted for single-channel screens. Only the rows may be
+// spaced out, the pixels in a row have to be packed.
+static py::array screenBuffer(py::object out, ssize_t w, ssize_t h, ssize_t channels) {
+	if (!py::isinstance<py::array>(out)) {
+		throw std::invalid_argument("out must be a numpy array");
+	}
+	py::array arr = py::reinterpret_borrow<py::array>(out);
+	if (!arr.dtype().is(py::dtype::of<uint8_t>()) || !arr.writeable()) {
+		throw std::invalid_argument("out must be a writable uint8 array");
+	}
+	bool packed;
+	if (arr.ndim() == 3) {
+		packed = arr.shape(0) == h && arr.shape(1) == w && arr.shape(2) == channels && arr.strides(2) == 1 && arr.strides(1) == channels;
+	} else if (arr.ndim() == 2 && channels == 1) {
+		packed = arr.shape(0) == h && arr.shape(1) == w && arr.strides(1) == 1;
+	} else {
+		packed = false;
+	}
+	if (!packed || arr.strides(0) < w * channels) {
+		throw std::invalid_argument("out has the wrong shape or layout for the screen");
+	}
+	return arr;
+}
+
+// How screens are converted for get_screen and step_action
+struct ScreenFormat {
+	ScreenFormat(bool gray, int downsample, bool interlace, py::object size, bool maxPool, bool indexed = false)
+		: gray(gray)
+		, downsample(downsample)
+		, interlace(interlace)
+		, maxPool(maxPool)
+		, indexed(indexed) {
+		if (indexed && (gray || downsample != 1 || interlace || !size.is_none() || maxPool)) {
+			throw std::invalid_argument("Indexed screens can only be cropped");
+		}
+		if (downsample != 1 && downsample != 2 && downsample != 4) {
+			throw std::invalid_argument("downsample must be 1, 2 or 4");
+		}
+		if (!gray && (downsample != 1 || interlace)) {
+			throw std::invalid_argument("Only grayscale screens can be downsampled or interlaced");
+		}
+		if (interlace && downsample == 1) {
+			throw std::invalid_argument("Interlaced screens must be downsampled");
+		}
+		if (interlace && maxPool) {
+			throw std::invalid_argument("Interlaced screens cannot also be max-pooled");
+		}
+		if (!size.is_none()) {
+			if (!py::isinstance<py::sequence>(size) || py::len(size) != 2) {
+				throw std::invalid_argument("size must be (width, height)");
+			}
+			py::sequence dims = py::reinterpret_borrow<py::sequence>(size);
+			width = dims[0].cast<size_t>();
+			height = dims[1].cast<size_t>();
+			if (!width || !height) {
+				throw std::invalid_argument("size must not be empty");
+			}
+			if (downsample != 1 || interlace) {
+				throw std::invalid_argument("Resized screens cannot also be downsampled or interlaced");
+			}
+		}
+	}
+
+	bool gray;
+	int downsample;
+	bool interlace;
+	// Each channel is the larger of the screen and the one before it
+	bool maxPool;
+	// Palette indices straight from the core instead of colors
+	bool indexed;
+	// Resized to width x height if these are set
+	size_t width = 0;
+	size_t height = 0;
+};
+
+// Turns an action of the given Actions type, either an integer or an array of
+// integers, into the buttons each player holds
+static void decodeAction(const Scenario& scen, py::handle action, int actionType, unsigned players, unsigned buttons, unsigned masks[MAX_PLAYERS]) {
+	std::array<int64_t, MAX_PLAYERS * N_BUTTONS> values;
+	size_t size = 1;
+	if (py::isinstance<py::sequence>(action) || py::isinstance<py::array>(action)) {
+		auto array = py::array_t<int64_t, py::array::c_style | py::array::forcecast>::ensure(action);
+		if (!array) {
+			throw std::invalid_argument("Action must be an integer or an array of integers");
+		}
+		size = array.size();
+		if (size > values.size()) {
+			throw std::invalid_argument("Action has too many values");
+		}
+		std::copy(array.data(), array.data() + size, values.begin());
+	} else {
+		values[0] = py::cast<int64_t>(action);
+	}
+	scen.decodeAction(static_cast<Scenario::ActionType>(actionType), values.data(), size, players, buttons, masks);
+}
+
+// The last depth screens of shape (height, width, channels), filled by
+// passing it to get_screen or step_action as stack. frames is a read-only
+// view of the stack rather than a copy, and passing out as well copies the
+// stack there in one go instead. The view is only valid until the next
+// screen is added: after that it shows the frames out of order, so copy it
+// to keep it.
+struct PyFrameStack {
+	Retro::FrameStack m_stack;
+	ssize_t m_channels;
+
+	PyFrameStack(size_t depth, py::object shape)
+		: m_stack(create(depth, shape))
+		, m_channels(py::reinterpret_borrow<py::sequence>(shape)[2].cast<ssize_t>()) {
+	}
+
+	static Retro::FrameStack create(size_t depth, py::object shape) {
+		if (!py::isinstance<py::sequence>(shape) || py::len(shape) != 3) {
+			throw std::invalid_argument("shape must be (height, width, channels)");
+		}
+		py::sequence dims = py::reinterpret_borrow<py::sequence>(shape);
+		size_t h = dims[0].cast<size_t>();
+		size_t w = dims[1].cast<size_t>();
+		size_t channels = dims[2].cast<size_t>();
+		if (!w || !h) {
+			throw std::invalid_argument("shape must not be empty");
+		}
+		switch (channels) {
+		case 1:
+			return Retro::FrameStack(Image::Format::G8, w, h, depth);
+		case 2:
+			// Interlaced screens
+			return Retro::FrameStack(Image::Format::G8, w * 2, h, depth);
+		case 3:
+			return Retro::FrameStack(Image::Format::RGB888, w, h, depth);
+		default:
+			throw std::invalid_argument("Screens have 1, 2 or 3 channels");
+		}
+	}
+
+	ssize_t width() const {
+		return m_stack.width() / (m_channels == 2 ? 2 : 1);
+	}
+
+	py::tuple shape() const {
+		return py::make_tuple(m_stack.depth(), m_stack.height(), width(), m_channels);
+	}
+
+	size_t depth() const {
+		return m_stack.depth();
+	}
+
+	void reset() {
+		m_stack.reset();
+	}
+
+	// Checks that out can take a copy of the stack, oldest frame first
+	py::array buffer(py::object out) const {
+		if (!py::isinstance<py::array>(out)) {
+			throw std::invalid_argument("out must be a numpy array");
+		}
+		py::array arr = py::reinterpret_borrow<py::array>(out);
+		if (!arr.dtype().is(py::dtype::of<uint8_t>()) || !arr.writeable() || !(arr.flags() & py::array::c_style) || arr.ndim() != 4
+			|| arr.shape(0) != static_cast<ssize_t>(depth()) || arr.shape(1) != static_cast<ssize_t>(m_stack.height()) || arr.shape(2) != width() || arr.shape(3) != m_channels) {
+			throw std::invalid_argument("out must be a writable, C-contiguous uint8 array of the stack's shape");
+		}
+		return arr;
+	}
+
+	static py::array frames(py::object self) {
+		PyFrameStack& stack = self.cast<PyFrameStack&>();
+		ssize_t frameSize = stack.m_stack.frameSize();
+		ssize_t stride = stack.m_stack.stride();
+		py::array arr(py::dtype::of<uint8_t>(),
+			{ static_cast<ssize_t>(stack.depth()), static_cast<ssize_t>(stack.m_stack.height()), stack.width(), stack.m_channels },
+			{ frameSize, stride, stack.m_channels, static_cast<ssize_t>(1) },
+			stack.m_stack.frames(), self);
+		arr.attr("setflags")(py::arg("write") = false);
+		return arr;
+	}
+};
+
+// Features of the audio of every frame an emulator runs while this is its
+// audio_features: the last rows mono samples at rate, or with kind "stft" or
+// "mel", the last rows spectrogram frames. features is a read-only view that
+// changes as frames run.
+struct PyAudioFeatures {
+	Retro::AudioFeatures m_features;
+
+	PyAudioFeatures(double rate, size_t rows, const string& kind, size_t fftSize, size_t hop, size_t bins)
+		: m_features(parseKind(kind), rate, rows, fftSize, hop, bins) {
+	}
+
+	static Retro::AudioFeatures::Kind parseKind(const string& kind) {
+		if (kind == "samples") {
+			return Retro::AudioFeatures::Kind::SAMPLES;
+		}
+		if (kind == "stft") {
+			return Retro::AudioFeatures::Kind::STFT;
+		}
+		if (kind == "mel") {
+			return Retro::AudioFeatures::Kind::MEL;
+		}
+		throw std::invalid_argument("kind must be \"samples\", \"stft\" or \"mel\"");
+	}
+
+	py::tuple shape() const {
+		return py::make_tuple(m_features.rows(), m_features.columns());
+	}
+
+	double rate() const {
+		return m_features.rate();
+	}
+
+	void reset() {
+		m_features.reset();
+	}
+
+	static py::array features(py::object self) {
+		PyAudioFeatures& features = self.cast<PyAudioFeatures&>();
+		ssize_t columns = features.m_features.columns();
+		py::array arr(py::dtype::of<float>(),
+			{ static_cast<ssize_t>(features.m_features.rows()), columns },
+			{ static_cast<ssize_t>(columns * sizeof(float)), static_cast<ssize_t>(sizeof(float)) },
+			features.m_features.features(), self);
+		arr.attr("setflags")(py::arg("write") = false);
+		return arr;
+	}
+
+	// Copies the features into a new array, or into out, a C-contiguous
+	// float32 array of the same size
+	py::array read(py::object out) {
+		size_t size = m_features.rows() * m_features.columns();
+		py::array arr;
+		if (out.is_none()) {
+			arr = py::array_t<float>(py::array::ShapeContainer{ static_cast<ssize_t>(m_features.rows()), static_cast<ssize_t>(m_features.columns()) });
+		} else {
+			if (!py::isinstance<py::array>(out)) {
+				throw std::invalid_argument("out must be a numpy array");
+			}
+			arr = py::reinterpret_borrow<py::array>(out);
+			if (!arr.dtype().is(py::dtype::of<float>()) || !arr.writeable() || !(arr.flags() & py::array::c_style) || static_cast<size_t>(arr.size()) != size) {
+				throw std::invalid_argument("out must be a writable, C-contiguous float32 array of the features' size");
+			}
+		}
+		memcpy(arr.mutable_data(), m_features.features(), size * sizeof(float));
+		return arr;
+	}
+};
+
+// Set as a RetroEmulator's rewind_buffer, it records the last frames frames
+// so that the emulator can be rewound to any of them.
+struct PyRewindBuffer {
+	Retro::RewindBuffer m_rewind;
+
+	PyRewindBuffer(size_t frames, unsigned interval)
+		: m_rewind(frames, interval) {
+	}
+
+	size_t frames() const {
+		return m_rewind.frames();
+	}
+
+	unsigned interval() const {
+		return m_rewind.interval();
+	}
+
+	size_t available() const {
+		return m_rewind.available();
+	}
+};
+
+// A savestate in a slab of a StateArena, which it goes back to once the
+// state is garbage collected. It can be read as a buffer.
+struct PySavedState {
+	std::shared_ptr<Retro::StateArena> m_arena;
+	uint8_t* m_data;
+	size_t m_size;
+
+	PySavedState(std::shared_ptr<Retro::StateArena> arena, size_t size)
+		: m_arena(std::move(arena))
+		, m_data(m_arena->acquire())
+		, m_size(size) {
+	}
+	PySavedState(const PySavedState&) = delete;
+
+	~PySavedState() {
+		m_arena->release(m_data);
+	}
+
+	size_t size() const {
+		return m_size;
+	}
+
+	py::buffer_info buffer() const {
+		return py::buffer_info(m_data, sizeof(uint8_t), py::format_descriptor<uint8_t>::format(), 1, { m_size }, { sizeof(uint8_t) }, true);
+	}
+};
+
+// Recycles fixed-size buffers for the savestates of one game, so that
+// saving them doesn't allocate once enough slabs have been made.
+struct PyStateArena {
+	std::shared_ptr<Retro::StateArena> m_arena;
+
+	PyStateArena(size_t slabSize)
+		: m_arena(std::make_shared<Retro::StateArena>(slabSize)) {
+	}
+
+	size_t slabSize() const {
+		return m_arena->slabSize();
+	}
+
+	size_t used() const {
+		return m_arena->used();
+	}
+
+	size_t capacity() const {
+		return m_arena->capacity();
+	}
+
+	std::unique_ptr<PySavedState> save(Retro::Emulator& emulator) {
+		size_t size = emulator.serializeSize();
+		if (size > m_arena->slabSize()) {
+			throw std::invalid_argument("The state is larger than the arena's slabs");
+		}
+		std::unique_ptr<PySavedState> state(new PySavedState(m_arena, size));
+		bool saved;
+		{
+			py::gil_scoped_release release;
+			saved = emulator.serialize(state->m_data, size);
+		}
+		if (!saved) {
+			throw std::runtime_error("Could not save the state");
+		}
+		return state;
+	}
+};
+
+// A savestate stored as the bytes that changed since its parent DeltaState
+struct PyDeltaState {
+	std::shared_ptr<const Retro::DeltaState> m_state;
+
+	size_t size() const {
+		return m_state->size();
+	}
+
+	size_t encodedSize() const {
+		return m_state->encodedSize();
+	}
+
+	size_t depth() const {
+		return m_state->depth();
+	}
+
+	py::object parent() const {
+		if (!m_state->parent()) {
+			return py::none();
+		}
+		return py::cast(PyDeltaState{ m_state->parent() });
+	}
+
+	py::object restore(py::object out) const {
+		size_t size = m_state->size();
+		if (out.is_none()) {
+			py::bytes bytes(NULL, size);
+			char* data = PyBytes_AsString(bytes.ptr());
+			py::gil_scoped_release release;
+			m_state->restore(data);
+			return std::move(bytes);
+		}
+		py::buffer_info info = out.cast<py::buffer>().request(true);
+		checkContiguous(info);
+		if (static_cast<size_t>(info.size * info.itemsize) < size) {
+			throw std::invalid_argument("out is smaller than the state");
+		}
+		{
+			py::gil_scoped_release release;
+			m_state->restore(info.ptr);
+		}
+		return py::int_(size);
+	}
+};
+
+// A decompressed .state file shared with every other user of the same file.
+// It can be read as a read-only buffer.
+struct PyCachedState {
+	std::shared_ptr<const std::vector<uint8_t>> m_state;
+
+	size_t size() const {
+		return m_state->size();
+	}
+
+	py::buffer_info buffer() const {
+		return py::buffer_info(const_cast<uint8_t*>(m_state->data()), sizeof(uint8_t), py::format_descriptor<uint8_t>::format(), 1, { m_state->size() }, { sizeof(uint8_t) }, true);
+	}
+};
+
 struct PyGameData;
 struct PyRetroEmulator {
 	Retro::Emulator m_re;
 	int m_cheats = 0;
+	unsigned m_buttons = 0;
+	std::vector<uint8_t> m_interlaced;
+	// The screen before the current one, for max pooling. It is saved just
+	// before the last frame of a step if the step asks for it, or of every
+	// step while m_keepPrevious is set, and forgotten otherwise.
+	bool m_keepPrevious = false;
+	std::vector<uint8_t> m_previous;
+	size_t m_previousWidth = 0;
+	size_t m_previousHeight = 0;
+	size_t m_previousPitch = 0;
+	int m_previousDepth = 0;
+	// Kept alive while the emulator pushes audio into it
+	py::object m_audioFeatures = py::none();
+	// Kept alive while the emulator records frames into it
+	py::object m_rewind = py::none();
+	// The last delta state saved or loaded and its bytes, so that saving its
+	// child doesn't need to restore it again
+	std::vector<uint8_t> m_stateBuffer;
+	std::vector<uint8_t> m_deltaBase;
+	std::weak_ptr<const Retro::DeltaState> m_lastDelta;
 	PyRetroEmulator(const string& rom_path) {
-		if (Emulator::isLoaded()) {
-			throw std::runtime_error("Cannot create multiple emulator instances per process, make sure to call env.close() on each environment before creating a new one");
-		}
 		if (!m_re.loadRom(rom_path.c_str())) {
 			throw std::runtime_error("Could not load ROM");
 		}
+		m_buttons = m_re.buttons().size();
 		m_re.run(); // otherwise you get a segfault when you try to get screen for the first time
 	}
 
 	void step() {
+		py::gil_scoped_release release;
+		keepPrevious(m_keepPrevious);
 		m_re.run();
 	}
 
+	void keepPrevious(bool keep) {
+		if (!keep) {
+			// It wouldn't be the screen before the next one anymore
+			m_previous.clear();
+			return;
+		}
+		m_previousWidth = m_re.getImageWidth();
+		m_previousHeight = m_re.getImageHeight();
+		m_previousPitch = m_re.getImagePitch();
+		m_previousDepth = m_re.getImageDepth();
+		const uint8_t* data = static_cast<const uint8_t*>(m_re.getImageData());
+		m_previous.assign(data, data + m_previousPitch * m_previousHeight);
+	}
+
+	// Runs the scenario for up to frames frames, keeping the screen before
+	// the last one if maxPool is set. Only those two frames are rendered.
+	unsigned runScenario(Scenario& scen, unsigned frames, float rewards[MAX_PLAYERS], bool maxPool) {
+		bool keep = maxPool || m_keepPrevious;
+		if (!keep || frames < 2) {
+			keepPrevious(keep);
+			return scen.step(&m_re, frames, rewards);
+		}
+		unsigned ran = scen.step(&m_re, frames - 1, rewards);
+		if (scen.isDone()) {
+			m_previous.clear();
+			return ran;
+		}
+		keepPrevious(true);
+		float lastRewards[MAX_PLAYERS];
+		ran += scen.step(&m_re, 1, lastRewards);
+		for (unsigned i = 0; i < MAX_PLAYERS; ++i) {
+			rewards[i] += lastRewards[i];
+		}
+		return ran;
+	}
+
+	size_t getStateSize() {
+		return m_re.serializeSize();
+	}
+
 	py::bytes getState() {
 		size_t size = m_re.serializeSize();
 		py::bytes bytes(NULL, size);
-		m_re.serialize(PyBytes_AsString(bytes.ptr()), size);
+		char* data = PyBytes_AsString(bytes.ptr());
+		{
+			py::gil_scoped_release release;
+			m_re.serialize(data, size);
+		}
 		return bytes;
 	}
 
-	bool setState(py::bytes o) {
-		return m_re.unserialize(PyBytes_AsString(o.ptr()), PyBytes_Size(o.ptr()));
+	size_t getStateInto(py::buffer out) {
+		size_t size = m_re.serializeSize();
+		py::buffer_info info = out.request(true);
+		checkContiguous(info);
+		if (static_cast<size_t>(info.size * info.itemsize) < size) {
+			throw std::invalid_argument("out is smaller than the state");
+		}
+		py::gil_scoped_release release;
+		m_re.serialize(info.ptr, size);
+		return size;
+	}
+
+	// Takes any contiguous buffer, such as bytes, a numpy array or a SavedState
+	bool setState(py::buffer state) {
+		py::buffer_info info = state.request();
+		checkContiguous(info, "state");
+		const void* data = info.ptr;
+		size_t size = info.size * info.itemsize;
+		py::gil_scoped_release release;
+		return loadState(data, size);
 	}
 
-	py::array_t<uint8_t> getScreen() {
-		long w = m_re.getImageWidth();
-		long h = m_re.getImageHeight();
-		py::array_t<uint8_t> arr({ { h, w, 3 } });
-		uint8_t* data = arr.mutable_data();
-		Image out(Image::Format::RGB888, data, w, h, w);
-		Image in;
-		if (m_re.getImageDepth() == 16) {
-			in = Image(Image::Format::RGB565, m_re.getImageData(), w, h, m_re.getImagePitch());
-		} else if (m_re.getImageDepth() == 32) {
-			in = Image(Image::Format::RGBX888, m_re.getImageData(), w, h, m_re.getImagePitch());
+	bool loadState(const void* data, size_t size) {
+		// The screen and audio before a loaded state are unrelated to it
+		m_previous.clear();
+		if (m_re.getAudioFeatures()) {
+			m_re.getAudioFeatures()->reset();
+		}
+		return m_re.unserialize(data, size);
+	}
+
+	PyDeltaState saveDelta(py::object parent) {
+		std::shared_ptr<const Retro::DeltaState> parentState;
+		if (!parent.is_none()) {
+			parentState = parent.cast<const PyDeltaState&>().m_state;
+		}
+		py::gil_scoped_release release;
+		size_t size = m_re.serializeSize();
+		m_stateBuffer.resize(size);
+		if (!m_re.serialize(m_stateBuffer.data(), size)) {
+			throw std::runtime_error("Could not save the state");
+		}
+		const void* base = nullptr;
+		if (parentState && parentState == m_lastDelta.lock() && m_deltaBase.size() == size) {
+			base = m_deltaBase.data();
+		}
+		auto state = std::make_shared<const Retro::DeltaState>(m_stateBuffer.data(), size, parentState, base);
+		m_stateBuffer.swap(m_deltaBase);
+		m_lastDelta = state;
+		return PyDeltaState{ state };
+	}
+
+	bool setDeltaState(const PyDeltaState& state) {
+		py::gil_scoped_release release;
+		m_stateBuffer.resize(state.size());
+		state.m_state->restore(m_stateBuffer.data());
+		m_stateBuffer.swap(m_deltaBase);
+		m_lastDelta = state.m_state;
+		return loadState(m_deltaBase.data(), m_deltaBase.size());
+	}
+
+	// Grayscale screens can also be downsampled by 2 or 4 and interlaced, in
+	// which case each pixel is paired with the same pixel of the previous
+	// interlaced screen as (current, previous). size resizes to (width,
+	// height) instead. crop is (x, y, width, height) in screen pixels, as in
+	// scenario.json. If out is given the screen is written into it instead of
+	// a new array; its rows may be padded. If stack is given the screen is
+	// added to that FrameStack and its frames are returned, as a view that is
+	// only valid until the next screen is added, or copied into out if that
+	// is given too. max_pool takes each channel
+	// as the larger of this screen and the one before it, if the last step
+	// kept that one. indexed gives the core's palette indices as a single channel
+	// instead, on cores that render through a palette.
+	py::array getScreen(bool gray, int downsample, bool interlace, py::object size, bool maxPool, py::object crop, py::object out, py::object stack, bool indexed) {
+		size_t x = 0;
+		size_t y = 0;
+		size_t width = 0;
+		size_t height = 0;
+		if (!crop.is_none()) {
+			if (!py::isinstance<py::sequence>(crop) || py::len(crop) != 4) {
+				throw std::invalid_argument("crop must be (x, y, width, height)");
+			}
+			py::sequence rect = py::reinterpret_borrow<py::sequence>(crop);
+			x = rect[0].cast<size_t>();
+			y = rect[1].cast<size_t>();
+			width = rect[2].cast<size_t>();
+			height = rect[3].cast<size_t>();
+		}
+		return convertScreen(ScreenFormat(gray, downsample, interlace, size, maxPool, indexed), x, y, width, height, out, stack);
+	}
+
+	// A width or height of 0, or one that runs past the edge of the screen,
+	// extends the crop to that edge.
+	py::array convertScreen(const ScreenFormat& format, size_t x, size_t y, size_t width, size_t height, py::object out, py::object stack) {
+		size_t screenWidth = m_re.getImageWidth();
+		size_t screenHeight = m_re.getImageHeight();
+		if (x >= screenWidth || y >= screenHeight) {
+			throw std::invalid_argument("Crop starts outside of the screen");
+		}
+		if (!width || x + width > screenWidth) {
+			width = screenWidth - x;
+		}
+		if (!height || y + height > screenHeight) {
+			height = screenHeight - y;
+		}
+		int downsample = format.downsample;
+		ssize_t w = format.width ? format.width : width / downsample;
+		ssize_t h = format.height ? format.height : height / downsample;
+		ssize_t channels = format.gray ? (format.interlace ? 2 : 1) : 3;
+		const void* palette;
+		size_t indexedPitch = 0;
+		const uint8_t* indexed = nullptr;
+		if (format.indexed) {
+			indexed = m_re.getIndexedData(&indexedPitch, &palette);
+			if (!indexed) {
+				throw std::runtime_error("This core has no indexed screens");
+			}
+			channels = 1;
+		}
+
+		py::array arr;
+		PyFrameStack* frameStack = nullptr;
+		uint8_t* data;
+		size_t stride;
+		if (!stack.is_none()) {
+			frameStack = &stack.cast<PyFrameStack&>();
+			if (frameStack->m_stack.height() != h || frameStack->width() != w || frameStack->m_channels != channels) {
+				throw std::invalid_argument("stack has the wrong shape for the screen");
+			}
+			if (!out.is_none()) {
+				arr = frameStack->buffer(out);
+			}
+			data = frameStack->m_stack.next();
+			stride = frameStack->m_stack.stride();
+		} else {
+			if (out.is_none()) {
+				arr = py::array_t<uint8_t>(py::array::ShapeContainer{ h, w, channels });
+			} else {
+				arr = screenBuffer(out, w, h, channels);
+			}
+			data = static_cast<uint8_t*>(arr.mutable_data());
+			stride = arr.strides(0);
+		}
+		if (format.interlace && stride % 2) {
+			throw std::invalid_argument("Rows of interlaced screens must start on even addresses");
+		}
+		{
+			py::gil_scoped_release release;
+			Image in;
+			if (indexed) {
+				in = Image(Image::Format::G8, indexed, screenWidth, screenHeight, indexedPitch);
+			} else {
+				in = screenImage(m_re.getImageData(), screenWidth, screenHeight, m_re.getImagePitch(), m_re.getImageDepth());
+			}
+			Image old;
+			bool pool = false;
+			if (format.maxPool) {
+				pool = !m_previous.empty() && m_previousWidth == screenWidth && m_previousHeight == screenHeight && m_previousDepth == m_re.getImageDepth();
+				if (pool) {
+					old = screenImage(m_previous.data(), screenWidth, screenHeight, m_previousPitch, m_previousDepth);
+				}
+			}
+			if (format.width) {
+				in = in.crop(x, y, width, height);
+			} else {
+				// Downsampling drops the leftover rows and columns
+				in = in.crop(x, y, w * downsample, h * downsample);
+			}
+			if (pool) {
+				old = old.crop(x, y, in.width(), in.height());
+			}
+			if (format.width) {
+				Image screen(format.gray ? Image::Format::G8 : Image::Format::RGB888, data, w, h, stride);
+				if (pool) {
+					in.resizeToMax(&screen, &old);
+				} else {
+					in.resizeTo(&screen);
+				}
+			} else if (indexed) {
+				Image screen(Image::Format::G8, data, w, h, stride);
+				in.copyTo(&screen);
+			} else if (!format.gray) {
+				Image screen(Image::Format::RGB888, data, w, h, stride);
+				if (pool) {
+					in.copyToMax(&screen, &old);
+				} else {
+					in.copyTo(&screen);
+				}
+			} else if (!format.interlace) {
+				Image screen(Image::Format::G8, data, w, h, stride);
+				if (pool) {
+					in.divideToMax(downsample, &screen, &old);
+				} else {
+					in.divideTo(downsample, &screen);
+				}
+			} else {
+				size_t rowSize = w * 2;
+				if (m_interlaced.size() != rowSize * h) {
+					m_interlaced.assign(rowSize * h, 0);
+				}
+				Image old(Image::Format::G8, m_interlaced.data(), rowSize, h, rowSize);
+				Image screen(Image::Format::G8, data, rowSize, h, stride);
+				in.divideToInterlace(downsample, &screen, &old);
+				for (ssize_t y = 0; y < h; ++y) {
+					memcpy(&m_interlaced[y * rowSize], &data[y * stride], rowSize);
+				}
+			}
+			if (frameStack) {
+				frameStack->m_stack.push();
+				if (!out.is_none()) {
+					memcpy(arr.mutable_data(), frameStack->m_stack.frames(), frameStack->depth() * frameStack->m_stack.frameSize());
+				}
+			}
+		}
+		if (frameStack && out.is_none()) {
+			return PyFrameStack::frames(stack);
 		}
-		in.copyTo(&out);
 		return arr;
 	}
 
+	// The colors of the palette indexed screens refer to, as (256, 3) RGB, or
+	// None if the core doesn't have one
+	py::object getPalette() {
+		size_t pitch;
+		const void* palette;
+		if (!m_re.getIndexedData(&pitch, &palette) || !palette) {
+			return py::none();
+		}
+		py::array_t<uint8_t> colors(py::array::ShapeContainer{ 256, 3 });
+		int depth = m_re.getImageDepth();
+		Image in = screenImage(palette, 256, 1, depth == 32 ? 256 * 4 : 256 * 2, depth);
+		Image out(Image::Format::RGB888, colors.mutable_data(), 256, 1, 256 * 3);
+		in.copyTo(&out);
+		return std::move(colors);
+	}
+
 	double getScreenRate() {
 		return m_re.getFrameRate();
 	}
 
+	bool getVideoEnabled() {
+		return m_re.getVideoEnabled();
+	}
+
+	bool getMaxPool() const {
+		return m_keepPrevious;
+	}
+
+	void setMaxPool(bool maxPool) {
+		m_keepPrevious = maxPool;
+	}
+
+	void setVideoEnabled(bool enabled) {
+		m_re.setVideoEnabled(enabled);
+	}
+
+	bool getAudioEnabled() {
+		return m_re.getAudioEnabled();
+	}
+
+	void setAudioEnabled(bool enabled) {
+		m_re.setAudioEnabled(enabled);
+	}
+
+	py::object getAudioFeatures() {
+		return m_audioFeatures;
+	}
+
+	void setAudioFeatures(py::object features) {
+		if (features.is_none()) {
+			m_re.setAudioFeatures(nullptr);
+		} else {
+			m_re.setAudioFeatures(&features.cast<PyAudioFeatures&>().m_features);
+		}
+		m_audioFeatures = features;
+	}
+
+	py::object getRewind() {
+		return m_rewind;
+	}
+
+	void setRewind(py::object rewind) {
+		if (rewind.is_none()) {
+			m_re.setRewind(nullptr);
+		} else {
+			Retro::RewindBuffer* buffer = &rewind.cast<PyRewindBuffer&>().m_rewind;
+			py::gil_scoped_release release;
+			m_re.setRewind(buffer);
+		}
+		m_rewind = rewind;
+	}
+
+	// Goes back frames frames, which must be no more than the rewind buffer's
+	// available frames
+	void rewind(size_t frames) {
+		if (!m_re.getRewind()) {
+			throw std::invalid_argument("No rewind buffer is set");
+		}
+		if (!frames) {
+			return;
+		}
+		py::gil_scoped_release release;
+		m_previous.clear();
+		if (m_re.getAudioFeatures()) {
+			m_re.getAudioFeatures()->reset();
+		}
+		m_re.getRewind()->rewind(m_re, frames);
+	}
+
 	py::array_t<int16_t> getAudio() {
 		py::array_t<int16_t> arr(py::array::ShapeContainer{ m_re.getAudioSamples(), 2 });
 		int16_t* data = arr.mutable_data();
@@ -86,6 +846,18 @@ struct PyRetroEmulator {
 		return arr;
 	}
 
+	size_t getAudioInto(py::array out) {
+		size_t samples = m_re.getAudioSamples();
+		if (!out.dtype().is(py::dtype::of<int16_t>()) || !out.writeable() || !(out.flags() & py::array::c_style)) {
+			throw std::invalid_argument("out must be a writable, C-contiguous int16 array");
+		}
+		if (static_cast<size_t>(out.size()) < samples * 2) {
+			throw std::invalid_argument("out is too small for the audio samples");
+		}
+		memcpy(out.mutable_data(), m_re.getAudioData(), samples * 4);
+		return samples;
+	}
+
 	double getAudioRate() {
 		return m_re.getAudioRate();
 	}
@@ -116,16 +888,116 @@ struct PyRetroEmulator {
 		m_cheats = 0;
 	}
 
-	void configureData(PyGameData& data);
+	static void configureData(py::object self, PyGameData& data);
+	py::tuple stepFrames(PyGameData& data, unsigned frames);
+	py::tuple stepAction(PyGameData& data, py::handle action, int actionType, unsigned players, unsigned frames, int obsType, bool gray, int downsample, bool interlace, py::object screenSize, bool maxPool, py::object stack, py::object out);
 	static bool loadCoreInfo(const string& json) {
 		return Retro::loadCoreInfo(json);
 	}
 };
 
+struct PyVecRetroEmulator {
+	Retro::VecEmulator m_vec;
+	PyVecRetroEmulator(const string& rom_path, size_t num_envs, size_t num_threads)
+		: m_vec(num_threads) {
+		if (!m_vec.loadRom(rom_path, num_envs)) {
+			throw std::runtime_error("Could not load ROM");
+		}
+	}
+
+	size_t numEnvs() const {
+		return m_vec.size();
+	}
+
+	// Checks that out can take every screen, one right after another
+	uint8_t* screensBuffer(py::object out) {
+		if (!py::isinstance<py::array>(out)) {
+			throw std::invalid_argument("out must be a numpy array");
+		}
+		py::array arr = py::reinterpret_borrow<py::array>(out);
+		if (arr.ndim() != 4 || arr.shape(0) != static_cast<ssize_t>(m_vec.size()) || !(arr.flags() & py::array::c_style)) {
+			throw std::invalid_argument("out must be a C-contiguous array of shape (num_envs, height, width, 3)");
+		}
+		screenBuffer(arr[py::int_(0)], m_vec.getImageWidth(), m_vec.getImageHeight(), 3);
+		return static_cast<uint8_t*>(arr.mutable_data());
+	}
+
+	// Converts the screens into out as each emulator finishes its frame, if
+	// out is given
+	void step(py::array_t<uint8_t, py::array::c_style | py::array::forcecast> masks, py::object out) {
+		unsigned players = 1;
+		unsigned buttons;
+		if (masks.ndim() == 2) {
+			buttons = masks.shape(1);
+		} else if (masks.ndim() == 3) {
+			players = masks.shape(1);
+			buttons = masks.shape(2);
+		} else {
+			throw std::runtime_error("masks must have shape (num_envs, buttons) or (num_envs, players, buttons)");
+		}
+		if (masks.shape(0) != static_cast<ssize_t>(m_vec.size())) {
+			throw std::runtime_error("masks.shape[0] != num_envs");
+		}
+		const uint8_t* data = masks.data();
+		uint8_t* screens = out.is_none() ? nullptr : screensBuffer(out);
+		py::gil_scoped_release release;
+		m_vec.step(data, players, buttons, screens);
+	}
+
+	// Converts the current screens into a new array, or into out
+	py::object getScreens(py::object out) {
+		if (out.is_none()) {
+			out = py::array_t<uint8_t>({ static_cast<ssize_t>(m_vec.size()), static_cast<ssize_t>(m_vec.getImageHeight()), static_cast<ssize_t>(m_vec.getImageWidth()), static_cast<ssize_t>(3) });
+		}
+		uint8_t* screens = screensBuffer(out);
+		{
+			py::gil_scoped_release release;
+			m_vec.getScreens(screens);
+		}
+		return out;
+	}
+
+	py::tuple getResolution() {
+		return py::make_tuple(m_vec.getImageWidth(), m_vec.getImageHeight());
+	}
+
+	Retro::Emulator& emulator(size_t index) {
+		if (index >= m_vec.size()) {
+			throw py::index_error();
+		}
+		return m_vec[index];
+	}
+
+	py::bytes getState(size_t index) {
+		Retro::Emulator& re = emulator(index);
+		size_t size = re.serializeSize();
+		py::bytes bytes(NULL, size);
+		char* data = PyBytes_AsString(bytes.ptr());
+		{
+			py::gil_scoped_release release;
+			re.serialize(data, size);
+		}
+		return bytes;
+	}
+
+	bool setState(size_t index, py::bytes o) {
+		Retro::Emulator& re = emulator(index);
+		const char* data = PyBytes_AsString(o.ptr());
+		size_t size = PyBytes_Size(o.ptr());
+		py::gil_scoped_release release;
+		return re.unserialize(data, size);
+	}
+
+	static void configureData(py::object self, size_t index, PyGameData& data);
+};
+
 struct PyMemoryView {
 	Retro::AddressSpace& m_mem;
-	PyMemoryView(Retro::AddressSpace& mem)
-		: m_mem(mem) {
+	// The emulator the game data is configured for, whose memory the blocks are
+	const py::object* m_emulator;
+	PyMemoryView(Retro::AddressSpace& mem, const py::object* emulator = nullptr)
+		: m_mem(mem)
+		, m_emulator(emulator) {
 	}
 
 	int64_t extract(size_t address, const string& type) {
@@ -144,13 +1016,40 @@ struct PyMemoryView {
 		return extract(py::int_(item["address"]), py::str(item["type"]));
 	}
 
-	py::dict blocks() {
+	// Writable arrays over the emulator's memory itself, by address. They keep
+	// that emulator alive even once the game data is configured for another.
+	static py::dict blocks(py::object self) {
+		PyMemoryView& view = self.cast<PyMemoryView&>();
+		py::object base = view.m_emulator && !view.m_emulator->is_none() ? *view.m_emulator : self;
 		py::dict obj;
-		for (const auto& iter : m_mem.blocks()) {
-			obj[py::int_(iter.first)] = py::bytes(static_cast<const char*>(iter.second.offset(0)), iter.second.size());
+		for (auto& iter : view.m_mem.blocks()) {
+			ssize_t size = iter.second.size();
+			obj[py::int_(iter.first)] = py::array_t<uint8_t>({ size }, { static_cast<ssize_t>(1) }, static_cast<uint8_t*>(iter.second.offset(0)), base);
 		}
 		return obj;
 	}
+
+	size_t packedSize() const {
+		return m_mem.packedSize();
+	}
+
+	// Copies all of the memory blocks, in order of address, into a new array
+	// or into out
+	py::object pack(py::object out) {
+		size_t size = m_mem.packedSize();
+		if (out.is_none()) {
+			py::array_t<uint8_t> ram(py::array::ShapeContainer{ static_cast<ssize_t>(size) });
+			m_mem.pack(ram.mutable_data());
+			return std::move(ram);
+		}
+		py::buffer_info info = py::reinterpret_borrow<py::buffer>(out).request(true);
+		checkContiguous(info);
+		if (static_cast<size_t>(info.size * info.itemsize) < size) {
+			throw std::invalid_argument("out is smaller than the memory");
+		}
+		m_mem.pack(info.ptr);
+		return out;
+	}
 };
 
 struct PySearch {
@@ -216,13 +1115,72 @@ struct PySearch {
 	}
 };
 
+// Variables compiled by GameDataGlue.compile_variables
+struct PyVariableVector {
+	Retro::VariableVector m_vars;
+
+	PyVariableVector(const Retro::GameData& data, const std::vector<string>& names)
+		: m_vars(data, names) {
+	}
+
+	py::list names() const {
+		py::list names;
+		for (const auto& name : m_vars.names()) {
+			names.append(name);
+		}
+		return names;
+	}
+
+	size_t size() const {
+		return m_vars.size();
+	}
+
+	// Custom values that aren't set are missing like unknown names are
+	template<typename T>
+	void readValues(T* out) const {
+		try {
+			m_vars.read(out);
+		} catch (const std::invalid_argument& e) {
+			throw pybind11::key_error(e.what());
+		}
+	}
+
+	// Writes the variables into a new int64 array, or into out, which may be
+	// an int64, float32 or float64 array
+	py::array read(py::object out) {
+		if (out.is_none()) {
+			py::array_t<int64_t> values(py::array::ShapeContainer{ static_cast<ssize_t>(m_vars.size()) });
+			readValues(values.mutable_data());
+			return std::move(values);
+		}
+		if (!py::isinstance<py::array>(out)) {
+			throw std::invalid_argument("out must be a numpy array");
+		}
+		py::array arr = py::reinterpret_borrow<py::array>(out);
+		if (!arr.writeable() || !(arr.flags() & py::array::c_style) || static_cast<size_t>(arr.size()) < m_vars.size()) {
+			throw std::invalid_argument("out must be a writable, C-contiguous array with room for every variable");
+		}
+		if (arr.dtype().is(py::dtype::of<int64_t>())) {
+			readValues(static_cast<int64_t*>(arr.mutable_data()));
+		} else if (arr.dtype().is(py::dtype::of<float>())) {
+			readValues(static_cast<float*>(arr.mutable_data()));
+		} else if (arr.dtype().is(py::dtype::of<double>())) {
+			readValues(static_cast<double*>(arr.mutable_data()));
+		} else {
+			throw std::invalid_argument("out must be an int64, float32 or float64 array");
+		}
+		return arr;
+	}
+};
+
 struct PyGameData {
 	Retro::GameData m_data;
 	Retro::Scenario m_scen{ m_data };
+	// The emulator whose memory m_data points into, kept alive for as long as
+	// the data is configured for it
+	py::object m_emulator = py::none();
 
 	bool load(py::handle data = py::none(), py::handle scen = py::none()) {
-		ScriptContext::reset();
-
 		bool success = true;
 		if (!data.is_none()) {
 			success = success && m_data.load(py::str(data));
@@ -253,6 +1211,16 @@ struct PyGameData {
 		return m_scen.filterAction(action);
 	}
 
+	py::list decodeAction(py::handle action, int actionType, unsigned players, unsigned buttons) const {
+		unsigned masks[MAX_PLAYERS];
+		::decodeAction(m_scen, action, actionType, players, buttons, masks);
+		py::list list;
+		for (unsigned player = 0; player < players; ++player) {
+			list.append(masks[player]);
+		}
+		return list;
+	}
+
 	py::list validActions() const {
 		py::list outer;
 		for (const auto& action : m_scen.validActions()) {
@@ -270,6 +1238,14 @@ struct PyGameData {
 		m_scen.update();
 	}
 
+	bool getRenderEveryFrame() const {
+		return m_scen.renderEveryFrame();
+	}
+
+	void setRenderEveryFrame(bool render) {
+		m_scen.setRenderEveryFrame(render);
+	}
+
 	py::object lookupValue(py::str name) const {
 		try {
 			Variant data = m_data.lookupValue(name);
@@ -312,6 +1288,21 @@ struct PyGameData {
 		return data;
 	}
 
+	// Resolves names to their memory once for reading them every step. The
+	// result has to be compiled again after configure_data or changes to the
+	// variables.
+	PyVariableVector compileVariables(py::iterable names) const {
+		std::vector<string> list;
+		for (const auto& name : names) {
+			list.emplace_back(name.cast<string>());
+		}
+		try {
+			return PyVariableVector(m_data, list);
+		} catch (const std::invalid_argument& e) {
+			throw pybind11::key_error(e.what());
+		}
+	}
+
 	py::dict getVariable(py::str name) const {
 		py::dict obj;
 		Retro::Variable var = m_data.getVariable(name);
@@ -361,7 +1352,7 @@ struct PyGameData {
 	}
 
 	PyMemoryView memory() {
-		return PyMemoryView(m_data.addressSpace());
+		return PyMemoryView(m_data.addressSpace(), &m_emulator);
 	}
 
 	void search(py::str name, int64_t value) {
@@ -390,8 +1381,73 @@ struct PyGameData {
 	}
 };
 
-void PyRetroEmulator::configureData(PyGameData& data) {
-	m_re.configureData(&data.m_data);
+void PyRetroEmulator::configureData(py::object self, PyGameData& data) {
+	self.cast<PyRetroEmulator&>().m_re.configureData(&data.m_data);
+	data.m_emulator = self;
+}
+
+py::tuple PyRetroEmulator::stepFrames(PyGameData& data, unsigned frames) {
+	float rewards[MAX_PLAYERS];
+	unsigned ran;
+	{
+		// Scripts run in the scenario's own context, so other threads can step
+		// other games meanwhile
+		py::gil_scoped_release release;
+		ran = runScenario(data.m_scen, frames, rewards, false);
+	}
+	py::list rewardList;
+	for (unsigned i = 0; i < MAX_PLAYERS; ++i) {
+		rewardList.append(rewards[i]);
+	}
+	return py::make_tuple(rewardList, data.m_scen.isDone(), ran);
+}
+
+py::tuple PyRetroEmulator::stepAction(PyGameData& data, py::handle action, int actionType, unsigned players, unsigned frames, int obsType, bool gray, int downsample, bool interlace, py::object screenSize, bool maxPool, py::object stack, py::object out) {
+	ScreenFormat format(gray, downsample, interlace, screenSize, maxPool, obsType == 2);
+	if (obsType == 1 && (!stack.is_none() || !out.is_none())) {
+		throw std::invalid_argument("Only screens can be stacked or written to out");
+	}
+	unsigned masks[MAX_PLAYERS];
+	decodeAction(data.m_scen, action, actionType, players, m_buttons, masks);
+	for (unsigned player = 0; player < players; ++player) {
+		for (unsigned key = 0; key < m_buttons; ++key) {
+			m_re.setKey(player, key, (masks[player] >> key) & 1);
+		}
+	}
+
+	float rewards[MAX_PLAYERS];
+	{
+		py::gil_scoped_release release;
+		runScenario(data.m_scen, frames, rewards, maxPool && obsType == 0);
+	}
+
+	py::object obs;
+	if (obsType == 0 || obsType == 2) {
+		size_t x = 0;
+		size_t y = 0;
+		size_t width = 0;
+		size_t height = 0;
+		data.m_scen.getCrop(&x, &y, &width, &height);
+		obs = convertScreen(format, x, y, width, height, out, stack);
+	} else if (obsType == 1) {
+		const AddressSpace& mem = data.m_data.addressSpace();
+		py::array_t<uint8_t> ram(py::array::ShapeContainer{ static_cast<ssize_t>(mem.packedSize()) });
+		mem.pack(ram.mutable_data());
+		obs = std::move(ram);
+	} else {
+		throw std::invalid_argument("Unrecognized observation type");
+	}
+
+	py::list rewardList;
+	for (unsigned i = 0; i < players; ++i) {
+		rewardList.append(rewards[i]);
+	}
+	return py::make_tuple(obs, rewardList, data.m_scen.isDone(), data.lookupAll());
+}
+
+void PyVecRetroEmulator::configureData(py::object self, size_t index, PyGameData& data) {
+	self.cast<PyVecRetroEmulator&>().emulator(index).configureData(&data.m_data);
+	data.m_emulator = self;
 }
 
 struct PyMovie {
@@ -446,8 +1502,10 @@ struct PyMovie {
 		return py::bytes(reinterpret_cast<const char*>(data.data()), data.size());
 	}
 
-	void setState(py::bytes data) {
-		m_movie->setState(reinterpret_cast<uint8_t*>(PyBytes_AsString(data.ptr())), PyBytes_Size(data.ptr()));
+	void setState(py::buffer data) {
+		py::buffer_info info = data.request();
+		checkContiguous(info, "state");
+		m_movie->setState(static_cast<const uint8_t*>(info.ptr), info.size * info.itemsize);
 	}
 };
 
@@ -459,30 +1517,112 @@ py::str dataPath(py::handle hint = py::none()) {
 	return Retro::GameData::dataPath(py::str(hint));
 }
 
+PyCachedState cachedState(const string& path) {
+	std::shared_ptr<const std::vector<uint8_t>> state;
+	{
+		py::gil_scoped_release release;
+		state = Retro::loadStateFile(path);
+	}
+	return PyCachedState{ state };
+}
+
 PYBIND11_MODULE(_retro, m) {
 	m.doc() = "libretro bindings";
 
+	py::class_<PyFrameStack>(m, "FrameStack")
+		.def(py::init<size_t, py::object>(), py::arg("depth"), py::arg("shape"))
+		.def_property_readonly("depth", &PyFrameStack::depth)
+		.def_property_readonly("shape", &PyFrameStack::shape)
+		.def_property_readonly("frames", &PyFrameStack::frames)
+		.def("reset", &PyFrameStack::reset);
+
+	py::class_<PyAudioFeatures>(m, "AudioFeatures")
+		.def(py::init<double, size_t, const string&, size_t, size_t, size_t>(), py::arg("rate"), py::arg("rows"), py::arg("kind") = "samples", py::arg("fft_size") = 512, py::arg("hop") = 0, py::arg("bins") = 64)
+		.def_property_readonly("shape", &PyAudioFeatures::shape)
+		.def_property_readonly("rate", &PyAudioFeatures::rate)
+		.def_property_readonly("features", &PyAudioFeatures::features)
+		.def("read", &PyAudioFeatures::read, py::arg("out") = py::none())
+		.def("reset", &PyAudioFeatures::reset);
+
+	py::class_<PyRewindBuffer>(m, "RewindBuffer")
+		.def(py::init<size_t, unsigned>(), py::arg("frames"), py::arg("interval") = 16)
+		.def_property_readonly("frames", &PyRewindBuffer::frames)
+		.def_property_readonly("interval", &PyRewindBuffer::interval)
+		.def_property_readonly("available", &PyRewindBuffer::available);
+
+	py::class_<PySavedState>(m, "SavedState", py::buffer_protocol())
+		.def_buffer(&PySavedState::buffer)
+		.def("__len__", &PySavedState::size);
+
+	py::class_<PyStateArena>(m, "StateArena")
+		.def(py::init<size_t>(), py::arg("slab_size"))
+		.def_property_readonly("slab_size", &PyStateArena::slabSize)
+		.def_property_readonly("used", &PyStateArena::used)
+		.def_property_readonly("capacity", &PyStateArena::capacity)
+		.def("save", [](PyStateArena& arena, PyRetroEmulator& emulator) {
+			return arena.save(emulator.m_re);
+		}, py::arg("emulator"));
+
+	py::class_<PyDeltaState>(m, "DeltaState")
+		.def(py::init([](PyRetroEmulator& emulator, py::object parent) {
+			return emulator.saveDelta(parent);
+		}), py::arg("emulator"), py::arg("parent") = py::none())
+		.def("__len__", &PyDeltaState::size)
+		.def_property_readonly("encoded_size", &PyDeltaState::encodedSize)
+		.def_property_readonly("depth", &PyDeltaState::depth)
+		.def_property_readonly("parent", &PyDeltaState::parent)
+		.def("restore", &PyDeltaState::restore, py::arg("out") = py::none());
+
+	py::class_<PyCachedState>(m, "CachedState", py::buffer_protocol())
+		.def_buffer(&PyCachedState::buffer)
+		.def("__len__", &PyCachedState::size);
+
 	py::class_<PyRetroEmulator>(m, "RetroEmulator")
 		.def(py::init<const string&>())
 		.def("step", &PyRetroEmulator::step)
 		.def("set_button_mask", &PyRetroEmulator::setButtonMask, py::arg("mask"), py::arg("player") = 0)
 		.def("get_state", &PyRetroEmulator::getState)
+		.def("get_state", &PyRetroEmulator::getStateInto, py::arg("out"))
+		.def("set_state", &PyRetroEmulator::setDeltaState)
 		.def("set_state", &PyRetroEmulator::setState)
-		.def("get_screen", &PyRetroEmulator::getScreen)
+		.def("get_state_size", &PyRetroEmulator::getStateSize)
+		.def("get_screen", &PyRetroEmulator::getScreen, py::arg("grayscale") = false, py::arg("downsample") = 1, py::arg("interlace") = false, py::arg("size") = py::none(), py::arg("max_pool") = false, py::arg("crop") = py::none(), py::arg("out") = py::none(), py::arg("stack") = py::none(), py::arg("indexed") = false)
+		.def("get_palette", &PyRetroEmulator::getPalette)
 		.def("get_screen_rate", &PyRetroEmulator::getScreenRate)
+		.def_property("video_enabled", &PyRetroEmulator::getVideoEnabled, &PyRetroEmulator::setVideoEnabled)
+		.def_property("max_pool", &PyRetroEmulator::getMaxPool, &PyRetroEmulator::setMaxPool)
+		.def_property("audio_enabled", &PyRetroEmulator::getAudioEnabled, &PyRetroEmulator::setAudioEnabled)
+		.def_property("audio_features", &PyRetroEmulator::getAudioFeatures, &PyRetroEmulator::setAudioFeatures)
+		.def_property("rewind_buffer", &PyRetroEmulator::getRewind, &PyRetroEmulator::setRewind)
+		.def("rewind", &PyRetroEmulator::rewind, py::arg("frames"))
 		.def("get_audio", &PyRetroEmulator::getAudio)
+		.def("get_audio", &PyRetroEmulator::getAudioInto, py::arg("out"))
 		.def("get_audio_rate", &PyRetroEmulator::getAudioRate)
 		.def("get_resolution", &PyRetroEmulator::getResolution)
 		.def("configure_data", &PyRetroEmulator::configureData)
+		.def("step_frames", &PyRetroEmulator::stepFrames, py::arg("data"), py::arg("frames") = 1)
+		.def("step_action", &PyRetroEmulator::stepAction, py::arg("data"), py::arg("action"), py::arg("action_type"), py::arg("players") = 1, py::arg("frames") = 1, py::arg("obs_type") = 0, py::arg("grayscale") = false, py::arg("downsample") = 1, py::arg("interlace") = false, py::arg("size") = py::none(), py::arg("max_pool") = false, py::arg("stack") = py::none(), py::arg("out") = py::none())
 		.def("add_cheat", &PyRetroEmulator::addCheat)
 		.def("clear_cheats", &PyRetroEmulator::clearCheats)
 		.def_static("load_core_info", &PyRetroEmulator::loadCoreInfo);
 
+	py::class_<PyVecRetroEmulator>(m, "VecRetroEmulator")
+		.def(py::init<const string&, size_t, size_t>(), py::arg("rom_path"), py::arg("num_envs"), py::arg("num_threads") = 0)
+		.def_property_readonly("num_envs", &PyVecRetroEmulator::numEnvs)
+		.def("step", &PyVecRetroEmulator::step, py::arg("masks"), py::arg("out") = py::none())
+		.def("get_screens", &PyVecRetroEmulator::getScreens, py::arg("out") = py::none())
+		.def("get_resolution", &PyVecRetroEmulator::getResolution)
+		.def("get_state", &PyVecRetroEmulator::getState, py::arg("index"))
+		.def("set_state", &PyVecRetroEmulator::setState, py::arg("index"), py::arg("state"))
+		.def("configure_data", &PyVecRetroEmulator::configureData, py::arg("index"), py::arg("data"));
+
 	py::class_<PyMemoryView>(m, "Memory")
 		.def(py::init<Retro::AddressSpace&>())
 		.def("extract", &PyMemoryView::extract, py::arg("address"), py::arg("type"))
 		.def("assign", &PyMemoryView::assign, py::arg("address"), py::arg("type"), py::arg("value"))
 		.def_property_readonly("blocks", &PyMemoryView::blocks)
+		.def_property_readonly("packed_size", &PyMemoryView::packedSize)
+		.def("pack", &PyMemoryView::pack, py::arg("out") = py::none())
 		.def("__setitem__", &PyMemoryView::setitem, py::arg("item"), py::arg("value"))
 		.def("__getitem__", &PyMemoryView::getitem, py::arg("item"));
 
@@ -499,11 +1639,13 @@ PYBIND11_MODULE(_retro, m) {
 		.def("save", &PyGameData::save, py::arg("data") = py::none(), py::arg("scen") = py::none())
 		.def("reset", &PyGameData::reset)
 		.def("filter_action", &PyGameData::filterAction)
+		.def("decode_action", &PyGameData::decodeAction, py::arg("action"), py::arg("action_type"), py::arg("players"), py::arg("buttons"))
 		.def("valid_actions", &PyGameData::validActions)
 		.def("update_ram", &PyGameData::updateRam)
 		.def("lookup_value", &PyGameData::lookupValue)
 		.def("set_value", &PyGameData::setValue)
 		.def("lookup_all", &PyGameData::lookupAll)
+		.def("compile_variables", &PyGameData::compileVariables, py::arg("names"), py::keep_alive<0, 1>())
 		.def("get_variable", &PyGameData::getVariable)
 		.def("set_variable", &PyGameData::setVariable)
 		.def("remove_variable", &PyGameData::removeVariable)
@@ -517,7 +1659,13 @@ PYBIND11_MODULE(_retro, m) {
 		.def("total_reward", &PyGameData::totalReward, py::arg("player") = 0)
 		.def("is_done", &PyGameData::isDone)
 		.def("crop_info", &PyGameData::cropInfo, py::arg("player") = 0)
-		.def_property_readonly("memory", &PyGameData::memory);
+		.def_property("render_every_frame", &PyGameData::getRenderEveryFrame, &PyGameData::setRenderEveryFrame)
+		.def_property_readonly("memory", py::cpp_function(&PyGameData::memory, py::keep_alive<0, 1>()));
+
+	py::class_<PyVariableVector>(m, "VariableVector")
+		.def_property_readonly("names", &PyVariableVector::names)
+		.def("__len__", &PyVariableVector::size)
+		.def("read", &PyVariableVector::read, py::arg("out") = py::none());
 
 	py::class_<PyMovie>(m, "Movie")
 		.def(py::init<py::str, bool, unsigned>(), py::arg("path"), py::arg("record") = false, py::arg("players") = 1)
@@ -533,4 +1681,5 @@ PYBIND11_MODULE(_retro, m) {
 
 	m.def("core_path", &::corePath, py::arg("hint") = py::none());
 	m.def("data_path", &::dataPath, py::arg("hint") = py::none());
+	m.def("cached_state", &::cachedState, py::arg("path"));
 }
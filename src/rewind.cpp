@@ -0,0 +1,110 @@
+#include "rewind.h"
+
+#include <stdexcept>
+
+using namespace Retro;
+using namespace std;
+
+// Keyframes after this many deltas start a new chain, so that restoring stays
+// quick and a chain is freed once its last keyframe leaves the ring
+static const size_t MAX_DEPTH = 16;
+
+RewindBuffer::RewindBuffer(size_t frames, unsigned interval)
+	: m_frames(frames)
+	, m_interval(interval)
+	, m_inputs(frames) {
+	if (!interval || interval > frames) {
+		throw invalid_argument("The interval must be between 1 and the number of frames");
+	}
+}
+
+size_t RewindBuffer::available() const {
+	// The oldest keyframe itself can't be gone back to, since at least one
+	// frame has to be run to draw the screen
+	if (m_keyframes.empty() || m_frame == m_keyframes.front().frame) {
+		return 0;
+	}
+	return m_frame - m_keyframes.front().frame - 1;
+}
+
+void RewindBuffer::restart(Emulator& emulator) {
+	m_frame = 0;
+	m_keyframes.clear();
+	saveKeyframe(emulator);
+}
+
+void RewindBuffer::push(Emulator& emulator) {
+	if (m_replaying || m_keyframes.empty()) {
+		return;
+	}
+	++m_frame;
+	auto& input = m_inputs[m_frame % m_frames];
+	for (int player = 0; player < MAX_PLAYERS; ++player) {
+		input[player] = 0;
+		for (int key = 0; key < N_BUTTONS; ++key) {
+			input[player] |= emulator.getKey(player, key) << key;
+		}
+	}
+	if (m_frame % m_interval == 0) {
+		saveKeyframe(emulator);
+	}
+	// The buttons of the frames after the oldest keyframe must still be known
+	while (m_keyframes.front().frame + m_frames < m_frame) {
+		m_keyframes.pop_front();
+	}
+}
+
+void RewindBuffer::rewind(Emulator& emulator, size_t n) {
+	if (!n) {
+		return;
+	}
+	if (n > available()) {
+		throw invalid_argument("Can't rewind further than the oldest recorded frame");
+	}
+	uint64_t target = m_frame - n;
+	while (!m_keyframes.empty() && m_keyframes.back().frame >= target) {
+		m_keyframes.pop_back();
+	}
+	const Keyframe& keyframe = m_keyframes.back();
+	m_buffer.resize(keyframe.state->size());
+	keyframe.state->restore(m_buffer.data());
+
+	m_replaying = true;
+	if (!emulator.unserialize(m_buffer.data(), m_buffer.size())) {
+		m_replaying = false;
+		throw runtime_error("Could not load the state");
+	}
+	m_buffer.swap(m_base);
+
+	bool video = emulator.getVideoEnabled();
+	bool audio = emulator.getAudioEnabled();
+	for (uint64_t frame = keyframe.frame + 1; frame <= target; ++frame) {
+		const auto& input = m_inputs[frame % m_frames];
+		for (int player = 0; player < MAX_PLAYERS; ++player) {
+			for (int key = 0; key < N_BUTTONS; ++key) {
+				emulator.setKey(player, key, input[player] & (1 << key));
+			}
+		}
+		emulator.setVideoEnabled(video && frame == target);
+		emulator.setAudioEnabled(audio && frame == target);
+		emulator.run();
+	}
+	emulator.setVideoEnabled(video);
+	emulator.setAudioEnabled(audio);
+	m_replaying = false;
+	m_frame = target;
+}
+
+void RewindBuffer::saveKeyframe(Emulator& emulator) {
+	size_t size = emulator.serializeSize();
+	m_buffer.resize(size);
+	if (!emulator.serialize(m_buffer.data(), size)) {
+		throw runtime_error("Could not save the state");
+	}
+	shared_ptr<const DeltaState> parent;
+	if (!m_keyframes.empty() && m_keyframes.back().state->depth() + 1 < MAX_DEPTH && m_base.size() == size) {
+		parent = m_keyframes.back().state;
+	}
+	m_keyframes.push_back({ m_frame, make_shared<const DeltaState>(m_buffer.data(), size, parent, parent ? m_base.data() : nullptr) });
+	m_buffer.swap(m_base);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "emulator.h"
+#include "savestate.h"
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace Retro {
+
+// Records the last frames an emulator ran so that it can go back to any of
+// them: a state every `interval` frames, delta-compressed against the one
+// before it, and the buttons held for every frame in between, in a ring of
+// `frames` frames. Rewinding loads the nearest state strictly before the
+// frame and runs the rest of the way with video and audio off until the last
+// frame, so the screen always shows the frame gone back to.
+class RewindBuffer {
+public:
+	RewindBuffer(size_t frames, unsigned interval = 16);
+	RewindBuffer(const RewindBuffer&) = delete;
+
+	size_t frames() const { return m_frames; }
+	unsigned interval() const { return m_interval; }
+	// How many frames back the emulator can be rewound right now
+	size_t available() const;
+	// True while a rewind is running frames, which aren't recorded
+	bool replaying() const { return m_replaying; }
+
+	// Forgets every frame and starts again from the emulator's current state
+	void restart(Emulator&);
+	// Called by the emulator after each frame it runs
+	void push(Emulator&);
+	// Goes back n frames, forgetting the frames after it. Going back no frames
+	// leaves the emulator as it is.
+	void rewind(Emulator&, size_t n);
+
+private:
+	struct Keyframe {
+		uint64_t frame;
+		std::shared_ptr<const DeltaState> state;
+	};
+
+	void saveKeyframe(Emulator&);
+
+	size_t m_frames;
+	unsigned m_interval;
+	uint64_t m_frame = 0;
+	bool m_replaying = false;
+
+	std::vector<std::array<uint16_t, MAX_PLAYERS>> m_inputs;
+	std::deque<Keyframe> m_keyframes;
+	// The state being saved or loaded, and the last keyframe's state, which
+	// the next keyframe is compared against
+	std::vector<uint8_t> m_buffer;
+	std::vector<uint8_t> m_base;
+};
+}
@@ -0,0 +1,267 @@
+#include "savestate.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <sys/stat.h>
+#include <zlib.h>
+
+using namespace Retro;
+using namespace std;
+
+StateArena::StateArena(size_t slabSize, size_t slabsPerChunk)
+	: m_slabSize(slabSize)
+	, m_slabsPerChunk(slabsPerChunk) {
+	if (!slabSize || !slabsPerChunk) {
+		throw invalid_argument("State slabs must not be empty");
+	}
+}
+
+uint8_t* StateArena::acquire() {
+	if (m_free.empty()) {
+		m_chunks.emplace_back(new uint8_t[m_slabSize * m_slabsPerChunk]);
+		uint8_t* chunk = m_chunks.back().get();
+		m_free.reserve(capacity());
+		// Hand out the start of the chunk first
+		for (size_t i = m_slabsPerChunk; i--;) {
+			m_free.push_back(&chunk[i * m_slabSize]);
+		}
+	}
+	uint8_t* slab = m_free.back();
+	m_free.pop_back();
+	++m_used;
+	return slab;
+}
+
+void StateArena::release(uint8_t* slab) {
+	if (!slab) {
+		return;
+	}
+	m_free.push_back(slab);
+	--m_used;
+}
+
+// Matching runs shorter than this are cheaper to store as part of the changed
+// bytes around them than as a run of their own
+static const size_t MIN_MATCH = 8;
+
+static size_t matchLength(const uint8_t* state, const uint8_t* base, size_t max) {
+	size_t length = 0;
+	if (base) {
+		for (; length + sizeof(uint64_t) <= max; length += sizeof(uint64_t)) {
+			uint64_t a;
+			uint64_t b;
+			memcpy(&a, &state[length], sizeof(a));
+			memcpy(&b, &base[length], sizeof(b));
+			if (a != b) {
+				break;
+			}
+		}
+		while (length < max && state[length] == base[length]) {
+			++length;
+		}
+	} else {
+		for (; length + sizeof(uint64_t) <= max; length += sizeof(uint64_t)) {
+			uint64_t a;
+			memcpy(&a, &state[length], sizeof(a));
+			if (a) {
+				break;
+			}
+		}
+		while (length < max && !state[length]) {
+			++length;
+		}
+	}
+	return length;
+}
+
+static void writeVarint(vector<uint8_t>& out, size_t value) {
+	while (value >= 0x80) {
+		out.push_back(value | 0x80);
+		value >>= 7;
+	}
+	out.push_back(value);
+}
+
+static size_t readVarint(const uint8_t*& in) {
+	size_t value = 0;
+	for (unsigned shift = 0;; shift += 7) {
+		uint8_t byte = *in++;
+		value |= static_cast<size_t>(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return value;
+		}
+	}
+}
+
+DeltaState::DeltaState(const void* state, size_t size, shared_ptr<const DeltaState> parent, const void* base)
+	: m_size(size)
+	, m_parent(move(parent)) {
+	vector<uint8_t> restored;
+	if (m_parent) {
+		if (m_parent->size() != size) {
+			throw invalid_argument("The state is not the same size as its parent");
+		}
+		m_depth = m_parent->depth() + 1;
+		if (!base) {
+			restored.resize(size);
+			m_parent->restore(restored.data());
+			base = restored.data();
+		}
+	} else {
+		base = nullptr;
+	}
+
+	// Runs of (matching bytes to skip, changed bytes to copy, the bytes)
+	const uint8_t* bytes = static_cast<const uint8_t*>(state);
+	const uint8_t* baseBytes = static_cast<const uint8_t*>(base);
+	size_t pos = 0;
+	while (pos < size) {
+		size_t skip = matchLength(&bytes[pos], baseBytes ? &baseBytes[pos] : nullptr, size - pos);
+		pos += skip;
+		if (pos == size) {
+			break;
+		}
+		size_t start = pos;
+		while (pos < size) {
+			size_t max = min(MIN_MATCH, size - pos);
+			size_t run = matchLength(&bytes[pos], baseBytes ? &baseBytes[pos] : nullptr, max);
+			if (run == max) {
+				break;
+			}
+			pos += run + 1;
+		}
+		writeVarint(m_delta, skip);
+		writeVarint(m_delta, pos - start);
+		m_delta.insert(m_delta.end(), &bytes[start], &bytes[pos]);
+	}
+	m_delta.shrink_to_fit();
+}
+
+DeltaState::~DeltaState() {
+	// Free long chains one state at a time instead of recursively
+	shared_ptr<const DeltaState> parent = move(m_parent);
+	while (parent && parent.use_count() == 1) {
+		shared_ptr<const DeltaState> next = move(parent->m_parent);
+		parent = move(next);
+	}
+}
+
+void DeltaState::restore(void* out) const {
+	vector<const DeltaState*> chain;
+	chain.reserve(m_depth + 1);
+	for (const DeltaState* state = this; state; state = state->m_parent.get()) {
+		chain.push_back(state);
+	}
+	uint8_t* bytes = static_cast<uint8_t*>(out);
+	for (auto state = chain.rbegin(); state != chain.rend(); ++state) {
+		(*state)->patch(bytes);
+	}
+}
+
+void DeltaState::patch(uint8_t* out) const {
+	const uint8_t* in = m_delta.data();
+	const uint8_t* end = in + m_delta.size();
+	size_t pos = 0;
+	while (in < end) {
+		size_t skip = readVarint(in);
+		size_t length = readVarint(in);
+		if (!m_parent) {
+			memset(&out[pos], 0, skip);
+		}
+		pos += skip;
+		memcpy(&out[pos], in, length);
+		in += length;
+		pos += length;
+	}
+	if (!m_parent) {
+		memset(&out[pos], 0, m_size - pos);
+	}
+}
+
+// Savestates are a few megabytes at most, so a larger size in a file's
+// trailer is not worth trusting up front
+static const size_t MAX_STATE_RESERVE = 64 * 1024 * 1024;
+
+struct CachedStateFile {
+	int64_t mtime;
+	int64_t size;
+	weak_ptr<const vector<uint8_t>> state;
+};
+
+static mutex s_stateFileMutex;
+static unordered_map<string, CachedStateFile> s_stateFiles;
+
+static shared_ptr<const vector<uint8_t>> inflateState(const string& compressed, const string& path) {
+	auto state = make_shared<vector<uint8_t>>();
+	// gzip ends with the size of the uncompressed data, modulo 2^32
+	if (compressed.size() >= 4) {
+		const uint8_t* tail = reinterpret_cast<const uint8_t*>(&compressed[compressed.size() - 4]);
+		size_t size = tail[0] | tail[1] << 8 | tail[2] << 16 | static_cast<uint32_t>(tail[3]) << 24;
+		state->reserve(min(size, MAX_STATE_RESERVE));
+	}
+
+	z_stream zs{};
+	// Accept both gzip and zlib headers
+	if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+		throw runtime_error("Could not decompress " + path);
+	}
+	zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+	zs.avail_in = compressed.size();
+	int err = Z_OK;
+	while (err == Z_OK) {
+		if (state->size() == state->capacity()) {
+			state->reserve(max<size_t>(state->capacity() * 2, 4096));
+		}
+		size_t size = state->size();
+		state->resize(state->capacity());
+		zs.next_out = &(*state)[size];
+		zs.avail_out = state->size() - size;
+		err = inflate(&zs, Z_NO_FLUSH);
+		state->resize(state->size() - zs.avail_out);
+	}
+	inflateEnd(&zs);
+	if (err != Z_STREAM_END) {
+		throw runtime_error("Could not decompress " + path);
+	}
+	state->shrink_to_fit();
+	return state;
+}
+
+shared_ptr<const vector<uint8_t>> Retro::loadStateFile(const string& path) {
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0) {
+		throw runtime_error("Could not open " + path);
+	}
+
+	lock_guard<mutex> lock(s_stateFileMutex);
+	auto cached = s_stateFiles.find(path);
+	if (cached != s_stateFiles.end() && cached->second.mtime == info.st_mtime && cached->second.size == info.st_size) {
+		auto state = cached->second.state.lock();
+		if (state) {
+			return state;
+		}
+	}
+
+	ifstream file(path, ios::binary);
+	if (!file) {
+		throw runtime_error("Could not open " + path);
+	}
+	string compressed{ istreambuf_iterator<char>(file), istreambuf_iterator<char>() };
+	auto state = inflateState(compressed, path);
+	s_stateFiles[path] = CachedStateFile{ static_cast<int64_t>(info.st_mtime), static_cast<int64_t>(info.st_size), state };
+	// Forget the files nobody is using any more
+	for (auto iter = s_stateFiles.begin(); iter != s_stateFiles.end();) {
+		if (iter->second.state.expired()) {
+			iter = s_stateFiles.erase(iter);
+		} else {
+			++iter;
+		}
+	}
+	return state;
+}
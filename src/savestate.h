@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Retro {
+
+// Buffers for savestates of one game, which all have the same size. Slabs are
+// allocated a chunk at a time and reused once released, so saving and
+// restoring states doesn't touch the heap once the arena has grown to the
+// number of states kept alive. It isn't thread-safe.
+class StateArena {
+public:
+	StateArena(size_t slabSize, size_t slabsPerChunk = 16);
+	StateArena(const StateArena&) = delete;
+
+	size_t slabSize() const { return m_slabSize; }
+	// Slabs handed out and not released yet
+	size_t used() const { return m_used; }
+	// Slabs allocated so far
+	size_t capacity() const { return m_chunks.size() * m_slabsPerChunk; }
+
+	uint8_t* acquire();
+	void release(uint8_t* slab);
+
+private:
+	size_t m_slabSize;
+	size_t m_slabsPerChunk;
+	size_t m_used = 0;
+	std::vector<std::unique_ptr<uint8_t[]>> m_chunks;
+	std::vector<uint8_t*> m_free;
+};
+
+// A savestate stored as the runs of bytes that differ from its parent state,
+// or from zeros if it is a keyframe without a parent. Neighboring frames
+// change little of a large state, so a chain of deltas takes a fraction of
+// the memory of full copies. Restoring applies the chain from its keyframe.
+class DeltaState {
+public:
+	// base may hold the parent's state if it has already been restored, which
+	// saves restoring it again to compare against
+	DeltaState(const void* state, size_t size, std::shared_ptr<const DeltaState> parent = nullptr, const void* base = nullptr);
+	DeltaState(const DeltaState&) = delete;
+	~DeltaState();
+
+	size_t size() const { return m_size; }
+	// Bytes stored for this state, not counting its parents
+	size_t encodedSize() const { return m_delta.size(); }
+	// Number of parents up to the keyframe
+	size_t depth() const { return m_depth; }
+	const std::shared_ptr<const DeltaState>& parent() const { return m_parent; }
+
+	// out must hold size() bytes
+	void restore(void* out) const;
+
+private:
+	void patch(uint8_t* out) const;
+
+	size_t m_size;
+	size_t m_depth = 0;
+	// Mutable so that the destructor can unlink a chain it is the last owner of
+	mutable std::shared_ptr<const DeltaState> m_parent;
+	std::vector<uint8_t> m_delta;
+};
+
+// Reads a gzipped .state file. Emulators starting from the same file share
+// one read-only decompressed copy for as long as any of them holds it. The
+// file is read again if its size or modification time changed.
+std::shared_ptr<const std::vector<uint8_t>> loadStateFile(const std::string& path);
+}
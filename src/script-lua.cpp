@@ -155,11 +155,63 @@ bool ScriptLua::init() {
 
 	vector<string> functions = listFunctions();
 	m_blacklist = { functions.begin(), functions.end() };
+
+	lua_newtable(m_L);
+	lua_pushnil(m_L);
+	while (lua_next(m_L, LUA_GLOBALSINDEX) != 0) {
+		lua_pushvalue(m_L, -2);
+		lua_insert(m_L, -2);
+		lua_rawset(m_L, -4);
+	}
+	m_globals = luaL_ref(m_L, LUA_REGISTRYINDEX);
 	return true;
 }
 
+void ScriptLua::restart() {
+	lua_rawgeti(m_L, LUA_REGISTRYINDEX, m_globals);
+	int globals = lua_gettop(m_L);
+
+	// Clear or reset every global, then add back any that were removed
+	lua_pushnil(m_L);
+	while (lua_next(m_L, LUA_GLOBALSINDEX) != 0) {
+		lua_pop(m_L, 1);
+		lua_pushvalue(m_L, -1);
+		lua_pushvalue(m_L, -1);
+		lua_rawget(m_L, globals);
+		lua_rawset(m_L, LUA_GLOBALSINDEX);
+	}
+	lua_pushnil(m_L);
+	while (lua_next(m_L, globals) != 0) {
+		lua_pushvalue(m_L, -2);
+		lua_insert(m_L, -2);
+		lua_rawset(m_L, LUA_GLOBALSINDEX);
+	}
+	lua_pop(m_L, 1);
+
+	if (data()) {
+		setData(data());
+	}
+	if (scenario()) {
+		setScenario(scenario());
+	}
+}
+
 bool ScriptLua::load(const string& filename) {
-	return luaL_dofile(m_L, filename.c_str()) == 0;
+	auto chunk = m_chunks.find(filename);
+	if (chunk == m_chunks.end()) {
+		if (luaL_loadfile(m_L, filename.c_str()) != 0) {
+			lua_pop(m_L, 1);
+			return false;
+		}
+		chunk = m_chunks.emplace(filename, luaL_ref(m_L, LUA_REGISTRYINDEX)).first;
+	}
+	// Running the chunk again also gives its functions fresh upvalues
+	lua_rawgeti(m_L, LUA_REGISTRYINDEX, chunk->second);
+	if (lua_pcall(m_L, 0, 0, 0) != 0) {
+		lua_pop(m_L, 1);
+		return false;
+	}
+	return true;
 }
 
 bool ScriptLua::loadString(const string& script) {
@@ -2,6 +2,7 @@
 
 #include "script.h"
 
+#include <unordered_map>
 #include <unordered_set>
 
 #include <lua.hpp>
@@ -17,6 +18,7 @@ public:
 	void setData(GameData*) override;
 	void setScenario(const Scenario*) override;
 	bool init() override;
+	void restart() override;
 	bool load(const std::string&) override;
 	bool loadString(const std::string&) override;
 	Variant callFunction(const std::string&) override;
@@ -25,5 +27,9 @@ public:
 private:
 	lua_State* m_L = nullptr;
 	std::unordered_set<std::string> m_blacklist;
+	// Registry references to a copy of the globals after init and to the
+	// compiled chunk of each file loaded
+	int m_globals = LUA_NOREF;
+	std::unordered_map<std::string, int> m_chunks;
 };
 }
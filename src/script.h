@@ -13,14 +13,18 @@ class GameData;
 class Scenario;
 class ScriptContext {
 public:
-	static std::shared_ptr<ScriptContext> get(const std::string& type);
-	static std::vector<std::string> listContexts();
-	static void reset();
+	// Makes a new, initialized context for scripts of the given type. Each
+	// Scenario owns the contexts its scripts run in.
+	static std::shared_ptr<ScriptContext> create(const std::string& type);
 
 	virtual void setData(GameData*);
 	virtual void setScenario(const Scenario*);
 
 	virtual bool init() = 0;
+	// Puts the globals back the way init left them, so that scripts can be
+	// loaded again for a new episode
+	virtual void restart() = 0;
+	// Files are only read and compiled the first time they're loaded
 	virtual bool load(const std::string&) = 0;
 	virtual bool loadString(const std::string&) = 0;
 	virtual Variant callFunction(const std::string&) = 0;
@@ -31,7 +35,7 @@ protected:
 	const Scenario* scenario();
 
 private:
-	GameData* m_data;
-	const Scenario* m_scen;
+	GameData* m_data = nullptr;
+	const Scenario* m_scen = nullptr;
 };
 }
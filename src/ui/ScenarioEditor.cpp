@@ -275,8 +275,11 @@ void ScenarioEditor::populateScriptLists() {
 	m_ui->doneFunc->clear();
 	m_ui->doneFunc->setEnabled(false);
 
-	for (const auto& contextName : Retro::ScriptContext::listContexts()) {
-		std::shared_ptr<Retro::ScriptContext> context = Retro::ScriptContext::get(contextName);
+	if (!m_scenario) {
+		return;
+	}
+	for (const auto& contextName : m_scenario->scriptContexts()) {
+		std::shared_ptr<Retro::ScriptContext> context = m_scenario->scriptContext(contextName);
 		const auto& funcs = context->listFunctions();
 		if (!funcs.empty()) {
 			m_ui->rewardFuncUse->setEnabled(true);
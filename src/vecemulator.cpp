@@ -0,0 +1,145 @@
+#include "vecemulator.h"
+
+#include "imageops.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+namespace Retro {
+
+VecEmulator::VecEmulator(size_t numThreads)
+	: m_numThreads(numThreads) {
+	if (!m_numThreads) {
+		m_numThreads = max(thread::hardware_concurrency(), 1u);
+	}
+}
+
+VecEmulator::~VecEmulator() {
+	{
+		lock_guard<mutex> lock(m_lock);
+		m_quit = true;
+	}
+	m_wake.notify_all();
+	for (auto& worker : m_workers) {
+		worker.join();
+	}
+}
+
+bool VecEmulator::loadRom(const string& romPath, size_t count) {
+	if (!m_emulators.empty() || !count) {
+		return false;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		m_emulators.emplace_back(new Emulator);
+		if (!m_emulators.back()->loadRom(romPath)) {
+			m_emulators.clear();
+			return false;
+		}
+	}
+
+	// The calling thread does its share of the work too
+	size_t numWorkers = min(m_numThreads, count) - 1;
+	for (size_t i = 0; i < numWorkers; ++i) {
+		m_workers.emplace_back(&VecEmulator::work, this);
+	}
+
+	parallel([this](size_t index) {
+		m_emulators[index]->run();
+	});
+	m_width = m_emulators[0]->getImageWidth();
+	m_height = m_emulators[0]->getImageHeight();
+	return true;
+}
+
+void VecEmulator::step(const uint8_t* masks, unsigned players, unsigned buttons, uint8_t* screens) {
+	if (players > MAX_PLAYERS) {
+		throw invalid_argument("players > MAX_PLAYERS");
+	}
+	if (buttons > N_BUTTONS) {
+		throw invalid_argument("buttons > N_BUTTONS");
+	}
+	parallel([&](size_t index) {
+		Emulator& emulator = *m_emulators[index];
+		const uint8_t* mask = &masks[index * players * buttons];
+		for (unsigned player = 0; player < players; ++player) {
+			for (unsigned key = 0; key < buttons; ++key) {
+				emulator.setKey(player, key, mask[player * buttons + key]);
+			}
+		}
+		emulator.run();
+		if (screens) {
+			getScreen(index, screens);
+		}
+	});
+}
+
+void VecEmulator::getScreens(uint8_t* screens) {
+	parallel([&](size_t index) {
+		getScreen(index, screens);
+	});
+}
+
+void VecEmulator::getScreen(size_t index, uint8_t* screens) {
+	Emulator& emulator = *m_emulators[index];
+	if (emulator.getImageWidth() != m_width || emulator.getImageHeight() != m_height) {
+		throw runtime_error("Screen dimensions changed");
+	}
+	Image out(Image::Format::RGB888, &screens[index * m_width * m_height * 3], m_width, m_height, m_width * 3);
+	Image in = screenImage(emulator.getImageData(), m_width, m_height, emulator.getImagePitch(), emulator.getImageDepth());
+	in.copyTo(&out);
+}
+
+void VecEmulator::parallel(const function<void(size_t)>& job) {
+	{
+		lock_guard<mutex> lock(m_lock);
+		m_job = &job;
+		m_next = 0;
+		m_error = nullptr;
+		m_busy = m_workers.size();
+		++m_generation;
+	}
+	m_wake.notify_all();
+	drain();
+
+	unique_lock<mutex> lock(m_lock);
+	m_done.wait(lock, [this]() { return !m_busy; });
+	m_job = nullptr;
+	if (m_error) {
+		rethrow_exception(m_error);
+	}
+}
+
+void VecEmulator::work() {
+	uint64_t generation = 0;
+	unique_lock<mutex> lock(m_lock);
+	while (true) {
+		m_wake.wait(lock, [&]() { return m_quit || m_generation != generation; });
+		if (m_quit) {
+			return;
+		}
+		generation = m_generation;
+		lock.unlock();
+		drain();
+		lock.lock();
+		if (!--m_busy) {
+			m_done.notify_one();
+		}
+	}
+}
+
+void VecEmulator::drain() {
+	size_t index;
+	while ((index = m_next++) < m_emulators.size()) {
+		try {
+			(*m_job)(index);
+		} catch (...) {
+			lock_guard<mutex> lock(m_lock);
+			if (!m_error) {
+				m_error = current_exception();
+			}
+		}
+	}
+}
+}
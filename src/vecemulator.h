@@ -0,0 +1,59 @@
+#pragma once
+
+#include "emulator.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Retro {
+
+class VecEmulator {
+public:
+	VecEmulator(size_t numThreads = 0);
+	~VecEmulator();
+	VecEmulator(const VecEmulator&) = delete;
+
+	bool loadRom(const std::string& romPath, size_t count);
+
+	size_t size() const { return m_emulators.size(); }
+	Emulator& operator[](size_t index) { return *m_emulators[index]; }
+
+	int getImageHeight() const { return m_height; }
+	int getImageWidth() const { return m_width; }
+
+	// masks is laid out as [size()][players][buttons]. If screens is non-null
+	// it receives every screen as RGB888 in one [size()][height][width][3] block.
+	void step(const uint8_t* masks, unsigned players, unsigned buttons, uint8_t* screens = nullptr);
+	void getScreens(uint8_t* screens);
+
+	void parallel(const std::function<void(size_t)>&);
+
+private:
+	void getScreen(size_t index, uint8_t* screen);
+	void work();
+	void drain();
+
+	std::vector<std::unique_ptr<Emulator>> m_emulators;
+	int m_width = 0;
+	int m_height = 0;
+
+	size_t m_numThreads;
+	std::vector<std::thread> m_workers;
+	std::mutex m_lock;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	const std::function<void(size_t)>* m_job = nullptr;
+	std::atomic<size_t> m_next{ 0 };
+	std::exception_ptr m_error;
+	uint64_t m_generation = 0;
+	size_t m_busy = 0;
+	bool m_quit = false;
+};
+}
@@ -0,0 +1,122 @@
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+#include "audioops.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using namespace ::testing;
+
+namespace Retro {
+
+static vector<int16_t> sine(double frequency, double rate, size_t frames) {
+	vector<int16_t> stereo;
+	for (size_t i = 0; i < frames; ++i) {
+		int16_t sample = lround(16000 * sin(2 * 3.14159265358979323846 * frequency * i / rate));
+		stereo.push_back(sample);
+		stereo.push_back(sample);
+	}
+	return stereo;
+}
+
+TEST(AudioFeatures, Samples) {
+	AudioFeatures features(AudioFeatures::Kind::SAMPLES, 100, 4);
+	EXPECT_EQ(features.columns(), 1);
+	EXPECT_THAT(vector<float>(features.features(), features.features() + 4), Each(0.f));
+
+	// Left and right are averaged
+	int16_t stereo[] = { 0, 8192, 8192, 8192, 16384, 16384, 16384, 32767, 0, 0, -16384, -16384 };
+	features.push(stereo, 6, 100);
+	EXPECT_THAT(vector<float>(features.features(), features.features() + 4), ElementsAre(0.5f, 0.75f - 0.5f / 32768, 0.f, -0.5f));
+	features.push(stereo, 1, 100);
+	EXPECT_THAT(vector<float>(features.features(), features.features() + 4), ElementsAre(0.75f - 0.5f / 32768, 0.f, -0.5f, 0.125f));
+
+	features.reset();
+	EXPECT_THAT(vector<float>(features.features(), features.features() + 4), Each(0.f));
+}
+
+TEST(AudioFeatures, Resample) {
+	AudioFeatures down(AudioFeatures::Kind::SAMPLES, 100, 8);
+	vector<int16_t> stereo;
+	for (int16_t i = 1; i <= 16; ++i) {
+		stereo.push_back(i * 1024);
+		stereo.push_back(i * 1024);
+	}
+	// Every output sample averages the three inputs it covers
+	down.push(stereo.data(), 16, 300);
+	const float* samples = down.features();
+	for (int i = 0; i < 5; ++i) {
+		EXPECT_FLOAT_EQ(samples[i + 3], (i * 3 + 2) / 32.f);
+	}
+	// The leftover sample is used by the next push
+	down.push(&stereo[32 - 4], 2, 300);
+	EXPECT_FLOAT_EQ(down.features()[7], (16 + 15 + 16) / 96.f);
+
+	AudioFeatures up(AudioFeatures::Kind::SAMPLES, 200, 4);
+	up.push(stereo.data(), 3, 100);
+	EXPECT_THAT(vector<float>(up.features(), up.features() + 4), ElementsAre(1 / 32.f, 1.5f / 32, 2 / 32.f, 2.5f / 32));
+}
+
+TEST(AudioFeatures, Stft) {
+	AudioFeatures features(AudioFeatures::Kind::STFT, 16000, 3, 256, 128);
+	EXPECT_EQ(features.columns(), 129);
+
+	// 2 kHz falls exactly on bin 32
+	vector<int16_t> stereo = sine(2000, 16000, 1024);
+	features.push(stereo.data(), stereo.size() / 2, 16000);
+	for (size_t row = 0; row < 3; ++row) {
+		const float* spectrum = &features.features()[row * 129];
+		EXPECT_EQ(max_element(spectrum, spectrum + 129) - spectrum, 32);
+		// A Hann window spreads a full-scale sine of amplitude a to a * n / 4
+		EXPECT_NEAR(spectrum[32], 16000 / 32768. * 256 / 4, 0.5);
+		EXPECT_LT(spectrum[40], spectrum[32] / 1000);
+	}
+}
+
+TEST(AudioFeatures, Chunks) {
+	// Pushing a frame's worth at a time gives the same rows as pushing it all
+	// at once, however the input and spectrogram frames wrap around
+	vector<int16_t> stereo = sine(1234, 44100, 8192);
+	AudioFeatures whole(AudioFeatures::Kind::STFT, 16000, 8, 256, 96);
+	whole.push(stereo.data(), stereo.size() / 2, 44100);
+	AudioFeatures chunks(AudioFeatures::Kind::STFT, 16000, 8, 256, 96);
+	for (size_t i = 0; i < stereo.size() / 2; i += 735) {
+		chunks.push(&stereo[i * 2], min<size_t>(735, stereo.size() / 2 - i), 44100);
+	}
+	size_t size = whole.rows() * whole.columns();
+	for (size_t i = 0; i < size; ++i) {
+		EXPECT_NEAR(chunks.features()[i], whole.features()[i], 1e-3) << i;
+	}
+}
+
+TEST(AudioFeatures, Mel) {
+	AudioFeatures low(AudioFeatures::Kind::MEL, 16000, 1, 512, 0, 40);
+	AudioFeatures high(AudioFeatures::Kind::MEL, 16000, 1, 512, 0, 40);
+	EXPECT_EQ(low.columns(), 40);
+
+	vector<int16_t> stereo = sine(300, 16000, 512);
+	low.push(stereo.data(), 512, 16000);
+	stereo = sine(5000, 16000, 512);
+	high.push(stereo.data(), 512, 16000);
+	const float* lowBands = low.features();
+	const float* highBands = high.features();
+	EXPECT_TRUE(all_of(lowBands, lowBands + 40, [](float band) { return isfinite(band); }));
+	EXPECT_LT(max_element(lowBands, lowBands + 40) - lowBands, max_element(highBands, highBands + 40) - highBands);
+	EXPECT_GT(lowBands[5], highBands[5]);
+	EXPECT_LT(lowBands[33], highBands[33]);
+}
+
+TEST(AudioFeatures, Invalid) {
+	EXPECT_THROW(AudioFeatures(AudioFeatures::Kind::SAMPLES, 0, 4), invalid_argument);
+	EXPECT_THROW(AudioFeatures(AudioFeatures::Kind::SAMPLES, 16000, 0), invalid_argument);
+	EXPECT_THROW(AudioFeatures(AudioFeatures::Kind::STFT, 16000, 4, 300), invalid_argument);
+	EXPECT_THROW(AudioFeatures(AudioFeatures::Kind::STFT, 16000, 4, 256, 512), invalid_argument);
+	EXPECT_THROW(AudioFeatures(AudioFeatures::Kind::MEL, 16000, 4, 256, 0, 0), invalid_argument);
+	EXPECT_THROW(AudioFeatures(AudioFeatures::Kind::MEL, 16000, 4, 256, 0, 200), invalid_argument);
+}
+
+}
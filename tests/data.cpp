@@ -123,6 +123,54 @@ TEST(GameData, Delta) {
 	EXPECT_EQI(data.lookupDelta("foo"), 1);
 }
 
+TEST(GameData, VariableVector) {
+	GameData data;
+	uint8_t ram[] = { 1, 2, 0x83 };
+	uint8_t high[] = { 4 };
+	data.addressSpace().addBlock(0, sizeof(ram), ram);
+	data.addressSpace().addBlock(0x10, sizeof(high), high);
+	data.updateRam();
+	data.setVariable("foo", {">n2", 0});
+	data.setVariable("bar", {"|i1", 2});
+	data.setVariable("baz", {"|u1", 0x10});
+	data.setVariable("masked", Variable{"|u1", 2, 0x0F});
+	data.setValue("custom", 7);
+
+	VariableVector vars(data, { "baz", "foo", "custom", "bar", "masked" });
+	EXPECT_EQ(vars.size(), 5);
+	int64_t values[5];
+	vars.read(values);
+	EXPECT_THAT(values, ElementsAre(4, 12, 7, -125, 3));
+
+	ram[1] = 5;
+	high[0] = 6;
+	data.setValue("custom", 8);
+	float floats[5];
+	vars.read(floats);
+	EXPECT_THAT(floats, ElementsAre(6.f, 15.f, 8.f, -125.f, 3.f));
+
+	// Custom values are found again after a restart clears them
+	data.restart();
+	EXPECT_THROW(vars.read(values), invalid_argument);
+	data.setValue("custom", 9);
+	vars.read(values);
+	EXPECT_THAT(values, ElementsAre(6, 15, 9, -125, 3));
+
+	// Changing the variables makes the vector stale
+	data.setVariable("second", {"|u1", 1});
+	EXPECT_THROW(vars.read(values), runtime_error);
+	VariableVector compiled(data, { "baz", "second" });
+	compiled.read(values);
+	EXPECT_EQ(values[0], 6);
+	EXPECT_EQ(values[1], 5);
+	data.invalidate();
+	EXPECT_THROW(compiled.read(values), runtime_error);
+
+	EXPECT_THROW(VariableVector(data, { "foo", "qux" }), invalid_argument);
+	data.setVariable("outside", {"|u1", 0x8});
+	EXPECT_THROW(VariableVector(data, { "outside" }), out_of_range);
+}
+
 TEST(Scenario, Measurement) {
 	EXPECT_EQ(Scenario::measurement("", M::ABSOLUTE), M::ABSOLUTE);
 	EXPECT_EQ(Scenario::measurement("", M::DELTA), M::DELTA);
@@ -822,4 +870,59 @@ TEST(Scenario, LoadReward2P) {
 	EXPECT_FLOAT_EQ(scen.currentReward(1), 1);
 }
 
+TEST(Scenario, LoadCrops) {
+	GameData data;
+	Scenario scen(data);
+
+	istringstream manifest(R"({
+		"crops": [[1, 2, 3, 4], [5, 6, 7, 8]]
+	})");
+	EXPECT_TRUE(scen.load(&manifest));
+
+	size_t x, y, width, height;
+	scen.getCrop(&x, &y, &width, &height, 0);
+	EXPECT_EQ(x, 1);
+	EXPECT_EQ(height, 4);
+	scen.getCrop(&x, &y, &width, &height, 1);
+	EXPECT_EQ(x, 5);
+	EXPECT_EQ(y, 6);
+	EXPECT_EQ(width, 7);
+	EXPECT_EQ(height, 8);
+}
+
+TEST(Scenario, DecodeAction) {
+	GameData data;
+	Scenario scen(data);
+	data.setButtons({ "B", "A", "LEFT", "RIGHT" });
+	data.setActions({ { {}, { "LEFT" }, { "RIGHT" } }, { {}, { "B" }, { "A" }, { "A", "B" } } });
+
+	using T = Scenario::ActionType;
+	unsigned masks[MAX_PLAYERS];
+	int64_t all[] = { 1, 0, 1, 1, 0, 1, 0, 0 };
+	scen.decodeAction(T::ALL, all, 8, 2, 4, masks);
+	EXPECT_EQ(masks[0], 0b1101);
+	EXPECT_EQ(masks[1], 0b0010);
+
+	scen.decodeAction(T::FILTERED, all, 8, 2, 4, masks);
+	EXPECT_EQ(masks[0], 0b0001);
+	EXPECT_EQ(masks[1], 0b0010);
+
+	// Sets are consumed in mask order: { B, A } before { LEFT, RIGHT }
+	int64_t discrete[] = { 3 + 4 * 2 + 12 * 1 };
+	scen.decodeAction(T::DISCRETE, discrete, 1, 2, 4, masks);
+	EXPECT_EQ(masks[0], 0b1011);
+	EXPECT_EQ(masks[1], 0b0001);
+
+	int64_t multi[] = { 2, 1, 0, 2 };
+	scen.decodeAction(T::MULTI_DISCRETE, multi, 4, 2, 4, masks);
+	EXPECT_EQ(masks[0], 0b0110);
+	EXPECT_EQ(masks[1], 0b1000);
+
+	int64_t negative[] = { -1 };
+	EXPECT_THROW(scen.decodeAction(T::DISCRETE, negative, 1, 1, 4, masks), invalid_argument);
+	EXPECT_THROW(scen.decodeAction(T::MULTI_DISCRETE, multi, 3, 2, 4, masks), invalid_argument);
+	EXPECT_THROW(scen.decodeAction(T::MULTI_DISCRETE, discrete, 1, 1, 4, masks), invalid_argument);
+	EXPECT_THROW(scen.decodeAction(T::ALL, all, 8, MAX_PLAYERS + 1, 4, masks), invalid_argument);
+}
+
 }
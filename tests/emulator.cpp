@@ -2,7 +2,10 @@
 #include "gmock/gmock.h"
 
 #include "coreinfo.h"
+#include "data.h"
 #include "emulator.h"
+#include "rewind.h"
+#include "vecemulator.h"
 
 #include <sstream>
 #include <fstream>
@@ -111,6 +114,33 @@ TEST_P(EmulatorTest, Output) {
 	EXPECT_THAT(e.getAudioData(), NotNull());
 }
 
+TEST_P(EmulatorTest, Indexed) {
+	const auto& param = GetParam();
+	Emulator e;
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	for (int i = 0; i < 60; ++i) {
+		e.run();
+	}
+
+	size_t pitch = 0;
+	const void* palette;
+	const uint8_t* indices = e.getIndexedData(&pitch, &palette);
+	if (!indices) {
+		EXPECT_THAT(palette, IsNull());
+		return;
+	}
+	ASSERT_THAT(palette, NotNull());
+	ASSERT_EQ(e.getImageDepth(), 16);
+	const uint16_t* colors = static_cast<const uint16_t*>(palette);
+	const uint8_t* image = static_cast<const uint8_t*>(e.getImageData());
+	for (int y = 0; y < e.getImageHeight(); ++y) {
+		const uint16_t* row = reinterpret_cast<const uint16_t*>(&image[y * e.getImagePitch()]);
+		for (int x = 0; x < e.getImageWidth(); ++x) {
+			ASSERT_EQ(colors[indices[y * pitch + x]], row[x]);
+		}
+	}
+}
+
 TEST_P(EmulatorTest, States) {
 	const auto& param = GetParam();
 	Emulator e;
@@ -129,6 +159,273 @@ TEST_P(EmulatorTest, States) {
 	e.run();
 }
 
+TEST_P(EmulatorTest, Replay) {
+	const auto& param = GetParam();
+	// PicoDrive rounds off some sound chip and CPU timing state when saving
+	if (param.system == "32x") {
+		return;
+	}
+	Emulator e;
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	for (int i = 0; i < 10; ++i) {
+		e.run();
+	}
+
+	// Running from a loaded state gives the same frames every time, however
+	// far the emulator got before loading it
+	vector<uint8_t> state(e.serializeSize());
+	ASSERT_TRUE(e.serialize(state.data(), state.size()));
+	auto play = [&e]() {
+		vector<uint8_t> frames;
+		for (int i = 0; i < 10; ++i) {
+			e.run();
+			const uint8_t* image = static_cast<const uint8_t*>(e.getImageData());
+			frames.insert(frames.end(), image, image + e.getImagePitch() * e.getImageHeight());
+		}
+		return frames;
+	};
+	vector<uint8_t> first = play();
+	play();
+	ASSERT_TRUE(e.unserialize(state.data(), state.size()));
+	EXPECT_EQ(first, play());
+	e.reset();
+	play();
+	ASSERT_TRUE(e.unserialize(state.data(), state.size()));
+	EXPECT_EQ(first, play());
+}
+
+TEST_P(EmulatorTest, Rewind) {
+	const auto& param = GetParam();
+	Emulator e;
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	GameData data;
+	e.configureData(&data);
+	// The RAM and the screen
+	auto frame = [&e, &data]() {
+		vector<uint8_t> bytes;
+		for (const auto& block : data.addressSpace().blocks()) {
+			const uint8_t* start = static_cast<const uint8_t*>(block.second.offset(0));
+			bytes.insert(bytes.end(), start, start + block.second.size());
+		}
+		const uint8_t* image = static_cast<const uint8_t*>(e.getImageData());
+		bytes.insert(bytes.end(), image, image + e.getImagePitch() * e.getImageHeight());
+		return bytes;
+	};
+	auto press = [&e](int frame) {
+		for (int key = 0; key < N_BUTTONS; ++key) {
+			e.setKey(0, key, (frame * 7 + key) % 5 == 0);
+		}
+	};
+	// PicoDrive rounds off some sound chip and CPU timing state when saving,
+	// so frames run again after loading a state can come out differently
+	bool exact = param.system != "32x";
+
+	RewindBuffer rewind(20, 4);
+	e.setRewind(&rewind);
+	EXPECT_EQ(rewind.available(), 0);
+	rewind.rewind(e, 0);
+	EXPECT_THROW(rewind.rewind(e, 1), invalid_argument);
+	vector<vector<uint8_t>> frames{ frame() };
+	for (int i = 1; i <= 30; ++i) {
+		press(i);
+		e.run();
+		frames.push_back(frame());
+	}
+	// Keyframes before frame 10 no longer have all of their buttons, and the
+	// frame of the oldest one left can't be drawn again
+	EXPECT_EQ(rewind.available(), 17);
+	EXPECT_THROW(rewind.rewind(e, 18), invalid_argument);
+
+	rewind.rewind(e, 5);
+	EXPECT_EQ(rewind.available(), 12);
+	if (exact) {
+		EXPECT_EQ(frame(), frames[25]);
+	}
+	for (int i = 26; i <= 30; ++i) {
+		press(i);
+		e.run();
+		if (exact) {
+			EXPECT_EQ(frame(), frames[i]);
+		}
+	}
+
+	// Frame 20 has a keyframe of its own, but is still run again
+	rewind.rewind(e, 10);
+	EXPECT_EQ(rewind.available(), 7);
+	if (exact) {
+		EXPECT_EQ(frame(), frames[20]);
+	}
+	for (int i = 21; i <= 30; ++i) {
+		press(i);
+		e.run();
+	}
+	EXPECT_EQ(rewind.available(), 17);
+	rewind.rewind(e, 17);
+	if (exact) {
+		EXPECT_EQ(frame(), frames[13]);
+	}
+	EXPECT_TRUE(e.getVideoEnabled());
+	EXPECT_TRUE(e.getAudioEnabled());
+
+	vector<uint8_t> state(e.serializeSize());
+	ASSERT_TRUE(e.serialize(state.data(), state.size()));
+	ASSERT_TRUE(e.unserialize(state.data(), state.size()));
+	EXPECT_EQ(rewind.available(), 0);
+	e.setRewind(nullptr);
+}
+
+TEST_P(EmulatorTest, Headless) {
+	const auto& param = GetParam();
+	Emulator e;
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	GameData data;
+	e.configureData(&data);
+	e.run();
+
+	// Skipping rendering may leave render caches in the savestate different,
+	// but must not change what the game itself sees
+	auto ram = [&data]() {
+		vector<uint8_t> bytes;
+		for (const auto& block : data.addressSpace().blocks()) {
+			const uint8_t* start = static_cast<const uint8_t*>(block.second.offset(0));
+			bytes.insert(bytes.end(), start, start + block.second.size());
+		}
+		return bytes;
+	};
+
+	vector<uint8_t> start(e.serializeSize());
+	ASSERT_TRUE(e.serialize(start.data(), start.size()));
+	for (int i = 0; i < 4; ++i) {
+		e.run();
+	}
+	vector<uint8_t> rendered = ram();
+
+	ASSERT_TRUE(e.unserialize(start.data(), start.size()));
+	e.setVideoEnabled(false);
+	for (int i = 0; i < 4; ++i) {
+		e.run();
+	}
+	EXPECT_THAT(e.getImageData(), NotNull());
+	EXPECT_EQ(rendered, ram());
+
+	e.setVideoEnabled(true);
+	e.run();
+	EXPECT_THAT(e.getImageData(), NotNull());
+
+	ASSERT_TRUE(e.unserialize(start.data(), start.size()));
+	e.setAudioEnabled(false);
+	for (int i = 0; i < 4; ++i) {
+		e.run();
+		EXPECT_EQ(e.getAudioSamples(), 0);
+	}
+	EXPECT_EQ(rendered, ram());
+
+	e.setAudioEnabled(true);
+	e.run();
+	e.run();
+	EXPECT_GT(e.getAudioSamples(), 0);
+
+	// States saved with audio off may keep less of the sound chip's state, so
+	// they need not match byte for byte, but the game goes on the same from them
+	ASSERT_TRUE(e.unserialize(start.data(), start.size()));
+	for (int i = 0; i < 8; ++i) {
+		e.run();
+	}
+	vector<uint8_t> later = ram();
+	ASSERT_TRUE(e.unserialize(start.data(), start.size()));
+	e.setAudioEnabled(false);
+	for (int i = 0; i < 4; ++i) {
+		e.run();
+	}
+	vector<uint8_t> silent(e.serializeSize());
+	ASSERT_TRUE(e.serialize(silent.data(), silent.size()));
+	e.setAudioEnabled(true);
+	ASSERT_TRUE(e.unserialize(silent.data(), silent.size()));
+	for (int i = 0; i < 4; ++i) {
+		e.run();
+	}
+	EXPECT_EQ(later, ram());
+}
+
+TEST_P(EmulatorTest, Multiple) {
+	const auto& param = GetParam();
+	Emulator e;
+	Emulator f;
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	ASSERT_TRUE(f.loadRom("roms/" + param.rom));
+	e.run();
+
+	vector<uint8_t> v;
+	v.resize(e.serializeSize());
+	ASSERT_TRUE(e.serialize(v.data(), v.size()));
+
+	f.run();
+	f.run();
+
+	vector<uint8_t> w;
+	w.resize(e.serializeSize());
+	ASSERT_TRUE(e.serialize(w.data(), w.size()));
+	EXPECT_EQ(v, w);
+
+	f.unloadCore();
+	e.run();
+	{
+		Emulator g;
+		ASSERT_TRUE(g.loadRom("roms/" + param.rom));
+		g.run();
+	}
+	e.run();
+}
+
+TEST_P(EmulatorTest, Vec) {
+	const auto& param = GetParam();
+	VecEmulator v(2);
+	ASSERT_TRUE(v.loadRom("roms/" + param.rom, 3));
+	ASSERT_EQ(v.size(), 3);
+	EXPECT_GT(v.getImageWidth(), 0);
+	EXPECT_GT(v.getImageHeight(), 0);
+
+	vector<uint8_t> masks(v.size() * N_BUTTONS);
+	vector<uint8_t> screens(v.size() * v.getImageWidth() * v.getImageHeight() * 3);
+	for (int i = 0; i < 4; ++i) {
+		v.step(masks.data(), 1, N_BUTTONS, screens.data());
+	}
+
+	vector<uint8_t> copy(screens.size());
+	v.getScreens(copy.data());
+	EXPECT_EQ(screens, copy);
+
+	vector<uint8_t> state(v[0].serializeSize());
+	ASSERT_TRUE(v[0].serialize(state.data(), state.size()));
+	v.step(masks.data(), 1, N_BUTTONS);
+	ASSERT_TRUE(v[0].unserialize(state.data(), state.size()));
+
+	EXPECT_THROW(v.step(masks.data(), MAX_PLAYERS + 1, N_BUTTONS), invalid_argument);
+}
+
+TEST_P(EmulatorTest, ScenarioStep) {
+	const auto& param = GetParam();
+	Emulator e;
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	GameData data;
+	Scenario scen(data);
+	e.configureData(&data);
+	ASSERT_FALSE(data.addressSpace().blocks().empty());
+
+	scen.setRewardTime({ Scenario::Measurement::ABSOLUTE, Operation::NOOP, 0, 1, 1 });
+	float rewards[MAX_PLAYERS];
+	EXPECT_EQ(scen.step(&e, 4, rewards), 4);
+	EXPECT_EQ(rewards[0], 4);
+	EXPECT_FALSE(scen.isDone());
+	EXPECT_EQ(scen.frame(), 4);
+
+	data.setVariable("x", Variable{ "|u1", data.addressSpace().blocks().begin()->first });
+	scen.setDoneVariable("x", { Scenario::Measurement::ABSOLUTE, Operation::GREATER_OR_EQUAL, 0 });
+	EXPECT_EQ(scen.step(&e, 4, rewards), 1);
+	EXPECT_EQ(rewards[0], 1);
+	EXPECT_TRUE(scen.isDone());
+}
+
 vector<EmulatorTestParam> s_systems{
 	{ "Nes", "Dr88-FamiconIntro.nes" },
 	{ "Snes", "Anthrox-SineDotDemo.sfc" },
@@ -0,0 +1,462 @@
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+#include "imageops.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+using namespace ::testing;
+
+namespace Retro {
+
+// Odd sizes so that both the vector loops and the scalar tails get exercised
+static const size_t W = 53;
+static const size_t H = 22;
+
+static unsigned gray565(uint16_t pixel) {
+	return ((pixel & 0xF800) >> 10) + ((pixel & 0x07E0) >> 5) + ((pixel & 0x001F) << 1);
+}
+
+static unsigned grayX888(uint32_t pixel) {
+	return (((pixel >> 16) & 0xFF) + ((pixel >> 8) & 0xFF) + (pixel & 0xFF)) / 4;
+}
+
+template<typename T>
+static vector<T> noise(size_t stride) {
+	vector<T> pixels(stride * H);
+	srand(1);
+	for (auto& pixel : pixels) {
+		pixel = rand();
+	}
+	return pixels;
+}
+
+TEST(Image, Copy565) {
+	// Padded rows, like most cores' framebuffers
+	size_t stride = W + 11;
+	vector<uint16_t> in = noise<uint16_t>(stride);
+	Image image(Image::Format::RGB565, in.data(), W, H, stride * 2);
+
+	vector<uint8_t> rgb(W * H * 3);
+	Image rgbImage(Image::Format::RGB888, rgb.data(), W, H, W * 3);
+	image.copyTo(&rgbImage);
+
+	vector<uint8_t> gray(W * H);
+	Image grayImage(Image::Format::G8, gray.data(), W, H, W);
+	image.copyTo(&grayImage);
+
+	vector<uint32_t> rgbx(W * H);
+	Image rgbxImage(Image::Format::RGBX888, rgbx.data(), W, H, W * 4);
+	image.copyTo(&rgbxImage);
+
+	for (size_t y = 0; y < H; ++y) {
+		for (size_t x = 0; x < W; ++x) {
+			uint16_t pixel = in[y * stride + x];
+			EXPECT_EQ(rgb[(y * W + x) * 3], (pixel & 0xF800) >> 8);
+			EXPECT_EQ(rgb[(y * W + x) * 3 + 1], (pixel & 0x07E0) >> 3);
+			EXPECT_EQ(rgb[(y * W + x) * 3 + 2], (pixel & 0x001F) << 3);
+			EXPECT_EQ(gray[y * W + x], gray565(pixel));
+			EXPECT_EQ(rgbx[y * W + x], ((pixel & 0xF800) << 8) | ((pixel & 0x07E0) << 5) | ((pixel & 0x001F) << 3));
+		}
+	}
+}
+
+TEST(Image, Copy1555) {
+	// 0RGB1555 should convert exactly like the same colors in RGB565
+	size_t stride = W + 5;
+	vector<uint16_t> in = noise<uint16_t>(stride);
+	vector<uint16_t> in565(in.size());
+	for (size_t i = 0; i < in.size(); ++i) {
+		in565[i] = ((in[i] & 0x7FE0) << 1) | (in[i] & 0x001F);
+	}
+	Image image(Image::Format::RGB1555, in.data(), W, H, stride * 2);
+	Image image565(Image::Format::RGB565, in565.data(), W, H, stride * 2);
+
+	vector<Image::Format> formats{ Image::Format::RGB888, Image::Format::G8, Image::Format::RGBX888 };
+	for (Image::Format format : formats) {
+		size_t depth = format == Image::Format::G8 ? 1 : format == Image::Format::RGB888 ? 3 : 4;
+		vector<uint8_t> out(W * H * depth);
+		vector<uint8_t> expected(W * H * depth);
+		Image outImage(format, out.data(), W, H, W * depth);
+		Image expectedImage(format, expected.data(), W, H, W * depth);
+		image.copyTo(&outImage);
+		image565.copyTo(&expectedImage);
+		EXPECT_EQ(out, expected);
+	}
+
+	for (int divisor : { 2, 4 }) {
+		vector<uint8_t> out(W / divisor * H / divisor);
+		vector<uint8_t> expected(out.size());
+		Image outImage(Image::Format::G8, out.data(), W / divisor, H / divisor, W / divisor);
+		Image expectedImage(Image::Format::G8, expected.data(), W / divisor, H / divisor, W / divisor);
+		image.divideTo(divisor, &outImage);
+		image565.divideTo(divisor, &expectedImage);
+		EXPECT_EQ(out, expected);
+	}
+
+	vector<uint8_t> out(20 * 9 * 3);
+	vector<uint8_t> expected(out.size());
+	Image outImage(Image::Format::RGB888, out.data(), 20, 9, 20 * 3);
+	Image expectedImage(Image::Format::RGB888, expected.data(), 20, 9, 20 * 3);
+	image.resizeTo(&outImage);
+	image565.resizeTo(&expectedImage);
+	EXPECT_EQ(out, expected);
+
+	vector<uint16_t> copy(W * H);
+	Image copyImage(Image::Format::RGB1555, copy.data(), W, H, W * 2);
+	image.copyTo(&copyImage);
+	for (size_t y = 0; y < H; ++y) {
+		EXPECT_TRUE(equal(&copy[y * W], &copy[y * W + W], &in[y * stride]));
+	}
+}
+
+TEST(Image, CopyX888) {
+	size_t stride = W + 3;
+	vector<uint32_t> in = noise<uint32_t>(stride);
+	Image image(Image::Format::RGBX888, in.data(), W, H, stride * 4);
+
+	vector<uint8_t> rgb(W * H * 3);
+	Image rgbImage(Image::Format::RGB888, rgb.data(), W, H, W * 3);
+	image.copyTo(&rgbImage);
+
+	vector<uint8_t> gray(W * H);
+	Image grayImage(Image::Format::G8, gray.data(), W, H, W);
+	image.copyTo(&grayImage);
+
+	for (size_t y = 0; y < H; ++y) {
+		for (size_t x = 0; x < W; ++x) {
+			uint32_t pixel = in[y * stride + x];
+			EXPECT_EQ(rgb[(y * W + x) * 3], (pixel >> 16) & 0xFF);
+			EXPECT_EQ(rgb[(y * W + x) * 3 + 1], (pixel >> 8) & 0xFF);
+			EXPECT_EQ(rgb[(y * W + x) * 3 + 2], pixel & 0xFF);
+			EXPECT_EQ(gray[y * W + x], grayX888(pixel));
+		}
+	}
+}
+
+TEST(Image, Halve) {
+	vector<uint16_t> in565 = noise<uint16_t>(W);
+	vector<uint32_t> inX888 = noise<uint32_t>(W);
+	Image image565(Image::Format::RGB565, in565.data(), W, H, W * 2);
+	Image imageX888(Image::Format::RGBX888, inX888.data(), W, H, W * 4);
+
+	vector<uint8_t> out565(W / 2 * H / 2);
+	vector<uint8_t> outX888(W / 2 * H / 2);
+	Image halved565(Image::Format::G8, out565.data(), W / 2, H / 2, W / 2);
+	Image halvedX888(Image::Format::G8, outX888.data(), W / 2, H / 2, W / 2);
+	image565.divideTo(2, &halved565);
+	imageX888.divideTo(2, &halvedX888);
+
+	// The vector and scalar paths round differently
+	for (size_t y = 0; y < H / 2; ++y) {
+		for (size_t x = 0; x < W / 2; ++x) {
+			size_t i = y * 2 * W + x * 2;
+			int expected = (gray565(in565[i]) + gray565(in565[i + 1]) + gray565(in565[i + W]) + gray565(in565[i + W + 1])) / 4;
+			EXPECT_NEAR(out565[y * (W / 2) + x], expected, 1);
+			expected = (grayX888(inX888[i]) + grayX888(inX888[i + 1]) + grayX888(inX888[i + W]) + grayX888(inX888[i + W + 1])) / 4;
+			EXPECT_NEAR(outX888[y * (W / 2) + x], expected, 1);
+		}
+	}
+}
+
+TEST(Image, Interlace) {
+	vector<uint16_t> in = noise<uint16_t>(W);
+	Image image(Image::Format::RGB565, in.data(), W, H, W * 2);
+
+	vector<uint8_t> halved(W / 2 * H / 2);
+	Image halvedImage(Image::Format::G8, halved.data(), W / 2, H / 2, W / 2);
+	image.halveTo(&halvedImage);
+
+	vector<uint8_t> old(W / 2 * H / 2 * 2, 7);
+	vector<uint8_t> out(old.size());
+	Image oldImage(Image::Format::G8, old.data(), W / 2 * 2, H / 2, W / 2 * 2);
+	Image outImage(Image::Format::G8, out.data(), W / 2 * 2, H / 2, W / 2 * 2);
+	image.halveToInterlace(&outImage, &oldImage);
+
+	for (size_t i = 0; i < halved.size(); ++i) {
+		EXPECT_EQ(out[i * 2], halved[i]);
+		EXPECT_EQ(out[i * 2 + 1], 7);
+	}
+
+	EXPECT_THROW(image.divideTo(3, &halvedImage), logic_error);
+	EXPECT_THROW(image.halveTo(&oldImage), invalid_argument);
+}
+
+TEST(Image, PaddedOutput) {
+	vector<uint32_t> in = noise<uint32_t>(W);
+	Image image(Image::Format::RGBX888, in.data(), W, H, W * 4);
+
+	vector<uint8_t> packed(W / 4 * H / 4);
+	Image packedImage(Image::Format::G8, packed.data(), W / 4, H / 4, W / 4);
+	image.quarterTo(&packedImage);
+
+	// Rows are written at the output stride and the padding is left alone
+	size_t stride = W / 4 + 5;
+	vector<uint8_t> padded(stride * H / 4, 0xAA);
+	Image paddedImage(Image::Format::G8, padded.data(), W / 4, H / 4, stride);
+	image.quarterTo(&paddedImage);
+
+	for (size_t y = 0; y < H / 4; ++y) {
+		for (size_t x = 0; x < stride; ++x) {
+			if (x < W / 4) {
+				EXPECT_EQ(padded[y * stride + x], packed[y * (W / 4) + x]);
+			} else {
+				EXPECT_EQ(padded[y * stride + x], 0xAA);
+			}
+		}
+	}
+
+	vector<uint8_t> rgb(W * H * 3);
+	Image rgbImage(Image::Format::RGB888, rgb.data(), W, H, W * 3);
+	image.copyTo(&rgbImage);
+
+	stride = W * 3 + 7;
+	vector<uint8_t> paddedRgb(stride * H, 0xAA);
+	Image paddedRgbImage(Image::Format::RGB888, paddedRgb.data(), W, H, stride);
+	image.copyTo(&paddedRgbImage);
+	for (size_t y = 0; y < H; ++y) {
+		EXPECT_TRUE(equal(&rgb[y * W * 3], &rgb[(y + 1) * W * 3], &paddedRgb[y * stride]));
+		EXPECT_EQ(paddedRgb[y * stride + W * 3], 0xAA);
+	}
+}
+
+TEST(Image, Crop) {
+	size_t stride = W + 3;
+	vector<uint16_t> in = noise<uint16_t>(stride);
+	Image image(Image::Format::RGB565, in.data(), W, H, stride * 2);
+
+	vector<uint8_t> full(W * H * 3);
+	Image fullImage(Image::Format::RGB888, full.data(), W, H, W * 3);
+	image.copyTo(&fullImage);
+
+	const size_t x = 5;
+	const size_t y = 3;
+	const size_t w = 33;
+	const size_t h = 12;
+	Image cropped = image.crop(x, y, w, h);
+	EXPECT_EQ(cropped.width(), w);
+	EXPECT_EQ(cropped.height(), h);
+
+	vector<uint8_t> out(w * h * 3);
+	Image outImage(Image::Format::RGB888, out.data(), w, h, w * 3);
+	cropped.copyTo(&outImage);
+	for (size_t row = 0; row < h; ++row) {
+		EXPECT_TRUE(equal(&out[row * w * 3], &out[(row + 1) * w * 3], &full[((y + row) * W + x) * 3]));
+	}
+
+	EXPECT_THROW(image.crop(x, y, W, h), invalid_argument);
+	EXPECT_THROW(image.crop(x, H, w, 1), invalid_argument);
+}
+
+// Every vector extension the CPU has must produce exactly what the baseline
+// kernels do, including in the columns left over for them
+TEST(Image, Simd) {
+	const size_t w = 301;
+	size_t stride = w + 5;
+	vector<uint16_t> in565 = noise<uint16_t>(stride);
+	vector<uint32_t> inX888 = noise<uint32_t>(stride);
+	Image image565(Image::Format::RGB565, in565.data(), w, H, stride * 2);
+	Image imageX888(Image::Format::RGBX888, inX888.data(), w, H, stride * 4);
+
+	auto convert = [&]() {
+		vector<vector<uint8_t>> outs;
+		for (Image* image : { &image565, &imageX888 }) {
+			outs.emplace_back((w * 3 + 1) * H);
+			Image rgb(Image::Format::RGB888, outs.back().data(), w, H, w * 3 + 1);
+			image->copyTo(&rgb);
+			for (int divisor : { 2, 4 }) {
+				outs.emplace_back(w / divisor * H / divisor);
+				Image gray(Image::Format::G8, outs.back().data(), w / divisor, H / divisor, w / divisor);
+				image->divideTo(divisor, &gray);
+			}
+		}
+		return outs;
+	};
+
+	Image::Simd best = Image::simd();
+	ASSERT_TRUE(Image::setSimd(Image::Simd::BASELINE));
+	auto expected = convert();
+	for (Image::Simd simd : { Image::Simd::AVX2, Image::Simd::AVX512 }) {
+		if (simd > best) {
+			EXPECT_FALSE(Image::setSimd(simd));
+			continue;
+		}
+		ASSERT_TRUE(Image::setSimd(simd));
+		EXPECT_EQ(convert(), expected);
+	}
+	Image::setSimd(best);
+}
+
+TEST(Image, Resize) {
+	size_t stride = W + 3;
+	vector<uint16_t> in = noise<uint16_t>(stride);
+	Image image(Image::Format::RGB565, in.data(), W, H, stride * 2);
+
+	// Shrinking by exactly 2 averages each 2x2 block
+	vector<uint8_t> halved(W / 2 * H / 2);
+	Image halvedImage(Image::Format::G8, halved.data(), W / 2, H / 2, W / 2);
+	image.crop(0, 0, W / 2 * 2, H / 2 * 2).resizeTo(&halvedImage);
+	for (size_t y = 0; y < H / 2; ++y) {
+		for (size_t x = 0; x < W / 2; ++x) {
+			size_t i = y * 2 * stride + x * 2;
+			unsigned sum = gray565(in[i]) + gray565(in[i + 1]) + gray565(in[i + stride]) + gray565(in[i + stride + 1]);
+			EXPECT_EQ(halved[y * (W / 2) + x], (sum + 2) / 4);
+		}
+	}
+
+	// Other sizes average over the covered area, with partial pixels weighted
+	const size_t outW = 20;
+	const size_t outH = 9;
+	vector<uint8_t> shrunk(outW * outH);
+	Image shrunkImage(Image::Format::G8, shrunk.data(), outW, outH, outW);
+	image.resizeTo(&shrunkImage);
+	auto overlap = [](double begin, double end, size_t i) {
+		return max(0.0, min(end, i + 1.0) - max(begin, static_cast<double>(i)));
+	};
+	for (size_t y = 0; y < outH; ++y) {
+		for (size_t x = 0; x < outW; ++x) {
+			double sx = static_cast<double>(W) / outW;
+			double sy = static_cast<double>(H) / outH;
+			double sum = 0;
+			for (size_t iy = 0; iy < H; ++iy) {
+				for (size_t ix = 0; ix < W; ++ix) {
+					sum += overlap(x * sx, (x + 1) * sx, ix) * overlap(y * sy, (y + 1) * sy, iy) * gray565(in[iy * stride + ix]);
+				}
+			}
+			EXPECT_NEAR(shrunk[y * outW + x], sum / (sx * sy), 1);
+		}
+	}
+
+	// A flat image stays flat at any size, growing or shrinking
+	vector<uint32_t> flat(W * H, 0x00C08040);
+	Image flatImage(Image::Format::RGBX888, flat.data(), W, H, W * 4);
+	const size_t size = 84;
+	vector<uint8_t> rgb((size * 3 + 1) * size, 0xAA);
+	Image rgbImage(Image::Format::RGB888, rgb.data(), size, size, size * 3 + 1);
+	flatImage.resizeTo(&rgbImage);
+	for (size_t y = 0; y < size; ++y) {
+		for (size_t x = 0; x < size; ++x) {
+			EXPECT_EQ(rgb[y * (size * 3 + 1) + x * 3], 0xC0);
+			EXPECT_EQ(rgb[y * (size * 3 + 1) + x * 3 + 1], 0x80);
+			EXPECT_EQ(rgb[y * (size * 3 + 1) + x * 3 + 2], 0x40);
+		}
+		EXPECT_EQ(rgb[y * (size * 3 + 1) + size * 3], 0xAA);
+	}
+
+	// The same size is a plain conversion
+	vector<uint8_t> copied(W * H);
+	vector<uint8_t> resized(W * H);
+	Image copiedImage(Image::Format::G8, copied.data(), W, H, W);
+	Image resizedImage(Image::Format::G8, resized.data(), W, H, W);
+	image.copyTo(&copiedImage);
+	image.resizeTo(&resizedImage);
+	EXPECT_EQ(copied, resized);
+
+	Image wrongImage(Image::Format::RGBX888, flat.data(), size / 4, size / 4, size);
+	EXPECT_THROW(image.resizeTo(&wrongImage), logic_error);
+}
+
+template<typename T>
+static void checkMax(Image::Format format, const vector<T>& masks) {
+	size_t stride = W + 3;
+	vector<T> in = noise<T>(stride);
+	vector<T> old(in.rbegin(), in.rend());
+	vector<T> pooled(in.size());
+	for (size_t i = 0; i < in.size(); ++i) {
+		for (T mask : masks) {
+			pooled[i] |= max<T>(in[i] & mask, old[i] & mask);
+		}
+	}
+	Image image(format, in.data(), W, H, stride * sizeof(T));
+	Image oldImage(format, old.data(), W, H, stride * sizeof(T));
+	Image pooledImage(format, pooled.data(), W, H, stride * sizeof(T));
+
+	vector<uint8_t> out(W * H * 3);
+	vector<uint8_t> expected(out.size());
+	Image outImage(Image::Format::RGB888, out.data(), W, H, W * 3);
+	Image expectedImage(Image::Format::RGB888, expected.data(), W, H, W * 3);
+	image.copyToMax(&outImage, &oldImage);
+	pooledImage.copyTo(&expectedImage);
+	EXPECT_EQ(out, expected);
+
+	for (int divisor : { 1, 2, 4 }) {
+		vector<uint8_t> out(W / divisor * (H / divisor));
+		vector<uint8_t> expected(out.size());
+		Image outImage(Image::Format::G8, out.data(), W / divisor, H / divisor, W / divisor);
+		Image expectedImage(Image::Format::G8, expected.data(), W / divisor, H / divisor, W / divisor);
+		image.divideToMax(divisor, &outImage, &oldImage);
+		pooledImage.divideTo(divisor, &expectedImage);
+		EXPECT_EQ(out, expected);
+	}
+
+	out.resize(20 * 9 * 3);
+	expected.resize(out.size());
+	outImage = Image(Image::Format::RGB888, out.data(), 20, 9, 20 * 3);
+	expectedImage = Image(Image::Format::RGB888, expected.data(), 20, 9, 20 * 3);
+	image.resizeToMax(&outImage, &oldImage);
+	pooledImage.resizeTo(&expectedImage);
+	EXPECT_EQ(out, expected);
+}
+
+TEST(Image, Max) {
+	checkMax<uint16_t>(Image::Format::RGB565, { 0xF800, 0x07E0, 0x001F });
+	checkMax<uint16_t>(Image::Format::RGB1555, { 0x7C00, 0x03E0, 0x001F });
+	checkMax<uint32_t>(Image::Format::RGBX888, { 0xFF0000, 0x00FF00, 0x0000FF });
+
+	vector<uint16_t> in(W * H);
+	Image image(Image::Format::RGB565, in.data(), W, H, W * 2);
+	Image small(Image::Format::RGB565, in.data(), W - 1, H, W * 2);
+	Image other(Image::Format::RGB1555, in.data(), W, H, W * 2);
+	vector<uint8_t> out(W * H * 3);
+	Image outImage(Image::Format::RGB888, out.data(), W, H, W * 3);
+	EXPECT_THROW(image.copyToMax(&outImage, &small), invalid_argument);
+	EXPECT_THROW(image.copyToMax(&outImage, &other), invalid_argument);
+}
+
+TEST(Image, FrameStack) {
+	vector<uint16_t> in = noise<uint16_t>(W);
+	Image image(Image::Format::RGB565, in.data(), W, H, W * 2);
+	FrameStack stack(Image::Format::G8, W / 2, H / 2, 3);
+	EXPECT_EQ(stack.frameSize(), W / 2 * (H / 2));
+
+	// Frames are told apart by the value of their first pixel
+	auto push = [&](uint16_t first) {
+		in[0] = in[1] = in[W] = in[W + 1] = first;
+		Image frame(stack.format(), stack.next(), stack.width(), stack.height(), stack.stride());
+		image.halveTo(&frame);
+		stack.push();
+	};
+	auto firsts = [&]() {
+		vector<unsigned> values;
+		for (size_t i = 0; i < stack.depth(); ++i) {
+			values.push_back(stack.frames()[i * stack.frameSize()]);
+		}
+		return values;
+	};
+
+	// The first frame fills the whole stack
+	push(0x0000);
+	EXPECT_THAT(firsts(), ElementsAre(0, 0, 0));
+	push(0x0800);
+	EXPECT_THAT(firsts(), ElementsAre(0, 0, 2));
+	push(0x1000);
+	push(0x1800);
+	push(0x2000);
+	EXPECT_THAT(firsts(), ElementsAre(4, 6, 8));
+
+	// The rest of each frame is kept along with it
+	vector<uint8_t> halved(stack.frameSize());
+	Image halvedImage(Image::Format::G8, halved.data(), W / 2, H / 2, W / 2);
+	image.halveTo(&halvedImage);
+	EXPECT_TRUE(equal(halved.begin(), halved.end(), &stack.frames()[stack.frameSize() * 2]));
+
+	stack.reset();
+	push(0x0800);
+	EXPECT_THAT(firsts(), ElementsAre(2, 2, 2));
+
+	EXPECT_THROW(FrameStack(Image::Format::G8, W, H, 0), invalid_argument);
+}
+}
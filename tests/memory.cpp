@@ -1487,4 +1487,18 @@ TEST(DataTypeEncode, x01020304) {
 	EXPECT_THAT(mem, ElementsAre(3, 4, 1, 2));
 }
 
+TEST(AddressSpace, Pack) {
+	uint8_t low[3] { 1, 2, 3 };
+	uint8_t high[2] { 4, 5 };
+	AddressSpace mem;
+	mem.addBlock(0x100, sizeof(high), high);
+	mem.addBlock(0, sizeof(low), low);
+	EXPECT_EQ(mem.packedSize(), 5);
+
+	// Blocks are packed in order of address, not in the order they were added
+	uint8_t packed[6] {};
+	mem.pack(packed);
+	EXPECT_THAT(packed, ElementsAre(1, 2, 3, 4, 5, 0));
+}
+
 }
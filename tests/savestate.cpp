@@ -0,0 +1,173 @@
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+#include "savestate.h"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+#include <zlib.h>
+
+using namespace std;
+using namespace ::testing;
+
+namespace Retro {
+
+TEST(StateArena, Recycle) {
+	StateArena arena(100, 4);
+	EXPECT_EQ(arena.slabSize(), 100);
+	EXPECT_EQ(arena.capacity(), 0);
+
+	vector<uint8_t*> slabs;
+	for (int i = 0; i < 4; ++i) {
+		slabs.push_back(arena.acquire());
+		memset(slabs.back(), i, arena.slabSize());
+	}
+	EXPECT_EQ(arena.used(), 4);
+	EXPECT_EQ(arena.capacity(), 4);
+	EXPECT_EQ(set<uint8_t*>(slabs.begin(), slabs.end()).size(), 4);
+	for (int i = 0; i < 4; ++i) {
+		EXPECT_EQ(slabs[i][0], i);
+		EXPECT_EQ(slabs[i][99], i);
+	}
+
+	// Released slabs are handed out again before anything new is allocated
+	arena.release(slabs[2]);
+	EXPECT_EQ(arena.used(), 3);
+	EXPECT_EQ(arena.acquire(), slabs[2]);
+	EXPECT_EQ(arena.capacity(), 4);
+
+	uint8_t* extra = arena.acquire();
+	EXPECT_EQ(arena.used(), 5);
+	EXPECT_EQ(arena.capacity(), 8);
+	EXPECT_THAT(slabs, Not(Contains(extra)));
+
+	arena.release(extra);
+	for (uint8_t* slab : slabs) {
+		arena.release(slab);
+	}
+	EXPECT_EQ(arena.used(), 0);
+	for (int i = 0; i < 8; ++i) {
+		arena.acquire();
+	}
+	EXPECT_EQ(arena.capacity(), 8);
+}
+
+TEST(StateArena, Empty) {
+	EXPECT_THROW(StateArena(0), invalid_argument);
+	EXPECT_THROW(StateArena(100, 0), invalid_argument);
+}
+
+TEST(DeltaState, Keyframe) {
+	vector<uint8_t> state(1000);
+	state[3] = 1;
+	state[500] = 2;
+	state[501] = 3;
+	state[999] = 4;
+	auto keyframe = make_shared<DeltaState>(state.data(), state.size());
+	EXPECT_EQ(keyframe->size(), 1000);
+	EXPECT_EQ(keyframe->depth(), 0);
+	EXPECT_LT(keyframe->encodedSize(), 20);
+
+	vector<uint8_t> restored(state.size(), 0xFF);
+	keyframe->restore(restored.data());
+	EXPECT_EQ(restored, state);
+
+	DeltaState empty(static_cast<const void*>(nullptr), 0);
+	EXPECT_EQ(empty.encodedSize(), 0);
+}
+
+TEST(DeltaState, Chain) {
+	vector<uint8_t> state(4096);
+	for (size_t i = 0; i < state.size(); ++i) {
+		state[i] = i * 7;
+	}
+	vector<vector<uint8_t>> states{ state };
+	vector<shared_ptr<const DeltaState>> deltas{ make_shared<DeltaState>(state.data(), state.size()) };
+	for (int i = 1; i < 20; ++i) {
+		// Scattered single bytes and a longer changed run
+		state[i * 97] ^= 0xFF;
+		state[i * 131 % state.size()] += 1;
+		memset(&state[i * 50], i, 40);
+		states.push_back(state);
+		if (i % 2) {
+			deltas.push_back(make_shared<DeltaState>(state.data(), state.size(), deltas.back()));
+		} else {
+			deltas.push_back(make_shared<DeltaState>(state.data(), state.size(), deltas.back(), states[i - 1].data()));
+		}
+		EXPECT_EQ(deltas.back()->depth(), i);
+		EXPECT_LT(deltas.back()->encodedSize(), 100);
+	}
+
+	vector<uint8_t> restored(state.size());
+	for (size_t i = 0; i < deltas.size(); ++i) {
+		deltas[i]->restore(restored.data());
+		EXPECT_EQ(restored, states[i]);
+	}
+
+	EXPECT_THROW(DeltaState(state.data(), state.size() - 1, deltas.back()), invalid_argument);
+}
+
+TEST(DeltaState, LongChain) {
+	vector<uint8_t> state(64);
+	auto delta = make_shared<DeltaState>(state.data(), state.size());
+	for (int i = 0; i < 200000; ++i) {
+		vector<uint8_t> base = state;
+		state[i % state.size()] = i;
+		delta = make_shared<DeltaState>(state.data(), state.size(), delta, base.data());
+	}
+	vector<uint8_t> restored(state.size());
+	delta->restore(restored.data());
+	EXPECT_EQ(restored, state);
+	delta.reset();
+}
+
+static void writeStateFile(const char* path, const vector<uint8_t>& state) {
+	gzFile file = gzopen(path, "wb");
+	ASSERT_THAT(file, NotNull());
+	gzwrite(file, state.data(), state.size());
+	gzclose(file);
+}
+
+TEST(StateFile, Cache) {
+	const char* path = "state-file-test.state";
+	vector<uint8_t> state(100000);
+	for (size_t i = 0; i < state.size(); ++i) {
+		state[i] = i * i;
+	}
+	writeStateFile(path, state);
+
+	auto loaded = loadStateFile(path);
+	EXPECT_EQ(*loaded, state);
+	EXPECT_EQ(loadStateFile(path), loaded);
+
+	// Files are told apart by size and modification time, and the rewrite may
+	// land in the same second
+	state.push_back(1);
+	writeStateFile(path, state);
+	auto changed = loadStateFile(path);
+	EXPECT_NE(changed, loaded);
+	EXPECT_EQ(*changed, state);
+	EXPECT_NE(*loaded, state);
+
+	// Only the states still in use are kept
+	weak_ptr<const vector<uint8_t>> released = loaded;
+	loaded.reset();
+	EXPECT_TRUE(released.expired());
+	EXPECT_EQ(loadStateFile(path), changed);
+
+	{
+		FILE* file = fopen(path, "wb");
+		fputs("not a state", file);
+		fclose(file);
+	}
+	EXPECT_THROW(loadStateFile(path), runtime_error);
+	remove(path);
+	EXPECT_THROW(loadStateFile(path), runtime_error);
+}
+
+}
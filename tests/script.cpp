@@ -5,6 +5,8 @@
 #include "script.h"
 #include "script-lua.h"
 
+#include <cstdio>
+#include <fstream>
 #include <sstream>
 
 using namespace Retro;
@@ -104,3 +106,38 @@ TEST(ScriptLua, SetCustomData) {
 	context->callFunction("test");
 	EXPECT_EQ(data.lookupValue("foo"), 1);
 }
+
+TEST(ScriptLua, Restart) {
+	GameData data;
+	data.setValue("foo", 3);
+
+	const char* filename = "restart-test.lua";
+	{
+		ofstream script(filename);
+		script << "local calls = 0\n"
+		          "function count()\n"
+		          "	calls = calls + 1\n"
+		          "	total = (total or 0) + 1\n"
+		          "	return calls + total * 10 + data.foo * 100\n"
+		          "end\n";
+	}
+
+	auto context = ScriptLua::create();
+	ASSERT_TRUE(context->init());
+	context->setData(&data);
+	ASSERT_TRUE(context->load(filename));
+	EXPECT_EQ(static_cast<double>(context->callFunction("count")), 311);
+	EXPECT_EQ(static_cast<double>(context->callFunction("count")), 322);
+	ASSERT_TRUE(context->loadString("math = nil string = nil"));
+
+	// The compiled chunk is run again without reading the file
+	remove(filename);
+	context->restart();
+	EXPECT_THAT(context->listFunctions(), IsEmpty());
+	ASSERT_TRUE(context->load(filename));
+	EXPECT_THAT(context->listFunctions(), ElementsAre("count"));
+	EXPECT_EQ(static_cast<double>(context->callFunction("count")), 311);
+	ASSERT_TRUE(context->loadString("assert(math.floor(1.5) == 1)"));
+
+	EXPECT_FALSE(context->load("missing.lua"));
+}
@@ -1,9 +1,13 @@
 import os
+import weakref
 
+import numpy as np
 import pytest
 
 import retro
 
+DUMMY_JSON = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
 
 @pytest.fixture(
     params=[
@@ -44,15 +48,12 @@ def generate_test_env(request):
 
 
 def test_env_create(generate_test_env):
-    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
-    assert generate_test_env(info=json_path, scenario=json_path)
+    assert generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON)
 
 
 @pytest.mark.parametrize("obs_type", [retro.Observations.IMAGE, retro.Observations.RAM])
 def test_env_basic(obs_type, generate_test_env):
-    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
-
-    env = generate_test_env(info=json_path, scenario=json_path, obs_type=obs_type)
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON, obs_type=obs_type)
 
     obs, info = env.reset()
     assert obs in env.observation_space
@@ -74,9 +75,7 @@ def test_env_basic(obs_type, generate_test_env):
 
 
 def test_env_data(generate_test_env):
-    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
-
-    env = generate_test_env(info=json_path, scenario=json_path)
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON)
     assert isinstance(env.data[env.system], int)
 
     env.data["foo"] = 1
@@ -87,3 +86,594 @@ def test_env_data(generate_test_env):
     with pytest.raises(KeyError):
         val = env.data["foo"]
         assert val
+
+
+def test_env_scripts(generate_test_env, tmp_path):
+    import json
+
+    def scenario(name, scale):
+        with open(str(tmp_path / (name + ".lua")), "w") as f:
+            f.write(
+                "count = 0\n"
+                "function reward()\n"
+                "  count = count + 1\n"
+                "  return {} * count\n"
+                "end\n".format(scale),
+            )
+        path = str(tmp_path / (name + ".json"))
+        with open(path, "w") as f:
+            json.dump({"scripts": [name + ".lua"], "reward": {"script": "lua:reward"}}, f)
+        return path
+
+    # Each env keeps its own Lua state, even when they step in turn
+    first = generate_test_env(info=DUMMY_JSON, scenario=scenario("first", 1))
+    second = generate_test_env(info=DUMMY_JSON, scenario=scenario("second", -2))
+    try:
+        # Resetting updates the scenario once already
+        first.reset()
+        second.reset()
+        for count in range(2, 5):
+            _, rew, _, _, _ = first.step(first.action_space.sample())
+            assert rew == count
+            _, rew, _, _, _ = second.step(second.action_space.sample())
+            assert rew == -2 * count
+
+        # Resetting one env only restarts its own scripts
+        first.reset()
+        _, rew, _, _, _ = second.step(second.action_space.sample())
+        assert rew == -10
+        _, rew, _, _, _ = first.step(first.action_space.sample())
+        assert rew == 2
+    finally:
+        second.close()
+
+
+def test_env_frameskip(generate_test_env):
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON, frameskip=4)
+
+    env.reset()
+    obs, rew, terminated, truncated, info = env.step(env.action_space.sample())
+    assert obs in env.observation_space
+    assert rew == 0
+    assert terminated is False
+
+    with pytest.raises(ValueError):
+        generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON, frameskip=0)
+
+
+def test_env_frameskip_done(generate_test_env, tmp_path):
+    import json
+
+    with open(str(tmp_path / "done.lua"), "w") as f:
+        f.write("count = 0\nfunction done()\n  count = count + 1\n  return count >= 3\nend\n")
+    scenario = str(tmp_path / "done.json")
+    with open(scenario, "w") as f:
+        json.dump({"scripts": ["done.lua"], "done": {"script": "lua:done"}}, f)
+    env = generate_test_env(info=DUMMY_JSON, scenario=scenario, frameskip=4)
+
+    # Done on the second frame of the step, whose screen is the one returned
+    # when every frame is rendered
+    env.data.render_every_frame = True
+    env.reset()
+    state = env.em.get_state()
+    action = np.zeros(env.action_space.shape, env.action_space.dtype)
+    obs, _, terminated, _, _ = env.step(action)
+    assert terminated is True
+
+    env.em.set_state(state)
+    env.em.step()
+    env.em.step()
+    assert np.array_equal(obs, env.em.get_screen())
+
+    # Otherwise that frame isn't rendered on cores that can skip it, and the
+    # screen is still the one from before the step
+    env.data.render_every_frame = False
+    env.em.set_state(state)
+    env.em.step()
+    first = env.em.get_screen()
+    env.data.reset()
+    obs, _, terminated, _, _ = env.step(action)
+    assert terminated is True
+    if env.system in ("Nes", "Snes", "Genesis"):
+        assert np.array_equal(obs, first)
+
+
+def test_env_compute_step(generate_test_env, monkeypatch):
+    class Env(retro.RetroEnv):
+        def compute_step(self):
+            return 1, False, {"steps": 1}
+
+    monkeypatch.setattr(retro, "RetroEnv", Env)
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON, frameskip=3)
+
+    # Overrides are still used, once per frame
+    env.reset()
+    obs, rew, terminated, truncated, info = env.step(env.action_space.sample())
+    assert obs in env.observation_space
+    assert rew == 3
+    assert info == {"steps": 1}
+
+
+@pytest.mark.parametrize("action_type", list(retro.Actions))
+def test_env_actions(action_type, generate_test_env):
+    env = generate_test_env(
+        info=DUMMY_JSON,
+        scenario=DUMMY_JSON,
+        use_restricted_actions=action_type,
+    )
+
+    env.reset()
+    action = env.action_space.sample()
+    obs, rew, terminated, truncated, info = env.step(action)
+    assert obs in env.observation_space
+    assert terminated is False
+
+    # Decoded the same way as step() does it
+    masks = env.data.decode_action(action, action_type.value, env.players, env.num_buttons)
+    buttons = env.action_to_array(action)
+    assert len(buttons) == len(masks)
+    for mask, ap in zip(masks, buttons):
+        assert sum(int(b) << i for i, b in enumerate(ap)) == mask
+    with pytest.raises(ValueError):
+        env.action_to_array([1] * (env.num_buttons + 1))
+
+
+def test_env_screen_format(generate_test_env):
+    env = generate_test_env(
+        info=DUMMY_JSON,
+        scenario=DUMMY_JSON,
+        grayscale=True,
+        downsample=2,
+        interlace=True,
+    )
+
+    width, height = env.em.get_resolution()
+    assert env.observation_space.shape == (height // 2, width // 2, 2)
+
+    obs, _ = env.reset()
+    assert obs in env.observation_space
+    next_obs, _, _, _, _ = env.step(env.action_space.sample())
+    assert next_obs in env.observation_space
+    assert (next_obs[..., 1] == obs[..., 0]).all()
+
+
+def test_env_resize(generate_test_env):
+    env = generate_test_env(
+        info=DUMMY_JSON,
+        scenario=DUMMY_JSON,
+        grayscale=True,
+        size=(84, 84),
+    )
+    assert env.observation_space.shape == (84, 84, 1)
+
+    obs, _ = env.reset()
+    assert obs in env.observation_space
+    obs, _, _, _, _ = env.step(env.action_space.sample())
+    assert obs in env.observation_space
+    assert env.em.get_screen(size=(64, 48)).shape == (48, 64, 3)
+
+    with pytest.raises(ValueError):
+        env.em.get_screen(grayscale=True, downsample=2, size=(84, 84))
+
+
+def test_env_frame_stack(generate_test_env):
+    env = generate_test_env(
+        info=DUMMY_JSON,
+        scenario=DUMMY_JSON,
+        grayscale=True,
+        downsample=2,
+        frame_stack=4,
+    )
+    shape = env.em.get_screen(grayscale=True, downsample=2).shape
+    assert env.observation_space.shape == (4, *shape)
+
+    # The first screen fills the stack
+    obs, _ = env.reset()
+    assert obs in env.observation_space
+    assert all(np.array_equal(obs[0], frame) for frame in obs)
+    for _ in range(3):
+        env.step(env.action_space.sample())
+    last = env.em.get_screen(grayscale=True, downsample=2)
+    obs, _, _, _, _ = env.step(env.action_space.sample())
+    assert obs in env.observation_space
+    assert np.array_equal(obs[2], last)
+    assert np.array_equal(obs[3], env.em.get_screen(grayscale=True, downsample=2))
+
+    # An observation stays as it is through the next step
+    previous = obs.copy()
+    env.step(env.action_space.sample())
+    assert np.array_equal(obs, previous)
+    assert not env.frame_stack.frames.flags.writeable
+
+    # The stack can be copied into a preallocated array
+    out = np.zeros(env.frame_stack.shape, np.uint8)
+    screen = env.em.get_screen(grayscale=True, downsample=2, stack=env.frame_stack, out=out)
+    assert screen is out
+    assert np.array_equal(out, env.frame_stack.frames)
+    with pytest.raises(ValueError):
+        env.em.get_screen(grayscale=True, downsample=2, stack=env.frame_stack, out=out[1:])
+
+    with pytest.raises(ValueError):
+        env.em.get_screen(stack=env.frame_stack)
+
+
+def test_env_indexed(generate_test_env):
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON)
+    palette = env.em.get_palette()
+    if palette is None:
+        with pytest.raises(RuntimeError):
+            env.em.get_screen(indexed=True)
+        return
+    env.close()
+
+    env = generate_test_env(
+        info=DUMMY_JSON,
+        scenario=DUMMY_JSON,
+        obs_type=retro.Observations.INDEXED,
+    )
+    obs, _ = env.reset()
+    for _ in range(10):
+        obs, _, _, _, _ = env.step(env.action_space.sample())
+    assert obs in env.observation_space
+    assert obs.shape[2] == 1
+    # The indices look up the same colors as the screen
+    assert np.array_equal(env.em.get_palette()[obs[..., 0]], env.em.get_screen())
+
+    with pytest.raises(ValueError):
+        env.em.get_screen(indexed=True, grayscale=True)
+
+
+def test_env_max_pool(generate_test_env):
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON, max_pool=True, frameskip=3)
+    env.reset()
+    for _ in range(3):
+        before = env.em.get_screen()
+        env.em.step()
+        after = env.em.get_screen()
+        pooled = env.em.get_screen(max_pool=True)
+        assert np.array_equal(pooled, np.maximum(before, after))
+        gray = env.em.get_screen(grayscale=True, downsample=2, max_pool=True)
+        assert gray.shape == env.em.get_screen(grayscale=True, downsample=2).shape
+
+    obs, _, _, _, _ = env.step(env.action_space.sample())
+    assert obs in env.observation_space
+    assert np.all(obs >= env.em.get_screen())
+
+    with pytest.raises(ValueError):
+        env.em.get_screen(grayscale=True, downsample=2, interlace=True, max_pool=True)
+
+    # Otherwise only steps that ask for it keep the screen before their last
+    # frame, and asking for a pooled screen doesn't change that
+    env.em.max_pool = False
+    for _ in range(2):
+        env.em.step()
+        assert np.array_equal(env.em.get_screen(max_pool=True), env.em.get_screen())
+    before = env.em.get_screen()
+    action = np.zeros(env.action_space.shape, env.action_space.dtype)
+    obs = env.em.step_action(env.data, action, env.use_restricted_actions.value, max_pool=True)[0]
+    assert np.array_equal(obs, np.maximum(before, env.em.get_screen()))
+    env.em.step()
+    assert np.array_equal(env.em.get_screen(max_pool=True), env.em.get_screen())
+
+
+def test_env_ram(generate_test_env):
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON)
+    env.reset()
+    memory = env.data.memory
+    blocks = memory.blocks
+    packed = np.concatenate([blocks[offset] for offset in sorted(blocks)])
+    assert np.array_equal(memory.pack(), packed)
+    assert np.array_equal(env.get_ram(), packed)
+    assert memory.packed_size == packed.size
+
+    out = np.zeros(memory.packed_size, np.uint8)
+    assert memory.pack(out=out) is out
+    assert np.array_equal(out, packed)
+    with pytest.raises(ValueError):
+        memory.pack(out=np.zeros(memory.packed_size - 1, np.uint8))
+
+    # The blocks are views of the emulator's memory
+    offset = min(blocks)
+    blocks[offset][0] ^= 0xFF
+    assert memory.pack()[0] == packed[0] ^ 0xFF
+    # ...which stays alive as long as they do
+    data = env.data
+    rom = retro.data.get_romfile_path(env.gamename)
+    emulator = weakref.ref(env.em)
+    env.close()
+    del env, memory
+    assert blocks[offset][0] == packed[0] ^ 0xFF
+    assert emulator() is not None
+
+    # Blocks keep the emulator they came from, while the game data only keeps
+    # the one it is configured for
+    other = retro.RetroEmulator(rom)
+    other.configure_data(data)
+    assert emulator() is not None
+    assert blocks[offset][0] == packed[0] ^ 0xFF
+    assert not np.shares_memory(blocks[offset], data.memory.blocks[offset])
+    del blocks
+    assert emulator() is None
+
+
+def test_vec_emulator(generate_test_env):
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON)
+    rom = retro.data.get_romfile_path(env.gamename)
+    screen = env.em.get_screen()
+    env.close()
+
+    emulators = retro.VecRetroEmulator(rom, num_envs=2)
+    screens = emulators.get_screens()
+    assert screens.shape == (2, *screen.shape)
+    emulators.step(np.zeros((2, 16), dtype=np.uint8))
+    # Each call converts into a new array, which later steps don't write to
+    assert not np.shares_memory(screens, emulators.get_screens())
+
+    # ...or into a preallocated one
+    out = np.zeros_like(screens)
+    emulators.step(np.zeros((2, 16), dtype=np.uint8), out=out)
+    assert np.array_equal(out, emulators.get_screens())
+    out[:] = 0
+    assert emulators.get_screens(out=out) is out
+    assert np.array_equal(out, emulators.get_screens())
+    with pytest.raises(ValueError):
+        emulators.get_screens(out=np.zeros_like(screens[:1]))
+    with pytest.raises(ValueError):
+        emulators.step(np.zeros((2, 16), dtype=np.uint8), out=np.zeros(screens.shape, np.float32))
+
+
+def test_env_variable_vector(generate_test_env):
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON)
+    env.reset()
+    blocks = env.data.memory.blocks
+    names = [
+        name
+        for name, var in env.data.list_variables().items()
+        if any(0 <= var["address"] - offset < block.size for offset, block in blocks.items())
+    ]
+    env.data.set_value("custom", 3)
+    names.append("custom")
+
+    variables = env.data.compile_variables(names)
+    assert variables.names == names
+    assert len(variables) == len(names)
+    for _ in range(10):
+        env.step(env.action_space.sample())
+        info = env.data.lookup_all()
+        values = variables.read()
+        assert values.dtype == np.int64
+        assert list(values) == [info[name] for name in names]
+
+    out = np.zeros(len(names), np.float32)
+    assert variables.read(out=out) is out
+    assert np.array_equal(out, values.astype(np.float32))
+    with pytest.raises(ValueError):
+        variables.read(out=np.zeros(len(names) - 1, np.float32))
+    with pytest.raises(ValueError):
+        variables.read(out=np.zeros(len(names), np.uint8))
+    with pytest.raises(KeyError):
+        env.data.compile_variables(["nonexistent"])
+
+    # Resetting clears custom values, which are found by name again once set
+    env.reset()
+    with pytest.raises(KeyError):
+        variables.read()
+    env.data.set_value("custom", 4)
+    info = env.data.lookup_all()
+    assert list(variables.read()) == [info[name] for name in names]
+
+    # Configuring the data for another emulator makes the vector stale
+    del env.em
+    env.em = retro.RetroEmulator(retro.data.get_romfile_path(env.gamename))
+    env.em.configure_data(env.data)
+    with pytest.raises(RuntimeError):
+        variables.read()
+    assert len(env.data.compile_variables(names[:-1]).read()) == len(names) - 1
+
+
+def test_env_preallocated(generate_test_env):
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON)
+    env.reset()
+
+    screens = np.zeros((2, *env.observation_space.shape), np.uint8)
+    env.em.get_screen(out=screens[1])
+    assert (screens[1] == env.em.get_screen()).all()
+
+    state = bytearray(len(env.em.get_state()))
+    assert env.em.get_state(out=state) == len(state)
+    assert env.em.set_state(bytes(state))
+
+    audio = np.zeros((4096, 2), np.int16)
+    samples = env.em.get_audio(out=audio)
+    assert (audio[:samples] == env.em.get_audio()).all()
+
+    with pytest.raises(ValueError):
+        env.em.get_screen(out=screens)
+
+
+def test_env_state_arena(generate_test_env):
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON)
+    env.reset()
+    size = env.em.get_state_size()
+    arena = retro.StateArena(size)
+    assert arena.slab_size == size
+
+    state = arena.save(env.em)
+    assert len(state) == size
+    saved = env.em.get_state()
+    for _ in range(5):
+        env.step(env.action_space.sample())
+    assert env.em.set_state(state)
+    env.em.step()
+    after = env.em.get_screen()
+    assert env.em.set_state(saved)
+    env.em.step()
+    assert np.array_equal(env.em.get_screen(), after)
+
+    # Any contiguous buffer can be loaded
+    assert env.em.set_state(np.frombuffer(bytes(state), np.uint8))
+    assert env.em.set_state(bytearray(state))
+    with pytest.raises(ValueError):
+        env.em.set_state(np.zeros((size, 2), np.uint8)[:, 0])
+
+    # Slabs of collected states are reused
+    assert arena.used == 1
+    del state
+    assert arena.used == 0
+    capacity = arena.capacity
+    states = [arena.save(env.em) for _ in range(capacity)]
+    assert arena.capacity == capacity
+    del states
+
+    with pytest.raises(ValueError):
+        retro.StateArena(size - 1).save(env.em)
+
+
+def test_env_delta_state(generate_test_env):
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON)
+    env.reset()
+    keyframe = retro.DeltaState(env.em)
+    assert keyframe.depth == 0
+    assert keyframe.parent is None
+    assert len(keyframe) == env.em.get_state_size()
+    assert keyframe.encoded_size <= len(keyframe)
+
+    states = [keyframe]
+    saved = [env.em.get_state()]
+    for _ in range(4):
+        env.step(env.action_space.sample())
+        states.append(retro.DeltaState(env.em, states[-1]))
+        saved.append(env.em.get_state())
+    assert states[-1].depth == 4
+    assert states[-1].parent.depth == 3
+
+    # Restoring any state in the chain matches loading its full copy
+    for state, full in zip(states, saved):
+        assert env.em.set_state(full)
+        env.em.step()
+        expected = env.em.get_screen()
+        assert env.em.set_state(state)
+        env.em.step()
+        assert np.array_equal(env.em.get_screen(), expected)
+
+    restored = bytearray(len(keyframe))
+    assert states[2].restore(restored) == len(keyframe)
+    assert bytes(restored) == states[2].restore()
+
+    # A child of a state that isn't the last one saved or loaded
+    env.em.set_state(saved[1])
+    branch = retro.DeltaState(env.em, states[3])
+    assert env.em.set_state(branch)
+    assert branch.restore() == retro.DeltaState(env.em).restore()
+
+
+def test_env_cached_state(generate_test_env, tmp_path):
+    import gzip
+
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON)
+    env.reset()
+    saved = env.em.get_state()
+    path = str(tmp_path / "test.state")
+    with gzip.open(path, "wb") as f:
+        f.write(saved)
+
+    state = retro.cached_state(path)
+    assert len(state) == len(saved)
+    assert bytes(state) == saved
+    view = memoryview(state)
+    assert view.readonly
+    # The same file shares one decompressed copy
+    assert memoryview(retro.cached_state(path)).tobytes() == saved
+    assert env.em.set_state(state)
+
+    with pytest.raises(RuntimeError):
+        retro.cached_state(str(tmp_path / "missing.state"))
+
+
+def test_env_rewind(generate_test_env):
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON)
+    env.reset()
+    with pytest.raises(ValueError):
+        env.em.rewind(1)
+
+    rewind = retro.RewindBuffer(60, interval=8)
+    env.em.rewind_buffer = rewind
+    assert env.em.rewind_buffer is rewind
+    assert rewind.available == 0
+    env.em.rewind(0)
+
+    actions = [env.action_space.sample() for _ in range(40)]
+    rams = []
+    screens = []
+    for action in actions:
+        env.step(action)
+        rams.append(env.get_ram().copy())
+        screens.append(env.em.get_screen().copy())
+    # The frame of the oldest keyframe can't be drawn again
+    assert rewind.available == 39
+
+    # Back to the frame after the 30th step, then the same steps again
+    env.em.rewind(10)
+    assert rewind.available == 29
+    assert np.array_equal(env.get_ram(), rams[29])
+    assert np.array_equal(env.em.get_screen(), screens[29])
+    for action, ram in zip(actions[30:], rams[30:]):
+        env.step(action)
+        assert np.array_equal(env.get_ram(), ram)
+
+    # Frame 32 has a keyframe of its own, and is still drawn
+    env.em.rewind(8)
+    assert np.array_equal(env.get_ram(), rams[31])
+    assert np.array_equal(env.em.get_screen(), screens[31])
+
+    with pytest.raises(ValueError):
+        env.em.rewind(32)
+
+    # Loading a state starts over
+    env.em.set_state(env.em.get_state())
+    assert rewind.available == 0
+    env.em.rewind_buffer = None
+
+
+def test_env_audio_features(generate_test_env):
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON)
+    env.reset()
+
+    # At the emulator's own rate the samples are just the downmix
+    samples = retro.AudioFeatures(env.em.get_audio_rate(), 4096)
+    env.em.audio_features = samples
+    assert env.em.audio_features is samples
+    for _ in range(3):
+        env.em.step()
+    audio = env.em.get_audio().astype(np.float32)
+    mono = (audio[:, 0] + audio[:, 1]) * (0.5 / 32768)
+    assert samples.shape == (4096, 1)
+    assert np.allclose(samples.features[len(samples.features) - len(mono) :, 0], mono)
+
+    mel = retro.AudioFeatures(16000, 8, kind="mel", fft_size=256, bins=32)
+    env.em.audio_features = mel
+    env.step(env.action_space.sample())
+    out = np.empty(mel.shape, np.float32)
+    assert mel.read(out=out) is out
+    assert np.array_equal(out, mel.features)
+    assert np.isfinite(out).all()
+    assert not mel.features.flags.writeable
+
+    # Audio from before a loaded state doesn't carry over
+    env.em.set_state(env.em.get_state())
+    assert not mel.read().any()
+
+    env.em.audio_features = None
+    with pytest.raises(ValueError):
+        retro.AudioFeatures(16000, 8, kind="wavelet")
+    with pytest.raises(ValueError):
+        mel.read(out=np.empty(mel.shape, np.float64))
+
+
+def test_env_crop(generate_test_env):
+    env = generate_test_env(info=DUMMY_JSON, scenario=DUMMY_JSON)
+    env.reset()
+
+    screen = env.em.get_screen()
+    assert (env.em.get_screen(crop=(2, 4, 16, 8)) == screen[4:12, 2:18]).all()
+    assert (env.em.get_screen(crop=(2, 4, 0, 0)) == screen[4:, 2:]).all()